@@ -0,0 +1,205 @@
+#include "access_log.h"
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// FNV-1a with a splitmix64 finalizer. Independent of the ring's std::hash, so a sample isn't one arc of the ring
+uint64_t sampleHash(std::string_view key) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+const std::string HEADER_PREFIX = "# cachemesh-access-log";
+
+int hexDigit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+}
+
+AccessLog::AccessLog(const AccessLogOptions& options, const std::string& node)
+    : options_(options), node_(node), threshold_(sampleThreshold(options.sample_rate)) {}
+
+AccessLog::~AccessLog() {
+    stop();
+}
+
+uint64_t AccessLog::sampleThreshold(double rate) {
+    if (!(rate > 0)) {
+        return 0;
+    }
+    if (rate >= 1) {
+        return std::numeric_limits<uint64_t>::max();
+    }
+    return static_cast<uint64_t>(std::ldexp(rate, 64));
+}
+
+bool AccessLog::sampled(std::string_view key, uint64_t threshold) {
+    return threshold == std::numeric_limits<uint64_t>::max() || sampleHash(key) < threshold;
+}
+
+void AccessLog::start() {
+    if (!enabled() || running_) {
+        return;
+    }
+    file_.open(options_.path, std::ios::app);
+    if (!file_) {
+        throw std::runtime_error("Failed to open access log: " + options_.path);
+    }
+    // one header per run, a restarted node appends a new one
+    file_ << header(node_, options_.sample_rate) << '\n';
+    running_ = true;
+    thread_ = std::thread(&AccessLog::loop, this);
+}
+
+void AccessLog::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void AccessLog::record(AccessOp op, std::string_view key, uint64_t bytes) {
+    if (!running_ || !sampled(key, threshold_)) {
+        return;
+    }
+    int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffer_.size() >= options_.max_buffered) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer_.push_back(AccessRecord{now, op, bytes, std::string(key)});
+}
+
+void AccessLog::loop() {
+    std::vector<AccessRecord> records;
+    bool running = true;
+    while (running) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait_for(lock, options_.flush_interval, [this]() { return !running_; });
+            running = running_;
+            records.swap(buffer_);
+        }
+        if (!records.empty() && !flush(records)) {
+            std::cerr << "Failed to write access log " << options_.path << ", " << records.size() << " records lost" << std::endl;
+        }
+        records.clear();
+    }
+    file_.close();
+}
+
+bool AccessLog::flush(std::vector<AccessRecord>& records) {
+    std::string out;
+    for (const auto& record : records) {
+        out += format(record);
+        out += '\n';
+    }
+    file_.write(out.data(), static_cast<std::streamsize>(out.size()));
+    file_.flush();
+    if (!file_) {
+        file_.clear();
+        return false;
+    }
+    return true;
+}
+
+std::string AccessLog::header(const std::string& node, double rate) {
+    std::ostringstream out;
+    out << HEADER_PREFIX << " node=" << node << " sample_rate=" << rate;
+    return out.str();
+}
+
+bool AccessLog::parseHeader(const std::string& line, std::string& node, double& rate) {
+    if (line.rfind(HEADER_PREFIX, 0) != 0) {
+        return false;
+    }
+    std::size_t node_at = line.find(" node=");
+    std::size_t at = line.find(" sample_rate=");
+    if (node_at == std::string::npos || at == std::string::npos || at < node_at) {
+        return false;
+    }
+    node = line.substr(node_at + std::string(" node=").size(), at - node_at - std::string(" node=").size());
+    try {
+        rate = std::stod(line.substr(at + std::string(" sample_rate=").size()));
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+std::string AccessLog::format(const AccessRecord& record) {
+    static const char* digits = "0123456789abcdef";
+    std::string line = std::to_string(record.time_us);
+    line += '\t';
+    line += static_cast<char>(record.op);
+    line += '\t';
+    line += std::to_string(record.bytes);
+    line += '\t';
+    // hex, keys may hold tabs, newlines and the NUL bytes of namespaced keys
+    for (unsigned char c : record.key) {
+        line += digits[c >> 4];
+        line += digits[c & 0xf];
+    }
+    return line;
+}
+
+bool AccessLog::parse(const std::string& line, AccessRecord& record) {
+    std::size_t first = line.find('\t');
+    std::size_t second = first == std::string::npos ? first : line.find('\t', first + 1);
+    std::size_t third = second == std::string::npos ? second : line.find('\t', second + 1);
+    if (third == std::string::npos || second != first + 2) {
+        return false;
+    }
+    char op = line[first + 1];
+    if (op != 'G' && op != 'P' && op != 'R') {
+        return false;
+    }
+    std::size_t key_length = line.size() - third - 1;
+    if (key_length % 2 != 0) {
+        return false;
+    }
+    try {
+        record.time_us = std::stoll(line.substr(0, first));
+        record.bytes = std::stoull(line.substr(second + 1, third - second - 1));
+    } catch (const std::exception&) {
+        return false;
+    }
+    record.op = static_cast<AccessOp>(op);
+    record.key.resize(key_length / 2);
+    for (std::size_t i = 0; i < record.key.size(); ++i) {
+        int high = hexDigit(line[third + 1 + 2 * i]);
+        int low = hexDigit(line[third + 2 + 2 * i]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        record.key[i] = static_cast<char>(high << 4 | low);
+    }
+    return true;
+}
@@ -0,0 +1,93 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct AccessLogOptions {
+    // file the sampled accesses are appended to, empty disables the log
+    std::string path;
+    // fraction of keys whose accesses are logged. Sampling by key rather than by request keeps every access of a
+    // sampled key, which the simulator's reuse distances need (SHARDS)
+    double sample_rate = 0.01;
+    // records held between two writes to the file, more are dropped
+    std::size_t max_buffered = 100000;
+    std::chrono::milliseconds flush_interval{1000};
+};
+
+enum class AccessOp : char {
+    GET = 'G',
+    // writes of any kind, read-modify-writes included
+    PUT = 'P',
+    REMOVE = 'R'
+};
+
+struct AccessRecord {
+    // wall clock, so the logs of all nodes merge into one trace
+    int64_t time_us = 0;
+    AccessOp op = AccessOp::GET;
+    // value bytes, 0 for a miss or a remove
+    uint64_t bytes = 0;
+    // stored form, namespace included
+    std::string key;
+};
+
+// sampled key access trace of a node, one "time_us<TAB>op<TAB>bytes<TAB>hex key" line per access after a
+// "# cachemesh-access-log" header naming the sample rate. Every client request is logged once, by the node
+// that serves it, so the logs of all nodes together are the cluster's trace. Recording only appends to a
+// buffer, a thread of its own writes it out
+class AccessLog {
+private:
+    AccessLogOptions options_;
+    std::string node_;
+    uint64_t threshold_;
+    // only the flush thread writes once started
+    std::ofstream file_;
+
+    std::mutex mutex_;
+    std::vector<AccessRecord> buffer_;
+    std::atomic<uint64_t> dropped_{0};
+
+    std::atomic<bool> running_{false};
+    std::condition_variable cv_;
+    std::thread thread_;
+
+    void loop();
+    bool flush(std::vector<AccessRecord>& records);
+
+public:
+    AccessLog(const AccessLogOptions& options, const std::string& node);
+    ~AccessLog();
+    AccessLog(const AccessLog&) = delete;
+    AccessLog& operator=(const AccessLog&) = delete;
+
+    // opens the file, throws if it can't
+    void start();
+    void stop();
+
+    bool enabled() const { return !options_.path.empty() && threshold_ > 0; }
+    void record(AccessOp op, std::string_view key, uint64_t bytes);
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    // the same keys on every node and in the simulator, a smaller rate picks a subset of a larger one's keys
+    static uint64_t sampleThreshold(double rate);
+    static bool sampled(std::string_view key, uint64_t threshold);
+
+    static std::string header(const std::string& node, double rate);
+    // the node and sample rate of a header line, false for anything else
+    static bool parseHeader(const std::string& line, std::string& node, double& rate);
+    static std::string format(const AccessRecord& record);
+    // false for a malformed line
+    static bool parse(const std::string& line, AccessRecord& record);
+};
+
+#endif
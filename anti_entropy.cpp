@@ -0,0 +1,423 @@
+#include "anti_entropy.h"
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+// splitmix64 finalizer, spreads nearby inputs over the whole 64-bit space
+uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+constexpr auto RPC_DEADLINE = std::chrono::seconds(5);
+
+}
+
+std::vector<uint64_t> MerkleTree::snapshot() const {
+    std::vector<uint64_t> nodes(2 * LEAVES - 1);
+    std::size_t first_leaf = LEAVES - 1;
+    for (uint32_t i = 0; i < LEAVES; ++i) {
+        nodes[first_leaf + i] = leaves_[i].load(std::memory_order_relaxed);
+    }
+    // parents from the bottom up, the rotate keeps the combination order sensitive
+    for (std::size_t i = first_leaf; i-- > 0;) {
+        uint64_t left = nodes[2 * i + 1];
+        uint64_t right = nodes[2 * i + 2];
+        nodes[i] = mix64(left ^ ((right << 1) | (right >> 63)));
+    }
+    return nodes;
+}
+
+AntiEntropy::AntiEntropy(const std::string& self,
+                         ConsistentHash& ring,
+                         LRUCache<std::string, std::string>& cache,
+                         std::size_t replica_count,
+                         std::chrono::seconds interval,
+                         std::size_t max_departed,
+                         ChannelFactory channel_factory,
+                         ApplyEntry apply_entry)
+    : self_(self)
+    , ring_(ring)
+    , cache_(cache)
+    , interval_(interval)
+    , channel_factory_(std::move(channel_factory))
+    , apply_entry_(std::move(apply_entry))
+    , ranges_(ring.getRanges(replica_count))
+    , max_departed_(max_departed) {
+
+    trees_.resize(ranges_.size());
+    std::size_t owned = 0;
+    for (std::size_t i = 0; i < ranges_.size(); ++i) {
+        const auto& replicas = ranges_[i].replicas;
+        if (std::find(replicas.begin(), replicas.end(), self_) == replicas.end()) {
+            continue;
+        }
+        trees_[i] = std::make_unique<MerkleTree>();
+        ++owned;
+        for (const auto& replica : replicas) {
+            if (replica != self_) {
+                shared_ranges_[replica].push_back(i);
+            }
+        }
+    }
+    std::cout << "Anti-entropy tracking " << owned << " of " << ranges_.size() << " ring ranges" << std::endl;
+}
+
+AntiEntropy::~AntiEntropy() {
+    stop();
+}
+
+void AntiEntropy::start() {
+    if (interval_.count() <= 0 || running_) {
+        return;
+    }
+    running_ = true;
+    sync_thread_ = std::thread(&AntiEntropy::syncLoop, this);
+}
+
+void AntiEntropy::stop() {
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        running_ = false;
+    }
+    cv_.notify_one();
+    if (sync_thread_.joinable()) {
+        sync_thread_.join();
+    }
+}
+
+std::size_t AntiEntropy::rangeForHash(std::size_t hash) const {
+    // same rule as ConsistentHash::getNodes: the first virtual node at or after the hash, wrapping around
+    auto it = std::lower_bound(ranges_.begin(), ranges_.end(), hash,
+        [](const ConsistentHash::Range& range, std::size_t value) { return range.end < value; });
+    if (it == ranges_.end()) {
+        return 0;
+    }
+    return static_cast<std::size_t>(it - ranges_.begin());
+}
+
+std::size_t AntiEntropy::rangeForEnd(std::size_t range_end) const {
+    std::size_t index = rangeForHash(range_end);
+    if (index < ranges_.size() && ranges_[index].end == range_end) {
+        return index;
+    }
+    return ranges_.size();
+}
+
+uint32_t AntiEntropy::leafFor(const ConsistentHash::Range& range, std::size_t hash) {
+    // offsets are taken modulo 2^64 so the arc wrapping past zero needs no special case
+    uint64_t offset = static_cast<uint64_t>(hash - range.start);
+    uint64_t width = static_cast<uint64_t>(range.end - range.start);
+    unsigned __int128 span = width == 0 ? (static_cast<unsigned __int128>(1) << 64) : width;
+    // the arc is (start, end], so offset is in [1, width]
+    return static_cast<uint32_t>((static_cast<unsigned __int128>(offset - 1) * MerkleTree::LEAVES) / span);
+}
+
+uint64_t AntiEntropy::digest(std::size_t key_hash, uint64_t version) {
+    return mix64(static_cast<uint64_t>(key_hash) ^ mix64(version + 0x9e3779b97f4a7c15ULL));
+}
+
+void AntiEntropy::toggle(std::size_t key_hash, uint64_t version) {
+    std::size_t range = rangeForHash(key_hash);
+    if (trees_[range]) {
+        trees_[range]->toggle(leafFor(ranges_[range], key_hash), digest(key_hash, version));
+    }
+}
+
+void AntiEntropy::onCacheEvent(CacheEvent event, std::string_view key, uint64_t version, std::chrono::steady_clock::time_point expiry) {
+    if (ranges_.empty()) {
+        return;
+    }
+    std::size_t hash = ring_.computeHash(key);
+    if (!trees_[rangeForHash(hash)]) {
+        return;
+    }
+    switch (event) {
+        case CacheEvent::INSERTED:
+        case CacheEvent::TOMBSTONED: {
+            // an insert or tombstone adds its digest, in place of the one of an evicted entry of the key
+            std::lock_guard<std::mutex> lock(departed_mutex_);
+            auto it = departed_.find(hash);
+            if (it != departed_.end()) {
+                forgetDepartedLocked(it);
+            }
+            toggle(hash, version);
+            break;
+        }
+        case CacheEvent::EVICTED: {
+            std::lock_guard<std::mutex> lock(departed_mutex_);
+            if (max_departed_ == 0) {
+                toggle(hash, version);
+                break;
+            }
+            auto it = departed_.find(hash);
+            if (it != departed_.end()) {
+                forgetDepartedLocked(it);
+            }
+            departed_.emplace(hash, Departed{version, departed_by_expiry_.emplace(expiry, hash)});
+            if (departed_.size() > max_departed_) {
+                forgetDepartedLocked(departed_.find(departed_by_expiry_.begin()->second));
+            }
+            break;
+        }
+        default:
+            // replaced, removed, expired or a dropped tombstone: the digest goes again
+            toggle(hash, version);
+            break;
+    }
+}
+
+void AntiEntropy::forgetDepartedLocked(std::unordered_map<std::size_t, Departed>::iterator it) {
+    toggle(it->first, it->second.version);
+    departed_by_expiry_.erase(it->second.by_expiry);
+    departed_.erase(it);
+}
+
+uint64_t AntiEntropy::departedVersion(std::size_t key_hash) {
+    std::lock_guard<std::mutex> lock(departed_mutex_);
+    auto it = departed_.find(key_hash);
+    return it == departed_.end() ? 0 : it->second.version;
+}
+
+void AntiEntropy::pruneDeparted() {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(departed_mutex_);
+    while (!departed_by_expiry_.empty() && departed_by_expiry_.begin()->first <= now) {
+        forgetDepartedLocked(departed_.find(departed_by_expiry_.begin()->second));
+    }
+}
+
+std::vector<AntiEntropy::LeafEntry> AntiEntropy::collectLeafEntries(const std::unordered_set<uint64_t>& leaves) {
+    std::vector<LeafEntry> entries;
+    if (leaves.empty() || ranges_.empty()) {
+        return entries;
+    }
+
+    // a full scan under the cache lock, bounded by the cache capacity and only run for differing leaves
+    auto now = std::chrono::steady_clock::now();
+    cache_.forEach([&](std::string_view key, std::string_view value, uint64_t version,
+                       std::chrono::steady_clock::time_point expiry) {
+        if (expiry <= now) {
+            return;
+        }
+        std::size_t hash = ring_.computeHash(key);
+        std::size_t range = rangeForHash(hash);
+        if (leaves.count(leafId(range, leafFor(ranges_[range], hash)))) {
+            entries.push_back(LeafEntry{std::string(key), version, false});
+        }
+    });
+    cache_.forEachTombstone([&](std::string_view key, uint64_t version, std::chrono::steady_clock::time_point expiry) {
+        if (expiry <= now) {
+            return;
+        }
+        std::size_t hash = ring_.computeHash(key);
+        std::size_t range = rangeForHash(hash);
+        if (leaves.count(leafId(range, leafFor(ranges_[range], hash)))) {
+            entries.push_back(LeafEntry{std::string(key), version, true});
+        }
+    });
+    return entries;
+}
+
+grpc::Status AntiEntropy::getMerkleNodes(const distributed_cache::MerkleNodesRequest& request, distributed_cache::MerkleNodesResponse* response) {
+    // one snapshot per range, even when several of its nodes are requested
+    std::unordered_map<std::size_t, std::vector<uint64_t>> snapshots;
+    for (const auto& node : request.nodes()) {
+        std::size_t range = rangeForEnd(node.range_end());
+        if (range == ranges_.size() || !trees_[range] || node.level() > MerkleTree::DEPTH || node.index() >= (1u << node.level())) {
+            continue;
+        }
+        auto it = snapshots.find(range);
+        if (it == snapshots.end()) {
+            it = snapshots.emplace(range, trees_[range]->snapshot()).first;
+        }
+        auto* reply = response->add_nodes();
+        *reply = node;
+        reply->set_hash(it->second[MerkleTree::position(node.level(), node.index())]);
+    }
+    return grpc::Status::OK;
+}
+
+grpc::Status AntiEntropy::getBucketEntries(const distributed_cache::BucketEntriesRequest& request, distributed_cache::BucketEntriesResponse* response) {
+    std::unordered_set<uint64_t> leaves;
+    for (const auto& leaf : request.leaves()) {
+        std::size_t range = rangeForEnd(leaf.range_end());
+        if (range == ranges_.size() || leaf.level() != MerkleTree::DEPTH || leaf.index() >= MerkleTree::LEAVES) {
+            continue;
+        }
+        leaves.insert(leafId(range, leaf.index()));
+    }
+
+    for (auto& leaf_entry : collectLeafEntries(leaves)) {
+        auto* entry = response->add_entries();
+        entry->set_key(std::move(leaf_entry.key));
+        entry->set_version(leaf_entry.version);
+        entry->set_removed(leaf_entry.removed);
+    }
+    return grpc::Status::OK;
+}
+
+grpc::Status AntiEntropy::fetchEntries(const distributed_cache::FetchEntriesRequest& request, grpc::ServerWriter<distributed_cache::CacheEntry>* writer) {
+    distributed_cache::CacheEntry entry;
+    for (const auto& key : request.keys()) {
+        std::string value;
+        uint64_t version = 0;
+        int64_t ttl = 0;
+        entry.Clear();
+        if (cache_.peek(key, value, version, ttl)) {
+            entry.set_value(std::move(value));
+            entry.set_ttl(ttl);
+        } else if (cache_.tombstone(key, version)) {
+            entry.set_removed(true);
+        } else {
+            // evicted or expired since the digest was sent
+            continue;
+        }
+        entry.set_key(key);
+        entry.set_version(version);
+        if (!writer->Write(entry)) {
+            break;
+        }
+    }
+    return grpc::Status::OK;
+}
+
+std::size_t AntiEntropy::syncWith(const std::string& peer) {
+    auto shared = shared_ranges_.find(peer);
+    if (shared == shared_ranges_.end()) {
+        return 0;
+    }
+    auto stub = distributed_cache::DistributedCache::NewStub(channel_factory_(peer));
+
+    // start from the roots of every range both of us replicate
+    std::unordered_map<std::size_t, std::vector<uint64_t>> snapshots;
+    distributed_cache::MerkleNodesRequest request;
+    for (std::size_t range : shared->second) {
+        snapshots.emplace(range, trees_[range]->snapshot());
+        auto* node = request.add_nodes();
+        node->set_range_end(ranges_[range].end);
+        node->set_level(0);
+        node->set_index(0);
+    }
+
+    // descend level by level, only into children of nodes whose hashes differ
+    distributed_cache::BucketEntriesRequest bucket_request;
+    std::unordered_set<uint64_t> differing_leaves;
+    for (uint32_t level = 0; level <= MerkleTree::DEPTH && request.nodes_size() > 0; ++level) {
+        distributed_cache::MerkleNodesResponse response;
+        grpc::ClientContext context;
+        context.set_deadline(std::chrono::system_clock::now() + RPC_DEADLINE);
+        grpc::Status status = stub->GetMerkleNodes(&context, request, &response);
+        if (!status.ok()) {
+            std::cout << "Anti-entropy with " << peer << " failed: " << status.error_message() << std::endl;
+            return 0;
+        }
+
+        distributed_cache::MerkleNodesRequest next;
+        for (const auto& node : response.nodes()) {
+            std::size_t range = rangeForEnd(node.range_end());
+            auto snapshot = snapshots.find(range);
+            if (snapshot == snapshots.end() || node.level() != level) {
+                continue;
+            }
+            if (snapshot->second[MerkleTree::position(level, node.index())] == node.hash()) {
+                continue;
+            }
+            if (level == MerkleTree::DEPTH) {
+                *bucket_request.add_leaves() = node;
+                differing_leaves.insert(leafId(range, node.index()));
+                continue;
+            }
+            for (uint32_t child = 0; child < 2; ++child) {
+                auto* next_node = next.add_nodes();
+                next_node->set_range_end(node.range_end());
+                next_node->set_level(level + 1);
+                next_node->set_index(node.index() * 2 + child);
+            }
+        }
+        request = std::move(next);
+    }
+
+    if (differing_leaves.empty()) {
+        return 0;
+    }
+
+    // compare key versions inside the differing leaves
+    distributed_cache::BucketEntriesResponse bucket_response;
+    {
+        grpc::ClientContext context;
+        context.set_deadline(std::chrono::system_clock::now() + RPC_DEADLINE);
+        grpc::Status status = stub->GetBucketEntries(&context, bucket_request, &bucket_response);
+        if (!status.ok()) {
+            std::cout << "Anti-entropy with " << peer << " failed: " << status.error_message() << std::endl;
+            return 0;
+        }
+    }
+
+    std::unordered_map<std::string, uint64_t> local_versions;
+    for (auto& leaf_entry : collectLeafEntries(differing_leaves)) {
+        local_versions.emplace(std::move(leaf_entry.key), leaf_entry.version);
+    }
+
+    // pull what the peer has newer; what we have newer is pulled by the peer on its own round.
+    // An evicted entry counts as held, or every eviction would be undone by the next round
+    distributed_cache::FetchEntriesRequest fetch_request;
+    for (const auto& entry : bucket_response.entries()) {
+        auto it = local_versions.find(entry.key());
+        uint64_t local = it != local_versions.end() ? it->second : departedVersion(ring_.computeHash(entry.key()));
+        // a tombstone only matters where there is something older to remove
+        bool pull = entry.removed() ? local != 0 && local < entry.version() : local < entry.version();
+        if (pull) {
+            fetch_request.add_keys(entry.key());
+        }
+    }
+    if (fetch_request.keys_size() == 0) {
+        return 0;
+    }
+
+    std::size_t pulled = 0;
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + RPC_DEADLINE);
+    auto reader = stub->FetchEntries(&context, fetch_request);
+    distributed_cache::CacheEntry entry;
+    while (reader->Read(&entry)) {
+        if (apply_entry_(entry)) {
+            ++pulled;
+        }
+    }
+    grpc::Status status = reader->Finish();
+    if (!status.ok()) {
+        std::cout << "Anti-entropy fetch from " << peer << " ended early: " << status.error_message() << std::endl;
+    }
+
+    keys_repaired_ += pulled;
+    return pulled;
+}
+
+void AntiEntropy::syncLoop() {
+    while (running_) {
+        {
+            std::unique_lock<std::mutex> lock(wait_mutex_);
+            cv_.wait_for(lock, interval_, [this] { return !running_; });
+        }
+        if (!running_) {
+            break;
+        }
+
+        pruneDeparted();
+        for (const auto& [peer, ranges] : shared_ranges_) {
+            if (!running_) {
+                break;
+            }
+            std::size_t pulled = syncWith(peer);
+            if (pulled > 0) {
+                std::cout << "Anti-entropy repaired " << pulled << " keys from " << peer << std::endl;
+            }
+        }
+    }
+}
@@ -0,0 +1,143 @@
+#ifndef ANTI_ENTROPY_H
+#define ANTI_ENTROPY_H
+
+#include "lru.h"
+#include "consistent_hash.h"
+#include "grpcpp/grpcpp.h"
+#include "distributed-cache.grpc.pb.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// fixed-depth Merkle tree over one ring range.
+// a leaf is the XOR of the digests of the entries hashing into it, so a write flips one leaf
+// without looking at the other entries, and internal nodes are only computed when a peer asks
+class MerkleTree {
+public:
+    static constexpr uint32_t DEPTH = 6;
+    static constexpr uint32_t LEAVES = 1u << DEPTH;
+
+    // add or remove a digest, XOR is its own inverse
+    void toggle(uint32_t leaf, uint64_t digest) { leaves_[leaf].fetch_xor(digest, std::memory_order_relaxed); }
+
+    // every node in heap order, the root first and the leaves last
+    std::vector<uint64_t> snapshot() const;
+    static std::size_t position(uint32_t level, uint32_t index) { return ((std::size_t{1} << level) - 1) + index; }
+
+private:
+    std::array<std::atomic<uint64_t>, LEAVES> leaves_{};
+};
+
+// background repair between replicas. Each node keeps a MerkleTree per ring range it replicates,
+// and periodically compares them with every peer sharing a range: only subtrees whose hashes
+// differ are descended, and only keys the peer holds in a newer version are pulled. Tombstones are
+// digested like entries, so a remove a replica missed is pulled too. An evicted entry keeps its digest
+// until it would have expired, since evicting it changed nothing the replicas should agree on
+class AntiEntropy {
+public:
+    using ChannelFactory = std::function<std::shared_ptr<grpc::Channel>(const std::string&)>;
+    // stores a pulled entry or tombstone locally (WAL and cache), false if it was not applied
+    using ApplyEntry = std::function<bool(const distributed_cache::CacheEntry&)>;
+
+private:
+    // a live entry or tombstone of a differing leaf
+    struct LeafEntry {
+        std::string key;
+        uint64_t version;
+        bool removed;
+    };
+
+    // an entry evicted while its digest stays in the tree, by key hash
+    struct Departed {
+        uint64_t version;
+        std::multimap<std::chrono::steady_clock::time_point, std::size_t>::iterator by_expiry;
+    };
+
+    std::string self_;
+    ConsistentHash& ring_;
+    LRUCache<std::string, std::string>& cache_;
+    std::chrono::seconds interval_;
+    ChannelFactory channel_factory_;
+    ApplyEntry apply_entry_;
+
+    // every arc of the ring, sorted by end position; trees_[i] is null for arcs we don't replicate
+    std::vector<ConsistentHash::Range> ranges_;
+    std::vector<std::unique_ptr<MerkleTree>> trees_;
+    // arcs shared with each peer
+    std::unordered_map<std::string, std::vector<std::size_t>> shared_ranges_;
+
+    std::atomic<bool> running_{false};
+    std::thread sync_thread_;
+    std::mutex wait_mutex_;
+    std::condition_variable cv_;
+    std::atomic<std::size_t> keys_repaired_{0};
+
+    // taken under the cache lock by onCacheEvent
+    std::mutex departed_mutex_;
+    std::unordered_map<std::size_t, Departed> departed_;
+    std::multimap<std::chrono::steady_clock::time_point, std::size_t> departed_by_expiry_;
+    // past it the entry closest to expiring is forgotten, its key may then be pulled again
+    std::size_t max_departed_;
+
+    std::size_t rangeForHash(std::size_t hash) const;
+    // index of the arc ending at range_end, ranges_.size() if unknown
+    std::size_t rangeForEnd(std::size_t range_end) const;
+    static uint32_t leafFor(const ConsistentHash::Range& range, std::size_t hash);
+    static uint64_t digest(std::size_t key_hash, uint64_t version);
+    static uint64_t leafId(std::size_t range, uint32_t leaf) { return (static_cast<uint64_t>(range) << MerkleTree::DEPTH) | leaf; }
+
+    // every live entry and tombstone in the given leaves, one pass over the cache
+    std::vector<LeafEntry> collectLeafEntries(const std::unordered_set<uint64_t>& leaves);
+    // adds or removes the digest in the tree of its range, if we replicate that range
+    void toggle(std::size_t key_hash, uint64_t version);
+    // version of an evicted entry of the key, 0 if there is none
+    uint64_t departedVersion(std::size_t key_hash);
+    // caller must hold departed_mutex_
+    void forgetDepartedLocked(std::unordered_map<std::size_t, Departed>::iterator it);
+    // drops the digests of evicted entries that have expired by now
+    void pruneDeparted();
+    void syncLoop();
+
+public:
+    AntiEntropy(const std::string& self,
+                ConsistentHash& ring,
+                LRUCache<std::string, std::string>& cache,
+                std::size_t replica_count,
+                std::chrono::seconds interval,
+                std::size_t max_departed,
+                ChannelFactory channel_factory,
+                ApplyEntry apply_entry);
+    ~AntiEntropy();
+
+    void start();
+    void stop();
+
+    // cache listener hook, runs under the cache lock
+    void onCacheEvent(CacheEvent event, std::string_view key, uint64_t version, std::chrono::steady_clock::time_point expiry);
+
+    // server side of the exchange
+    grpc::Status getMerkleNodes(const distributed_cache::MerkleNodesRequest& request, distributed_cache::MerkleNodesResponse* response);
+    grpc::Status getBucketEntries(const distributed_cache::BucketEntriesRequest& request, distributed_cache::BucketEntriesResponse* response);
+    grpc::Status fetchEntries(const distributed_cache::FetchEntriesRequest& request, grpc::ServerWriter<distributed_cache::CacheEntry>* writer);
+
+    // one comparison round with a peer, returns how many keys were pulled
+    std::size_t syncWith(const std::string& peer);
+
+    std::size_t keysRepaired() const { return keys_repaired_.load(); }
+};
+
+#endif
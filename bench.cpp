@@ -0,0 +1,516 @@
+// microbenchmarks for the engines under the node: LRU cache, hash ring, WAL, write queue and recovery.
+// every case runs a few repetitions and reports the median, results are written as JSON so runs can be diffed
+
+#include "lru.h"
+#include "consistent_hash.h"
+#include "wal.h"
+#include "write_queue.h"
+#include "recovery.h"
+#include "slab_allocator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace {
+
+// keep the compiler from discarding a result we never read
+template <typename T>
+inline void doNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct BenchConfig {
+    std::string filter;
+    std::string out_path = "bench_results.json";
+    std::size_t repetitions = 3;
+    // multiplies every operation count, below 1 for quick smoke runs
+    double scale = 1.0;
+    std::filesystem::path scratch_dir;
+};
+
+struct BenchResult {
+    std::string name;
+    // "key=value" pairs describing the case
+    std::vector<std::pair<std::string, std::string>> params;
+    std::size_t threads = 1;
+    uint64_t operations = 0;
+    uint64_t bytes = 0;
+    // one duration per repetition, in seconds
+    std::vector<double> samples;
+
+    double median() const {
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+};
+
+// what one repetition did, the body times only the part being measured
+struct Run {
+    double seconds = 0;
+    uint64_t operations = 0;
+    uint64_t bytes = 0;
+};
+
+class Timer {
+    std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+public:
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+};
+
+std::vector<std::string> makeKeys(std::size_t count, std::size_t key_size, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        // unique prefix, random-ish filler up to the requested size
+        std::string key = "key" + std::to_string(i) + ":";
+        while (key.size() < key_size) {
+            key.push_back(static_cast<char>('a' + rng() % 26));
+        }
+        keys.push_back(std::move(key));
+    }
+    return keys;
+}
+
+std::string paramString(const std::vector<std::pair<std::string, std::string>>& params) {
+    std::string out;
+    for (const auto& [name, value] : params) {
+        out += (out.empty() ? "" : ",") + name + "=" + value;
+    }
+    return out;
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+        }
+        out.push_back(c);
+    }
+    return out;
+}
+
+class BenchRunner {
+    BenchConfig config_;
+    std::vector<BenchResult> results_;
+
+public:
+    explicit BenchRunner(const BenchConfig& config): config_(config) {}
+
+    std::size_t scaled(std::size_t count) const {
+        return std::max<std::size_t>(1, static_cast<std::size_t>(count * config_.scale));
+    }
+    const std::filesystem::path& scratchDir() const { return config_.scratch_dir; }
+
+    void run(const std::string& name,
+             std::vector<std::pair<std::string, std::string>> params,
+             std::size_t threads,
+             const std::function<Run()>& body) {
+        std::string full_name = name + "/" + paramString(params) + (threads > 1 ? ",threads=" + std::to_string(threads) : "");
+        if (!config_.filter.empty() && full_name.find(config_.filter) == std::string::npos) {
+            return;
+        }
+
+        BenchResult result;
+        result.name = name;
+        result.params = std::move(params);
+        result.threads = threads;
+        for (std::size_t i = 0; i < config_.repetitions; ++i) {
+            Run run = body();
+            result.samples.push_back(run.seconds);
+            result.operations = run.operations;
+            result.bytes = run.bytes;
+        }
+
+        double seconds = result.median();
+        std::cout << std::left << std::setw(64) << full_name
+                  << std::right << std::setw(12) << std::fixed << std::setprecision(1)
+                  << (seconds * 1e9 / result.operations) << " ns/op"
+                  << std::setw(14) << std::setprecision(0) << (result.operations / seconds) << " ops/s";
+        if (result.bytes > 0) {
+            std::cout << std::setw(10) << std::setprecision(1) << (result.bytes / seconds / (1024 * 1024)) << " MB/s";
+        }
+        std::cout << std::endl;
+        results_.push_back(std::move(result));
+    }
+
+    bool writeJson() const {
+        std::ofstream out(config_.out_path);
+        if (!out) {
+            std::cerr << "Failed to open " << config_.out_path << std::endl;
+            return false;
+        }
+        out << std::setprecision(9);
+        out << "{\n";
+        out << "  \"timestamp\": " << std::time(nullptr) << ",\n";
+        out << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n";
+#ifdef NDEBUG
+        out << "  \"optimized\": true,\n";
+#else
+        out << "  \"optimized\": false,\n";
+#endif
+        out << "  \"repetitions\": " << config_.repetitions << ",\n";
+        out << "  \"scale\": " << config_.scale << ",\n";
+        out << "  \"results\": [";
+        for (std::size_t i = 0; i < results_.size(); ++i) {
+            const BenchResult& result = results_[i];
+            double seconds = result.median();
+            out << (i == 0 ? "\n" : ",\n");
+            out << "    {\"name\": \"" << jsonEscape(result.name) << "\", \"params\": {";
+            for (std::size_t p = 0; p < result.params.size(); ++p) {
+                out << (p == 0 ? "" : ", ") << "\"" << jsonEscape(result.params[p].first) << "\": \""
+                    << jsonEscape(result.params[p].second) << "\"";
+            }
+            out << "}, \"threads\": " << result.threads
+                << ", \"operations\": " << result.operations
+                << ", \"bytes\": " << result.bytes
+                << ", \"median_seconds\": " << seconds
+                << ", \"ns_per_op\": " << seconds * 1e9 / result.operations
+                << ", \"ops_per_sec\": " << result.operations / seconds
+                << ", \"samples\": [";
+            for (std::size_t s = 0; s < result.samples.size(); ++s) {
+                out << (s == 0 ? "" : ", ") << result.samples[s];
+            }
+            out << "]}";
+        }
+        out << "\n  ]\n}\n";
+        std::cout << "Wrote " << results_.size() << " results to " << config_.out_path << std::endl;
+        return true;
+    }
+};
+
+// runs body(thread_index) on every thread at once and returns the wall time until the last one finishes
+double runThreads(std::size_t threads, const std::function<void(std::size_t)>& body) {
+    std::atomic<std::size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            body(t);
+        });
+    }
+    while (ready.load() < threads) {
+        std::this_thread::yield();
+    }
+    Timer timer;
+    go.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return timer.seconds();
+}
+
+void benchLRU(BenchRunner& runner) {
+    const std::size_t capacity = 100000;
+    const std::size_t operations = runner.scaled(1000000);
+
+    for (std::size_t key_size : {16, 64}) {
+        for (std::size_t value_size : {64, 1024}) {
+            std::vector<std::pair<std::string, std::string>> params = {
+                {"key_size", std::to_string(key_size)}, {"value_size", std::to_string(value_size)}};
+            std::vector<std::string> keys = makeKeys(capacity, key_size, 1);
+            // four times the capacity, so nearly every put evicts once the cache is full
+            std::vector<std::string> evict_keys = makeKeys(capacity * 4, key_size, 2);
+            std::string value(value_size, 'v');
+
+            runner.run("lru_put", params, 1, [&]() {
+                LRUCache<std::string, std::string> cache(capacity);
+                Timer timer;
+                for (std::size_t i = 0; i < operations; ++i) {
+                    cache.put(keys[i % keys.size()], value);
+                }
+                return Run{timer.seconds(), operations, operations * (key_size + value_size)};
+            });
+
+            runner.run("lru_get_hit", params, 1, [&]() {
+                LRUCache<std::string, std::string> cache(capacity);
+                for (const auto& key : keys) {
+                    cache.put(key, value);
+                }
+                std::string out;
+                std::mt19937_64 rng(3);
+                Timer timer;
+                for (std::size_t i = 0; i < operations; ++i) {
+                    doNotOptimize(cache.get(keys[rng() % keys.size()], out));
+                }
+                return Run{timer.seconds(), operations, operations * value_size};
+            });
+
+            runner.run("lru_put_evict", params, 1, [&]() {
+                LRUCache<std::string, std::string> cache(capacity);
+                for (std::size_t i = 0; i < capacity; ++i) {
+                    cache.put(evict_keys[i], value);
+                }
+                Timer timer;
+                for (std::size_t i = 0; i < operations; ++i) {
+                    cache.put(evict_keys[(capacity + i) % evict_keys.size()], value);
+                }
+                return Run{timer.seconds(), operations, operations * (key_size + value_size)};
+            });
+
+            // the same churn with the entries in slab pages
+            runner.run("lru_put_evict_slab", params, 1, [&]() {
+                SlabOptions slab_options;
+                slab_options.max_bytes = 1ULL << 30;
+                SlabAllocator slab(slab_options);
+                LRUCache<std::string, std::string> cache(capacity, &slab);
+                for (std::size_t i = 0; i < capacity; ++i) {
+                    cache.put(evict_keys[i], value);
+                }
+                Timer timer;
+                for (std::size_t i = 0; i < operations; ++i) {
+                    cache.put(evict_keys[(capacity + i) % evict_keys.size()], value);
+                }
+                return Run{timer.seconds(), operations, operations * (key_size + value_size)};
+            });
+        }
+    }
+
+    // 90% gets, 10% puts on one shared cache, shows what the single cache mutex costs under contention
+    std::vector<std::string> keys = makeKeys(capacity, 16, 4);
+    std::string value(128, 'v');
+    for (std::size_t threads : {1, 2, 4, 8}) {
+        runner.run("lru_mixed_90_10", {{"key_size", "16"}, {"value_size", "128"}}, threads, [&]() {
+            LRUCache<std::string, std::string> cache(capacity);
+            for (const auto& key : keys) {
+                cache.put(key, value);
+            }
+            std::size_t per_thread = operations / threads;
+            double seconds = runThreads(threads, [&](std::size_t t) {
+                std::mt19937_64 rng(t + 10);
+                std::string out;
+                for (std::size_t i = 0; i < per_thread; ++i) {
+                    uint64_t r = rng();
+                    const std::string& key = keys[(r >> 8) % keys.size()];
+                    if (r % 10 == 0) {
+                        cache.put(key, value);
+                    } else {
+                        doNotOptimize(cache.get(key, out));
+                    }
+                }
+            });
+            return Run{seconds, per_thread * threads, 0};
+        });
+    }
+}
+
+void benchConsistentHash(BenchRunner& runner) {
+    const std::size_t lookups = runner.scaled(1000000);
+    std::vector<std::string> keys = makeKeys(100000, 16, 5);
+
+    for (std::size_t nodes : {3, 10, 50, 100}) {
+        // same virtual node count as Node uses
+        ConsistentHash ring(52);
+        for (std::size_t n = 0; n < nodes; ++n) {
+            ring.addNode("10.0." + std::to_string(n / 256) + "." + std::to_string(n % 256) + ":50051");
+        }
+        for (std::size_t replicas : {1, 3}) {
+            runner.run("hash_get_nodes", {{"nodes", std::to_string(nodes)}, {"replicas", std::to_string(replicas)}}, 1, [&]() {
+                Timer timer;
+                for (std::size_t i = 0; i < lookups; ++i) {
+                    doNotOptimize(ring.getNodes(keys[i % keys.size()], replicas));
+                }
+                return Run{timer.seconds(), lookups, 0};
+            });
+        }
+    }
+}
+
+LogEntry makeEntry(const std::string& key, const std::string& value, uint64_t sequence) {
+    return LogEntry{
+        .op_type = LogEntry::OpType::PUT,
+        .node_id = "bench",
+        .key = key,
+        .value = value,
+        .ttl = 3600,
+        .timestamp = std::chrono::system_clock::now(),
+        .sequence_number = sequence,
+        .version = sequence
+    };
+}
+
+void benchWAL(BenchRunner& runner) {
+    const std::size_t entries = runner.scaled(200000);
+    std::vector<std::string> keys = makeKeys(entries, 16, 6);
+
+    for (std::size_t value_size : {64, 1024}) {
+        std::string value(value_size, 'v');
+        runner.run("wal_serialize_entry", {{"value_size", std::to_string(value_size)}}, 1, [&]() {
+            LogEntry entry = makeEntry(keys[0], value, 1);
+            uint64_t bytes = 0;
+            Timer timer;
+            for (std::size_t i = 0; i < entries; ++i) {
+                entry.key = keys[i];
+                std::string data = WAL::serializeEntry("bench", entry);
+                bytes += data.size();
+                doNotOptimize(data);
+            }
+            return Run{timer.seconds(), entries, bytes};
+        });
+    }
+
+    for (bool use_io_uring : {true, false}) {
+        for (std::size_t batch_size : {1, 100}) {
+            std::string value(128, 'v');
+            std::vector<std::pair<std::string, std::string>> params = {
+                {"batch_size", std::to_string(batch_size)}, {"value_size", "128"},
+                {"prefer_io_uring", use_io_uring ? "true" : "false"}};
+            runner.run("wal_write_batch", params, 1, [&]() {
+                std::filesystem::path dir = runner.scratchDir() / "wal_write_batch";
+                std::filesystem::remove_all(dir);
+                WALOptions options;
+                options.use_io_uring = use_io_uring;
+                // single-entry batches are slow, keep their run short
+                std::size_t count = batch_size == 1 ? entries / 10 : entries;
+                double seconds;
+                {
+                    WAL wal(dir.string(), "bench", options);
+                    std::vector<LogEntry> batch;
+                    Timer timer;
+                    for (std::size_t i = 0; i < count; i += batch_size) {
+                        batch.clear();
+                        for (std::size_t j = i; j < std::min(count, i + batch_size); ++j) {
+                            batch.push_back(makeEntry(keys[j], value, j));
+                        }
+                        wal.writeBatch("bench", batch);
+                    }
+                    // io_uring completes writes after writeBatch returns
+                    wal.drain();
+                    seconds = timer.seconds();
+                }
+                std::filesystem::remove_all(dir);
+                return Run{seconds, count, count * (keys[0].size() + value.size())};
+            });
+        }
+    }
+}
+
+void benchWriteQueue(BenchRunner& runner) {
+    const std::size_t entries = runner.scaled(500000);
+    std::vector<std::string> keys = makeKeys(entries, 16, 7);
+    std::string value(128, 'v');
+
+    for (std::size_t producers : {1, 4}) {
+        runner.run("write_queue_enqueue", {{"value_size", "128"}}, producers, [&]() {
+            std::filesystem::path dir = runner.scratchDir() / "write_queue";
+            std::filesystem::remove_all(dir);
+            WriteQueueOptions options;
+            options.flush_interval = std::chrono::milliseconds(10);
+            std::size_t per_thread = entries / producers;
+            double seconds;
+            {
+                WriteQueue queue(dir.string(), "bench", options);
+                queue.start();
+                // enqueue rate until the last producer returns, a full ring blocks on the flush thread
+                seconds = runThreads(producers, [&](std::size_t t) {
+                    for (std::size_t i = t * per_thread; i < (t + 1) * per_thread; ++i) {
+                        queue.logPut(keys[i], value, 3600, i + 1);
+                    }
+                });
+                queue.stop();
+            }
+            std::filesystem::remove_all(dir);
+            return Run{seconds, per_thread * producers, per_thread * producers * (keys[0].size() + value.size())};
+        });
+    }
+}
+
+void benchRecovery(BenchRunner& runner) {
+    const std::size_t entries = runner.scaled(500000);
+    std::vector<std::string> keys = makeKeys(entries, 16, 8);
+
+    for (std::size_t value_size : {128, 1024}) {
+        std::filesystem::path dir = runner.scratchDir() / ("recovery_" + std::to_string(value_size));
+        std::filesystem::remove_all(dir);
+        std::string value(value_size, 'v');
+        uint64_t log_bytes = 0;
+        {
+            WAL wal(dir.string(), "bench");
+            std::vector<LogEntry> batch;
+            for (std::size_t i = 0; i < entries; i += 100) {
+                batch.clear();
+                // batch count, then a length prefix per entry
+                log_bytes += sizeof(uint32_t);
+                for (std::size_t j = i; j < std::min(entries, i + 100); ++j) {
+                    batch.push_back(makeEntry(keys[j], value, j));
+                    log_bytes += sizeof(uint32_t) + WAL::serializeEntry("bench", batch.back()).size();
+                }
+                wal.writeBatch("bench", batch);
+            }
+        }
+
+        for (std::size_t threads : {1, 4}) {
+            runner.run("recovery_replay", {{"value_size", std::to_string(value_size)}}, threads, [&]() {
+                LRUCache<std::string, std::string> cache(entries);
+                RecoveryManager recovery(dir.string(), threads);
+                Timer timer;
+                recovery.recoverFromWAL("bench", cache);
+                // bytes written to the log, not the preallocated size of its segments
+                return Run{timer.seconds(), entries, log_bytes};
+            });
+        }
+        std::filesystem::remove_all(dir);
+    }
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (name == "--filter") {
+            config.filter = value;
+        } else if (name == "--out") {
+            config.out_path = value;
+        } else if (name == "--repetitions") {
+            config.repetitions = std::max<std::size_t>(1, std::stoull(value));
+        } else if (name == "--scale") {
+            config.scale = std::stod(value);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [options]" << std::endl;
+            std::cerr << "  --filter=TEXT       only run cases whose name/params contain TEXT" << std::endl;
+            std::cerr << "  --out=PATH          JSON results file (default: bench_results.json)" << std::endl;
+            std::cerr << "  --repetitions=N     runs per case, the median is reported (default: 3)" << std::endl;
+            std::cerr << "  --scale=F           multiply operation counts by F (default: 1)" << std::endl;
+            return 1;
+        }
+    }
+
+    config.scratch_dir = std::filesystem::temp_directory_path() / ("cachemesh-bench-" + std::to_string(::getpid()));
+    std::filesystem::create_directories(config.scratch_dir);
+
+    BenchRunner runner(config);
+    benchLRU(runner);
+    benchConsistentHash(runner);
+    benchWAL(runner);
+    benchWriteQueue(runner);
+    benchRecovery(runner);
+
+    std::filesystem::remove_all(config.scratch_dir);
+    return runner.writeJson() ? 0 : 1;
+}
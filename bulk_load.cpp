@@ -0,0 +1,331 @@
+// offline bulk loader for a CacheMesh cluster.
+// reads a dump, works out every key's replicas on the same ring the nodes build and streams large batches
+// straight to each replica through BulkLoad. Nodes neither forward nor replicate what they receive, and each
+// batch costs them one cache lock and one WAL write, so a warm-up is bound by network and disk bandwidth
+
+#include "consistent_hash.h"
+#include "namespaces.h"
+#include "grpcpp/grpcpp.h"
+#include "distributed-cache.grpc.pb.h"
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/util/delimited_message_util.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// what Node builds its ring with
+constexpr std::size_t VIRTUAL_NODES = 52;
+constexpr std::size_t REPLICAS = 3;
+// batches waiting per node before reading the dump stalls
+constexpr std::size_t MAX_QUEUED_BATCHES = 4;
+
+enum class DumpFormat {
+    // key<TAB>value per line, for dumps made by hand or by scripts
+    TSV,
+    // varint length-prefixed BulkRecord messages, for binary values
+    RECORDS
+};
+
+struct BulkOptions {
+    // every member of the ring, in any order
+    std::vector<std::string> nodes;
+    DumpFormat format = DumpFormat::TSV;
+    // for records that don't name one
+    std::string ns;
+    // seconds, 0 takes the namespace's default
+    int64_t ttl = 0;
+    std::size_t batch_records = 1000;
+    std::size_t batch_bytes = 1024 * 1024;
+    std::string path;
+};
+
+std::vector<std::string> splitList(const std::string& value) {
+    std::vector<std::string> items;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+// one BulkLoad stream to a node, written by a thread of its own so a slow node only holds up the
+// reader once its queue is full
+class NodeStream {
+private:
+    std::string address_;
+    const BulkOptions& options_;
+    std::unique_ptr<distributed_cache::DistributedCache::Stub> stub_;
+    grpc::ClientContext context_;
+    distributed_cache::BulkLoadResponse response_;
+    std::unique_ptr<grpc::ClientWriter<distributed_cache::BulkLoadRequest>> writer_;
+    grpc::Status status_;
+
+    // the batch being filled, only touched by the reader
+    distributed_cache::BulkLoadRequest pending_;
+    std::size_t pending_bytes_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<distributed_cache::BulkLoadRequest> queue_;
+    bool closed_ = false;
+    // set once a write failed, the rest of the load for this node is dropped
+    bool broken_ = false;
+    std::thread thread_;
+
+    void run() {
+        while (true) {
+            distributed_cache::BulkLoadRequest batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return closed_ || !queue_.empty(); });
+                if (queue_.empty()) {
+                    break;
+                }
+                batch = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            cv_.notify_all();
+            if (!writer_->Write(batch)) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                broken_ = true;
+                queue_.clear();
+                cv_.notify_all();
+                break;
+            }
+        }
+        writer_->WritesDone();
+        status_ = writer_->Finish();
+    }
+
+public:
+    NodeStream(const std::string& address, const BulkOptions& options) : address_(address), options_(options) {
+        stub_ = distributed_cache::DistributedCache::NewStub(grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
+        writer_ = stub_->BulkLoad(&context_, &response_);
+        thread_ = std::thread(&NodeStream::run, this);
+    }
+
+    void add(const distributed_cache::BulkRecord& record) {
+        *pending_.add_records() = record;
+        pending_bytes_ += record.ByteSizeLong();
+        if (static_cast<std::size_t>(pending_.records_size()) >= options_.batch_records || pending_bytes_ >= options_.batch_bytes) {
+            flush();
+        }
+    }
+
+    void flush() {
+        if (pending_.records_size() == 0) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return broken_ || queue_.size() < MAX_QUEUED_BATCHES; });
+        if (!broken_) {
+            queue_.push_back(std::move(pending_));
+        }
+        lock.unlock();
+        cv_.notify_all();
+        pending_.Clear();
+        pending_bytes_ = 0;
+    }
+
+    void finish() {
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    const grpc::Status& status() const { return status_; }
+    const distributed_cache::BulkLoadResponse& response() const { return response_; }
+};
+
+// next record of the dump, false at its end; throws on a malformed dump
+class DumpReader {
+private:
+    DumpFormat format_;
+    std::istream& in_;
+    google::protobuf::io::IstreamInputStream stream_;
+    uint64_t line_ = 0;
+
+public:
+    DumpReader(DumpFormat format, std::istream& in) : format_(format), in_(in), stream_(&in) {}
+
+    bool next(distributed_cache::BulkRecord& record) {
+        record.Clear();
+        if (format_ == DumpFormat::RECORDS) {
+            bool clean_eof = false;
+            if (google::protobuf::util::ParseDelimitedFromZeroCopyStream(&record, &stream_, &clean_eof)) {
+                return true;
+            }
+            if (!clean_eof) {
+                throw std::runtime_error("truncated or corrupt record");
+            }
+            return false;
+        }
+        std::string line;
+        while (std::getline(in_, line)) {
+            ++line_;
+            if (line.empty()) {
+                continue;
+            }
+            std::size_t tab = line.find('\t');
+            if (tab == std::string::npos) {
+                throw std::runtime_error("line " + std::to_string(line_) + " has no tab");
+            }
+            record.set_key(line.substr(0, tab));
+            record.set_value(line.substr(tab + 1));
+            return true;
+        }
+        return false;
+    }
+};
+
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " --nodes=HOST:PORT[,HOST:PORT...] [options] DUMP" << std::endl;
+    std::cerr << "  --nodes=LIST            every node of the cluster, DUMP may be - for stdin" << std::endl;
+    std::cerr << "  --format=F              tsv (key<TAB>value lines) or records (length-prefixed BulkRecord) (default: tsv)" << std::endl;
+    std::cerr << "  --namespace=NAME        namespace of records that don't name one (default: the default namespace)" << std::endl;
+    std::cerr << "  --ttl=S                 ttl of records that don't set one, 0 takes the namespace's default (default: 0)" << std::endl;
+    std::cerr << "  --batch-records=N       records per batch (default: 1000)" << std::endl;
+    std::cerr << "  --batch-kb=N            bytes per batch, below the 4 MB gRPC message limit (default: 1024)" << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    BulkOptions options;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.rfind("--", 0) != 0) {
+                options.path = arg;
+                continue;
+            }
+            std::size_t eq = arg.find('=');
+            std::string name = arg.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+            if (name == "--nodes") {
+                options.nodes = splitList(value);
+            } else if (name == "--format" && value == "tsv") {
+                options.format = DumpFormat::TSV;
+            } else if (name == "--format" && value == "records") {
+                options.format = DumpFormat::RECORDS;
+            } else if (name == "--namespace") {
+                options.ns = value;
+            } else if (name == "--ttl") {
+                options.ttl = std::stoll(value);
+            } else if (name == "--batch-records") {
+                options.batch_records = std::max<std::size_t>(1, std::stoull(value));
+            } else if (name == "--batch-kb") {
+                options.batch_bytes = std::max<std::size_t>(1, std::stoull(value)) * 1024;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Invalid option value: " << e.what() << std::endl;
+        return 1;
+    }
+    if (options.nodes.empty() || options.path.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::ifstream file;
+    if (options.path != "-") {
+        file.open(options.path, std::ios::binary);
+        if (!file) {
+            std::cerr << "Cannot open " << options.path << std::endl;
+            return 1;
+        }
+    }
+    std::istream& in = options.path == "-" ? std::cin : file;
+
+    ConsistentHash ring(VIRTUAL_NODES);
+    std::map<std::string, std::unique_ptr<NodeStream>> streams;
+    for (const auto& node : options.nodes) {
+        ring.addNode(node);
+        streams[node] = std::make_unique<NodeStream>(node, options);
+    }
+
+    // one version for the whole load, the same on every replica; a write made after the load started wins
+    uint64_t version = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count()) << 8;
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    bool failed = false;
+    try {
+        DumpReader reader(options.format, in);
+        distributed_cache::BulkRecord record;
+        while (reader.next(record)) {
+            if (record.namespace_().empty()) {
+                record.set_namespace_(options.ns);
+            }
+            if (record.ttl() == 0) {
+                record.set_ttl(options.ttl);
+            }
+            if (record.version() == 0) {
+                record.set_version(version);
+            }
+            // requests name the default namespace with an empty string
+            if (record.namespace_() == DEFAULT_NAMESPACE) {
+                record.clear_namespace_();
+            }
+            // the ring places namespaced keys by their stored form, like the nodes do
+            std::string stored_key = namespacedKey(record.namespace_(), record.key());
+            for (const auto& owner : ring.getNodes(stored_key, REPLICAS)) {
+                streams[owner]->add(record);
+            }
+            ++records;
+            bytes += record.key().size() + record.value().size();
+            if (records % 1000000 == 0) {
+                std::cout << records << " records read" << std::endl;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Bad dump after " << records << " records: " << e.what() << std::endl;
+        failed = true;
+    }
+
+    for (auto& [address, stream] : streams) {
+        stream->finish();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (const auto& [address, stream] : streams) {
+        const auto& response = stream->response();
+        if (!stream->status().ok()) {
+            std::cerr << address << ": " << stream->status().error_message() << std::endl;
+            failed = true;
+        }
+        std::cout << address << ": " << response.loaded() << " loaded, " << response.stale() << " stale, "
+                  << response.misrouted() << " misrouted, " << response.rejected() << " rejected" << std::endl;
+    }
+    std::cout << records << " records (" << bytes / (1024.0 * 1024.0) << " MB) in " << seconds << " s, "
+              << (seconds > 0 ? records / seconds : 0) << " records/s" << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,258 @@
+#include "cache_arena.h"
+#include <boost/crc.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <tuple>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char ARENA_MAGIC[8] = {'C', 'M', 'A', 'R', 'E', 'N', 'A', '\0'};
+
+int64_t wallClockMillis(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+}
+
+}
+
+CacheArena::CacheArena(const std::string& path, const std::string& node_id, std::size_t slot_count, std::size_t slot_size)
+    : path_(path)
+    , node_id_(node_id)
+    , slot_count_(slot_count)
+    // keep slots 8-byte aligned so the slot headers can be accessed directly
+    , slot_size_((std::max(slot_size, sizeof(SlotHeader) + 1) + 7) / 8 * 8) {
+
+    mapped_size_ = sizeof(Header) + slot_count_ * slot_size_;
+
+    int fd = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open cache arena " + path_ + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    bool existing = ::fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) == mapped_size_;
+    if (!existing && ::ftruncate(fd, static_cast<off_t>(mapped_size_)) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Failed to size cache arena " + path_ + ": " + std::strerror(errno));
+    }
+
+    void* mapped = ::mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Failed to map cache arena " + path_ + ": " + std::strerror(errno));
+    }
+    base_ = static_cast<char*>(mapped);
+
+    attached_ = existing && attach();
+    if (!attached_) {
+        initialize();
+    }
+}
+
+CacheArena::~CacheArena() {
+    if (base_ != nullptr) {
+        // the kernel keeps the pages either way, this only bounds how much a machine crash loses
+        ::msync(base_, mapped_size_, MS_ASYNC);
+        ::munmap(base_, mapped_size_);
+    }
+}
+
+uint32_t CacheArena::checksum(const SlotHeader* slot) {
+    boost::crc_32_type result;
+    const char* fields = reinterpret_cast<const char*>(&slot->sequence);
+    result.process_bytes(fields, sizeof(SlotHeader) - offsetof(SlotHeader, sequence));
+    result.process_bytes(reinterpret_cast<const char*>(slot + 1), slot->key_length + slot->value_length);
+    return result.checksum();
+}
+
+void CacheArena::initialize() {
+    std::cout << "Initializing cache arena at " << path_ << std::endl;
+    std::memset(base_, 0, sizeof(Header));
+    Header* h = header();
+    std::memcpy(h->magic, ARENA_MAGIC, sizeof(ARENA_MAGIC));
+    h->layout_version = LAYOUT_VERSION;
+    h->slot_size = static_cast<uint32_t>(slot_size_);
+    h->slot_count = slot_count_;
+    h->next_sequence = 1;
+    // empty until the WAL has been replayed into it, which only replayed() confirms
+    h->incomplete = 1;
+    std::strncpy(h->node_id, node_id_.c_str(), sizeof(h->node_id) - 1);
+
+    index_.clear();
+    free_slots_.clear();
+    for (uint32_t slot = static_cast<uint32_t>(slot_count_); slot-- > 0;) {
+        slotAt(slot)->used = 0;
+        free_slots_.push_back(slot);
+    }
+}
+
+bool CacheArena::attach() {
+    Header* h = header();
+    if (std::memcmp(h->magic, ARENA_MAGIC, sizeof(ARENA_MAGIC)) != 0
+        || h->layout_version != LAYOUT_VERSION
+        || h->slot_size != slot_size_
+        || h->slot_count != slot_count_
+        || std::strncmp(h->node_id, node_id_.c_str(), sizeof(h->node_id)) != 0) {
+        std::cout << "Cache arena at " << path_ << " has an incompatible layout, starting cold" << std::endl;
+        return false;
+    }
+
+    std::size_t payload_capacity = slot_size_ - sizeof(SlotHeader);
+    for (uint32_t slot = static_cast<uint32_t>(slot_count_); slot-- > 0;) {
+        SlotHeader* s = slotAt(slot);
+        if (s->used == 0) {
+            free_slots_.push_back(slot);
+            continue;
+        }
+        // a slot torn by a crash mid-write fails its checksum and is dropped
+        if (static_cast<std::size_t>(s->key_length) + s->value_length > payload_capacity || s->checksum != checksum(s)) {
+            s->used = 0;
+            free_slots_.push_back(slot);
+            ++corrupted_slots_;
+            h->incomplete = 1;
+            continue;
+        }
+        std::string key(reinterpret_cast<const char*>(s + 1), s->key_length);
+        auto [it, inserted] = index_.emplace(std::move(key), slot);
+        if (!inserted) {
+            // two copies of a key can only come from a crash between writing one and freeing the other
+            uint32_t stale = slot;
+            if (slotAt(it->second)->sequence < s->sequence) {
+                stale = it->second;
+                it->second = slot;
+            }
+            slotAt(stale)->used = 0;
+            free_slots_.push_back(stale);
+        }
+    }
+    return true;
+}
+
+std::size_t CacheArena::restore(LRUCache<std::string, std::string>& cache) {
+    auto start_time = std::chrono::steady_clock::now();
+    int64_t now_ms = wallClockMillis(std::chrono::system_clock::now());
+
+    std::vector<std::pair<uint64_t, uint32_t>> order;
+    order.reserve(index_.size());
+    for (auto it = index_.begin(); it != index_.end();) {
+        SlotHeader* s = slotAt(it->second);
+        if (s->expiry_ms <= now_ms) {
+            s->used = 0;
+            free_slots_.push_back(it->second);
+            it = index_.erase(it);
+            continue;
+        }
+        order.emplace_back(s->sequence, it->second);
+        ++it;
+    }
+    std::sort(order.begin(), order.end());
+
+    std::vector<std::tuple<std::string, std::string, int64_t, uint64_t>> items;
+    items.reserve(order.size());
+    for (const auto& [sequence, slot] : order) {
+        SlotHeader* s = slotAt(slot);
+        const char* payload = reinterpret_cast<const char*>(s + 1);
+        // ttl fix-up: only the time left until the stored wall-clock expiry, rounded up
+        int64_t remaining = (s->expiry_ms - now_ms + 999) / 1000;
+        items.emplace_back(std::string(payload, s->key_length),
+                           std::string(payload + s->key_length, s->value_length),
+                           remaining,
+                           s->version);
+    }
+
+    // the slots already hold these entries, don't rewrite them on the way in
+    restoring_ = true;
+    cache.putBatch(items);
+    restoring_ = false;
+
+    double millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    std::cout << "Cache arena restored " << items.size() << " entries in " << millis << " ms"
+              << " (" << corrupted_slots_ << " corrupted slots dropped)" << std::endl;
+    return items.size();
+}
+
+void CacheArena::store(std::string_view key, std::string_view value, uint64_t version, std::chrono::steady_clock::time_point expiry) {
+    std::size_t payload_capacity = slot_size_ - sizeof(SlotHeader);
+    if (key.size() + value.size() > payload_capacity) {
+        // too big for a slot; drop any older copy so it isn't restored, a restart has to replay the WAL
+        release(key);
+        ++skipped_;
+        header()->incomplete = 1;
+        return;
+    }
+
+    uint32_t slot;
+    auto it = index_.find(std::string(key));
+    if (it != index_.end()) {
+        slot = it->second;
+    } else {
+        if (free_slots_.empty()) {
+            ++skipped_;
+            header()->incomplete = 1;
+            return;
+        }
+        slot = free_slots_.back();
+        free_slots_.pop_back();
+        index_.emplace(key, slot);
+    }
+
+    auto wall_expiry = std::chrono::system_clock::now()
+        + std::chrono::duration_cast<std::chrono::system_clock::duration>(expiry - std::chrono::steady_clock::now());
+
+    SlotHeader* s = slotAt(slot);
+    s->sequence = header()->next_sequence++;
+    s->version = version;
+    s->expiry_ms = wallClockMillis(wall_expiry);
+    s->key_length = static_cast<uint32_t>(key.size());
+    s->value_length = static_cast<uint32_t>(value.size());
+    char* payload = reinterpret_cast<char*>(s + 1);
+    std::memcpy(payload, key.data(), key.size());
+    std::memcpy(payload + key.size(), value.data(), value.size());
+    s->checksum = checksum(s);
+    s->used = 1;
+}
+
+void CacheArena::replayed() {
+    // cleared only now, a crash during the replay must not leave the arena looking complete
+    if (skipped_ == 0) {
+        header()->incomplete = 0;
+    }
+}
+
+void CacheArena::release(std::string_view key) {
+    auto it = index_.find(std::string(key));
+    if (it == index_.end()) {
+        return;
+    }
+    slotAt(it->second)->used = 0;
+    free_slots_.push_back(it->second);
+    index_.erase(it);
+}
+
+void CacheArena::onCacheEvent(CacheEvent event, std::string_view key, std::string_view value, uint64_t version,
+                              std::chrono::steady_clock::time_point expiry) {
+    switch (event) {
+        case CacheEvent::INSERTED:
+            if (!restoring_) {
+                store(key, value, version, expiry);
+            }
+            break;
+        case CacheEvent::REPLACED:
+            // the INSERTED that follows reuses the slot
+            break;
+        case CacheEvent::TOMBSTONED:
+        case CacheEvent::TOMBSTONE_DROPPED:
+            // tombstones aren't mirrored, a restart forgets them
+            break;
+        case CacheEvent::REMOVED:
+        case CacheEvent::EVICTED:
+        case CacheEvent::EXPIRED:
+            release(key);
+            break;
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef CACHE_ARENA_H
+#define CACHE_ARENA_H
+
+#include "lru.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// a copy of the cache contents in fixed-size slots of a MAP_SHARED file mapping.
+// the mapping outlives the process (point it at /dev/shm for shared memory, or at a file on disk),
+// so a restarted node with the same layout reattaches and reloads its cache without replaying the WAL,
+// unless an entry didn't fit a slot or a slot was lost, in which case the arena is marked incomplete.
+// kept in sync through the cache listener, which runs under the cache lock, so the arena needs no lock of its own
+class CacheArena {
+public:
+    // bump whenever the header or slot layout changes
+    static constexpr uint32_t LAYOUT_VERSION = 2;
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t layout_version;
+        uint32_t slot_size;
+        uint64_t slot_count;
+        // next slot write stamp, restored entries are replayed in this order
+        uint64_t next_sequence;
+        char node_id[64];
+        // set on a new arena and once an entry of the cache has no slot, until a WAL replay has filled the gaps in
+        uint32_t incomplete;
+    };
+
+    struct SlotHeader {
+        uint32_t used;
+        // crc32 over the rest of the slot header and the payload
+        uint32_t checksum;
+        uint64_t sequence;
+        uint64_t version;
+        // wall-clock expiry in milliseconds, the steady clock restarts with the process
+        int64_t expiry_ms;
+        uint32_t key_length;
+        uint32_t value_length;
+    };
+
+    std::string path_;
+    std::string node_id_;
+    std::size_t slot_count_;
+    std::size_t slot_size_;
+    std::size_t mapped_size_ = 0;
+    char* base_ = nullptr;
+    bool attached_ = false;
+    bool restoring_ = false;
+
+    // slot of every stored key and the slots nobody uses, rebuilt from the mapping on attach
+    std::unordered_map<std::string, uint32_t> index_;
+    std::vector<uint32_t> free_slots_;
+    std::size_t corrupted_slots_ = 0;
+    // entries this process couldn't mirror
+    std::size_t skipped_ = 0;
+
+    Header* header() { return reinterpret_cast<Header*>(base_); }
+    SlotHeader* slotAt(uint32_t slot) { return reinterpret_cast<SlotHeader*>(base_ + sizeof(Header) + slot * slot_size_); }
+    static uint32_t checksum(const SlotHeader* slot);
+
+    void initialize();
+    // validate the header and index the slots, false if the layout doesn't match
+    bool attach();
+    void store(std::string_view key, std::string_view value, uint64_t version, std::chrono::steady_clock::time_point expiry);
+    void release(std::string_view key);
+
+public:
+    CacheArena(const std::string& path, const std::string& node_id, std::size_t slot_count, std::size_t slot_size);
+    ~CacheArena();
+    CacheArena(const CacheArena&) = delete;
+    CacheArena& operator=(const CacheArena&) = delete;
+
+    // true if an existing arena with a compatible layout was found
+    bool attached() const { return attached_; }
+    // false if the arena may lack entries the WAL has, restore() then needs a WAL replay after it
+    bool complete() { return attached_ && header()->incomplete == 0; }
+    // the WAL was replayed into the cache, so the arena holds every entry it has a slot for.
+    // Call with the cache lock held
+    void replayed();
+
+    // load the surviving entries into the cache, oldest write first, with their remaining ttl
+    std::size_t restore(LRUCache<std::string, std::string>& cache);
+
+    // cache listener hook
+    void onCacheEvent(CacheEvent event, std::string_view key, std::string_view value, uint64_t version,
+                      std::chrono::steady_clock::time_point expiry);
+};
+
+#endif
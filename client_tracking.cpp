@@ -0,0 +1,196 @@
+#include "client_tracking.h"
+#include "namespaces.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+ClientTracker::ClientTracker(const TrackingOptions& options) : options_(options) {}
+
+bool ClientTracker::connect(uint64_t& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (clients_.size() >= options_.max_clients) {
+        return false;
+    }
+    id = next_id_++;
+    clients_.emplace(id, Client{});
+    client_count_.store(clients_.size(), std::memory_order_relaxed);
+    return true;
+}
+
+void ClientTracker::disconnect(uint64_t id) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (clients_.erase(id) == 0) {
+            return;
+        }
+        client_count_.store(clients_.size(), std::memory_order_relaxed);
+        // prefixes are few and would match forever, unlike keys which are dropped lazily
+        for (auto it = prefixes_.begin(); it != prefixes_.end();) {
+            auto& ids = it->second;
+            std::size_t before = ids.size();
+            ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+            prefix_count_ -= before - ids.size();
+            if (ids.empty()) {
+                auto length = prefix_lengths_.find(it->first.size());
+                if (--length->second == 0) {
+                    prefix_lengths_.erase(length);
+                }
+                it = prefixes_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    cv_.notify_all();
+}
+
+bool ClientTracker::track(uint64_t id, const std::vector<std::string>& keys) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (clients_.find(id) == clients_.end()) {
+        return false;
+    }
+    for (const auto& key : keys) {
+        auto& ids = keys_[key];
+        if (std::find(ids.begin(), ids.end(), id) == ids.end()) {
+            ids.push_back(id);
+            ++tracked_;
+        }
+    }
+    while (tracked_ > options_.max_keys) {
+        overflowLocked();
+    }
+    return true;
+}
+
+bool ClientTracker::trackPrefix(uint64_t id, const std::string& prefix) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (clients_.find(id) == clients_.end()) {
+        return false;
+    }
+    auto& ids = prefixes_[prefix];
+    if (std::find(ids.begin(), ids.end(), id) != ids.end()) {
+        return true;
+    }
+    if (prefix_count_ >= options_.max_prefixes) {
+        if (ids.empty()) {
+            prefixes_.erase(prefix);
+        }
+        return false;
+    }
+    if (ids.empty()) {
+        ++prefix_lengths_[prefix.size()];
+    }
+    ids.push_back(id);
+    ++prefix_count_;
+    return true;
+}
+
+void ClientTracker::pushKey(uint64_t id, std::string_view key) {
+    auto it = clients_.find(id);
+    if (it == clients_.end() || it->second.pending.all) {
+        return;
+    }
+    Client& client = it->second;
+    if (client.pending_count >= options_.max_pending) {
+        client.pending = Invalidation{};
+        client.pending.all = true;
+        return;
+    }
+    client.pending.keys.emplace_back(key);
+    ++client.pending_count;
+}
+
+void ClientTracker::pushRange(uint64_t id, const std::string& first, const std::string& last) {
+    auto it = clients_.find(id);
+    if (it == clients_.end() || it->second.pending.all) {
+        return;
+    }
+    Client& client = it->second;
+    if (client.pending_count >= options_.max_pending) {
+        client.pending = Invalidation{};
+        client.pending.all = true;
+        return;
+    }
+    client.pending.ranges.emplace_back(first, last);
+    ++client.pending_count;
+}
+
+void ClientTracker::overflowLocked() {
+    // 1/16 of the table per overflow, so a client that keeps tracking new keys doesn't cause one range per key
+    std::size_t batch = std::max<std::size_t>(1, options_.max_keys / 16);
+    auto it = keys_.upper_bound(overflow_cursor_);
+    if (it == keys_.end()) {
+        it = keys_.begin();
+    }
+    std::string ns = namespaceOf(it->first);
+    std::string first = it->first;
+    std::string last;
+    std::unordered_set<uint64_t> affected;
+    for (std::size_t taken = 0; it != keys_.end() && taken < batch && namespaceOf(it->first) == ns; ++taken) {
+        affected.insert(it->second.begin(), it->second.end());
+        tracked_ -= it->second.size();
+        last = it->first;
+        it = keys_.erase(it);
+    }
+    overflow_cursor_ = last;
+    for (uint64_t id : affected) {
+        pushRange(id, first, last);
+    }
+    overflows_.fetch_add(1, std::memory_order_relaxed);
+    cv_.notify_all();
+}
+
+void ClientTracker::invalidate(std::string_view key) {
+    if (client_count_.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    bool pushed = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = keys_.find(key);
+        if (it != keys_.end()) {
+            for (uint64_t id : it->second) {
+                pushKey(id, key);
+            }
+            tracked_ -= it->second.size();
+            keys_.erase(it);
+            pushed = true;
+        }
+        for (const auto& [length, count] : prefix_lengths_) {
+            if (length > key.size()) {
+                break;
+            }
+            auto prefix = prefixes_.find(std::string(key.substr(0, length)));
+            if (prefix != prefixes_.end()) {
+                for (uint64_t id : prefix->second) {
+                    pushKey(id, key);
+                }
+                pushed = true;
+            }
+        }
+    }
+    if (pushed) {
+        cv_.notify_all();
+    }
+}
+
+bool ClientTracker::wait(uint64_t id, Invalidation& invalidation, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait_for(lock, timeout, [this, id]() {
+        auto it = clients_.find(id);
+        return it == clients_.end() || !it->second.pending.empty();
+    });
+    auto it = clients_.find(id);
+    if (it == clients_.end()) {
+        return false;
+    }
+    invalidation = std::move(it->second.pending);
+    it->second.pending = Invalidation{};
+    it->second.pending_count = 0;
+    return true;
+}
+
+std::size_t ClientTracker::tracked() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tracked_;
+}
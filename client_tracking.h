@@ -0,0 +1,101 @@
+#ifndef CLIENT_TRACKING_H
+#define CLIENT_TRACKING_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct TrackingOptions {
+    // (key, client) pairs tracked over all clients; past it a range of tracked keys is invalidated to make room
+    std::size_t max_keys = 1000000;
+    // prefixes tracked over all clients, more are refused
+    std::size_t max_prefixes = 1024;
+    // open Watch streams, each holds a server thread
+    std::size_t max_clients = 16;
+    // invalidations queued for a client before it is told to drop everything instead
+    std::size_t max_pending = 10000;
+};
+
+// what a watching client has to drop from its local copy, all keys in stored form
+struct Invalidation {
+    std::vector<std::string> keys;
+    // inclusive ranges of stored keys, each within one namespace, sent when the table overflowed
+    std::vector<std::pair<std::string, std::string>> ranges;
+    // the client fell too far behind to be told key by key
+    bool all = false;
+
+    bool empty() const { return keys.empty() && ranges.empty() && !all; }
+};
+
+// server side of client-side caching. A client holds a Watch stream open and registers the keys it caches;
+// the first write, remove or expiry of a key queues an invalidation and ends its tracking, so the client has
+// to register the key again when it caches it anew. Prefixes stay registered until the client disconnects.
+// The key table is ordered so that on overflow a run of neighbouring keys can go as one range
+class ClientTracker {
+private:
+    struct Client {
+        Invalidation pending;
+        std::size_t pending_count = 0;
+    };
+
+    TrackingOptions options_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    uint64_t next_id_ = 1;
+    std::unordered_map<uint64_t, Client> clients_;
+    // checked without the lock, so a node nobody watches pays nothing per write
+    std::atomic<std::size_t> client_count_{0};
+
+    // ids of clients that disconnected linger here until the key is invalidated or overflows
+    std::map<std::string, std::vector<uint64_t>, std::less<>> keys_;
+    std::size_t tracked_ = 0;
+    // where the next overflow range starts, so overflows sweep the key space round robin
+    std::string overflow_cursor_;
+
+    std::unordered_map<std::string, std::vector<uint64_t>> prefixes_;
+    std::size_t prefix_count_ = 0;
+    // prefix length -> prefixes of that length, a key is checked once per distinct length
+    std::map<std::size_t, std::size_t> prefix_lengths_;
+
+    std::atomic<uint64_t> overflows_{0};
+
+    // caller must hold mutex_
+    void pushKey(uint64_t id, std::string_view key);
+    void pushRange(uint64_t id, const std::string& first, const std::string& last);
+    void overflowLocked();
+
+public:
+    explicit ClientTracker(const TrackingOptions& options);
+
+    // false once max_clients are connected
+    bool connect(uint64_t& id);
+    void disconnect(uint64_t id);
+
+    // false for a client that isn't connected
+    bool track(uint64_t id, const std::vector<std::string>& keys);
+    // false for a client that isn't connected or a full prefix table
+    bool trackPrefix(uint64_t id, const std::string& prefix);
+
+    // a tracked key changed or went away; runs under the cache lock
+    void invalidate(std::string_view key);
+
+    // waits up to timeout for the client's invalidations and takes them, false once it is disconnected
+    bool wait(uint64_t id, Invalidation& invalidation, std::chrono::milliseconds timeout);
+
+    std::size_t clients() const { return client_count_.load(std::memory_order_relaxed); }
+    std::size_t tracked();
+    uint64_t overflows() const { return overflows_.load(std::memory_order_relaxed); }
+};
+
+#endif
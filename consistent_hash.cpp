@@ -1,11 +1,13 @@
 #include "consistent_hash.h"
+#include <algorithm>
 #include <functional>
 
 ConsistentHash::ConsistentHash(std::size_t virtualNodesNum): virtual_nodes_num_(virtualNodesNum) {}
 
 
-std::size_t ConsistentHash::computeHash(const std::string& key) const{
-    std::hash<std::string> hasher;
+std::size_t ConsistentHash::computeHash(std::string_view key) const{
+    // same hash as std::hash<std::string>
+    std::hash<std::string_view> hasher;
     return hasher(key) % RING_SPACE_;
 }
 
@@ -30,15 +32,11 @@ void ConsistentHash::removeNode(const std::string& nodeId) {
     }
 }
 
-std::vector<std::string> ConsistentHash::getNodes(const std::string& key, std::size_t replica_count){
-    std::lock_guard<std::mutex> lock(mutex_);
-    std::size_t hash = computeHash(key);
-
+std::vector<std::string> ConsistentHash::collectNodes(std::map<std::size_t, std::string>::const_iterator it, std::size_t replica_count) const {
     std::vector<std::string> nodes;
-    // find the first node that is greater than or equal to the hash of the data key
-    auto it = hash_ring_.lower_bound(hash);
 
-    while(nodes.size() < replica_count && nodes.size() < hash_ring_.size()){
+    // one lap at most, fewer physical nodes than replica_count would otherwise loop forever
+    for(std::size_t steps = 0; nodes.size() < replica_count && steps < hash_ring_.size(); ++steps){
         if(it == hash_ring_.end()){
             it = hash_ring_.begin();
         }
@@ -49,4 +47,29 @@ std::vector<std::string> ConsistentHash::getNodes(const std::string& key, std::s
         ++it;
     }
     return nodes;
-}
\ No newline at end of file
+}
+
+std::vector<std::string> ConsistentHash::getNodes(const std::string& key, std::size_t replica_count){
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t hash = computeHash(key);
+
+    // find the first node that is greater than or equal to the hash of the data key
+    return collectNodes(hash_ring_.lower_bound(hash), replica_count);
+}
+
+std::vector<ConsistentHash::Range> ConsistentHash::getRanges(std::size_t replica_count){
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Range> ranges;
+    if(hash_ring_.empty()){
+        return ranges;
+    }
+    ranges.reserve(hash_ring_.size());
+
+    // the first arc wraps around from the last virtual node
+    std::size_t start = hash_ring_.rbegin()->first;
+    for(auto it = hash_ring_.begin(); it != hash_ring_.end(); ++it){
+        ranges.push_back(Range{start, it->first, collectNodes(it, replica_count)});
+        start = it->first;
+    }
+    return ranges;
+}
@@ -3,6 +3,7 @@
 
 #include <map>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <mutex>
 #include <cstddef>
@@ -18,6 +19,9 @@ private:
     std::size_t virtual_nodes_num_;
     std::mutex mutex_;
 
+    // walk clockwise from it collecting distinct nodes, caller must hold mutex_
+    std::vector<std::string> collectNodes(std::map<std::size_t, std::string>::const_iterator it, std::size_t replica_count) const;
+
 public:
     // delete copy and move operations to prevent accidental copying/moving
     ConsistentHash(const ConsistentHash&) = delete;
@@ -26,7 +30,7 @@ public:
     ConsistentHash& operator=(ConsistentHash&&) = delete;
 
     ConsistentHash(std::size_t virtualNodesNum);
-    std::size_t computeHash(const std::string& key) const;
+    std::size_t computeHash(std::string_view key) const;
 
     void addNode(const std::string& nodeId);
     void removeNode(const std::string& nodeId);
@@ -35,6 +39,15 @@ public:
     // decides how many replica user wants to keep
     std::vector<std::string> getNodes(const std::string& key, std::size_t replica_count);
 
+    // an arc (start, end] of the ring and the nodes that replicate the keys hashing into it
+    struct Range {
+        std::size_t start;
+        std::size_t end;
+        std::vector<std::string> replicas;
+    };
+    // every arc of the ring in position order, identical on all nodes with the same membership
+    std::vector<Range> getRanges(std::size_t replica_count);
+
 };
 
 #endif // CONSISTENT_HASH_H
\ No newline at end of file
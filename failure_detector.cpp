@@ -0,0 +1,108 @@
+#include "failure_detector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+
+FailureDetector::FailureDetector(const std::vector<std::string>& peers, const FailureDetectorOptions& options, Ping ping)
+    : options_(options), ping_(std::move(ping)) {
+    auto now = std::chrono::steady_clock::now();
+    double interval_ms = static_cast<double>(options_.heartbeat_interval.count());
+    for (const auto& peer : peers) {
+        // seeded as if one heartbeat arrived on schedule just now, so a peer that never answers
+        // becomes suspect after a few intervals instead of never
+        History& history = peers_[peer];
+        history.intervals_ms.push_back(interval_ms);
+        history.sum = interval_ms;
+        history.sum_squares = interval_ms * interval_ms;
+        history.last_heartbeat = now;
+    }
+}
+
+FailureDetector::~FailureDetector() {
+    stop();
+}
+
+void FailureDetector::start() {
+    if (running_ || peers_.empty()) {
+        return;
+    }
+    running_ = true;
+    thread_ = std::thread(&FailureDetector::loop, this);
+}
+
+void FailureDetector::stop() {
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void FailureDetector::loop() {
+    std::vector<std::string> peers;
+    for (const auto& [peer, history] : peers_) {
+        peers.push_back(peer);
+    }
+    auto next = std::chrono::steady_clock::now();
+    while (running_) {
+        // all peers at once, so one dead peer's deadline doesn't delay everyone else's heartbeat
+        std::vector<std::future<bool>> pings;
+        for (const auto& peer : peers) {
+            pings.push_back(std::async(std::launch::async, ping_, peer, options_.heartbeat_interval));
+        }
+        for (std::size_t i = 0; i < peers.size(); ++i) {
+            if (pings[i].get()) {
+                heartbeat(peers[i], std::chrono::steady_clock::now());
+            }
+        }
+
+        next += options_.heartbeat_interval;
+        std::unique_lock<std::mutex> lock(wait_mutex_);
+        cv_.wait_until(lock, next, [this]() { return !running_; });
+    }
+}
+
+void FailureDetector::heartbeat(const std::string& peer, std::chrono::steady_clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    History& history = peers_.at(peer);
+    double interval = std::chrono::duration<double, std::milli>(now - history.last_heartbeat).count();
+    history.last_heartbeat = now;
+    history.intervals_ms.push_back(interval);
+    history.sum += interval;
+    history.sum_squares += interval * interval;
+    if (history.intervals_ms.size() > options_.window) {
+        double oldest = history.intervals_ms.front();
+        history.intervals_ms.pop_front();
+        history.sum -= oldest;
+        history.sum_squares -= oldest * oldest;
+    }
+}
+
+double FailureDetector::phiLocked(const History& history, std::chrono::steady_clock::time_point now) const {
+    double n = static_cast<double>(history.intervals_ms.size());
+    double mean = history.sum / n;
+    double variance = std::max(0.0, history.sum_squares / n - mean * mean);
+    double stddev = std::max(std::sqrt(variance), static_cast<double>(options_.min_stddev.count()));
+    double elapsed = std::chrono::duration<double, std::milli>(now - history.last_heartbeat).count();
+
+    // logistic approximation of the normal CDF, as in Akka, which keeps the tail from rounding to 0
+    double y = (elapsed - mean) / stddev;
+    double e = std::exp(-y * (1.5976 + 0.070566 * y * y));
+    if (elapsed > mean) {
+        return -std::log10(e / (1.0 + e));
+    }
+    return -std::log10(1.0 - 1.0 / (1.0 + e));
+}
+
+double FailureDetector::phi(const std::string& peer) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = peers_.find(peer);
+    if (it == peers_.end() || !running_) {
+        return 0.0;
+    }
+    return phiLocked(it->second, std::chrono::steady_clock::now());
+}
@@ -0,0 +1,74 @@
+#ifndef FAILURE_DETECTOR_H
+#define FAILURE_DETECTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct FailureDetectorOptions {
+    // how often every peer is pinged, 0 disables the detector and with it hinted handoff
+    std::chrono::milliseconds heartbeat_interval{500};
+    // suspicion level above which a peer counts as down; 8 means a 1e-8 chance the peer is merely slow
+    double phi_threshold = 8.0;
+    // inter-arrival times kept per peer
+    std::size_t window = 100;
+    // floor on the deviation, so a perfectly regular history doesn't make one late heartbeat fatal
+    std::chrono::milliseconds min_stddev{100};
+};
+
+// phi accrual failure detector (Hayashibara et al.). Instead of a fixed timeout, each peer's history of
+// heartbeat inter-arrival times gives a normal distribution, and phi is -log10 of the probability that a
+// heartbeat still arrives after the time since the last one. A background thread pings every peer once per
+// interval with the interval as deadline
+class FailureDetector {
+public:
+    // true if the peer answered within the deadline
+    using Ping = std::function<bool(const std::string& peer, std::chrono::milliseconds deadline)>;
+
+private:
+    struct History {
+        std::deque<double> intervals_ms;
+        double sum = 0;
+        double sum_squares = 0;
+        std::chrono::steady_clock::time_point last_heartbeat;
+    };
+
+    FailureDetectorOptions options_;
+    Ping ping_;
+
+    mutable std::mutex mutex_;
+    // fixed set of peers, only the histories change
+    std::unordered_map<std::string, History> peers_;
+
+    std::atomic<bool> running_{false};
+    std::mutex wait_mutex_;
+    std::condition_variable cv_;
+    std::thread thread_;
+
+    void heartbeat(const std::string& peer, std::chrono::steady_clock::time_point now);
+    double phiLocked(const History& history, std::chrono::steady_clock::time_point now) const;
+    void loop();
+
+public:
+    FailureDetector(const std::vector<std::string>& peers, const FailureDetectorOptions& options, Ping ping);
+    ~FailureDetector();
+    FailureDetector(const FailureDetector&) = delete;
+    FailureDetector& operator=(const FailureDetector&) = delete;
+
+    void start();
+    void stop();
+
+    double phi(const std::string& peer) const;
+    // peers the detector doesn't know are never suspected
+    bool suspect(const std::string& peer) const { return phi(peer) > options_.phi_threshold; }
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// high dynamic range histogram: log-linear buckets that keep every recorded value to a fixed
+// number of significant digits over the whole range, so p99.99 of microsecond latencies costs
+// a few tens of KB instead of a sorted copy of every sample.
+// not synchronized, keep one per thread and merge them
+class HdrHistogram {
+private:
+    uint64_t highest_;
+    // sub-buckets per bucket is 2^(half_count_magnitude_ + 1)
+    uint32_t half_count_magnitude_;
+    uint64_t half_count_;
+    uint64_t sub_bucket_mask_;
+    std::vector<uint64_t> counts_;
+
+    uint64_t total_ = 0;
+    uint64_t min_ = std::numeric_limits<uint64_t>::max();
+    uint64_t max_ = 0;
+    // for the mean, exact rather than bucketed
+    long double sum_ = 0;
+
+    std::size_t indexOf(uint64_t value) const {
+        // bucket 0 covers [0, 2^(m+1)), bucket b covers [2^(m+b), 2^(m+b+1)) in steps of 2^b
+        uint32_t magnitude = 63 - __builtin_clzll(value | sub_bucket_mask_);
+        uint32_t bucket = magnitude - half_count_magnitude_;
+        uint64_t sub_bucket = value >> bucket;
+        return ((static_cast<std::size_t>(bucket) + 1) << half_count_magnitude_) + (sub_bucket - half_count_);
+    }
+
+    // largest value that lands in the same slot as index
+    uint64_t highestValueAt(std::size_t index) const {
+        int64_t bucket = static_cast<int64_t>(index >> half_count_magnitude_) - 1;
+        uint64_t sub_bucket = (index & (half_count_ - 1)) + half_count_;
+        if (bucket < 0) {
+            sub_bucket -= half_count_;
+            bucket = 0;
+        }
+        return (sub_bucket << bucket) + ((uint64_t{1} << bucket) - 1);
+    }
+
+public:
+    // values above highest are clamped to it; significant_digits is 1 to 5
+    explicit HdrHistogram(uint64_t highest = 60'000'000, int significant_digits = 3)
+        : highest_(std::max<uint64_t>(highest, 2)) {
+        uint64_t largest_single_unit = 2;
+        for (int i = 0; i < std::clamp(significant_digits, 1, 5); ++i) {
+            largest_single_unit *= 10;
+        }
+        uint32_t sub_bucket_magnitude = 64 - __builtin_clzll(largest_single_unit - 1);
+        half_count_magnitude_ = sub_bucket_magnitude - 1;
+        half_count_ = uint64_t{1} << half_count_magnitude_;
+        sub_bucket_mask_ = (uint64_t{1} << sub_bucket_magnitude) - 1;
+
+        // enough buckets that the last one reaches highest
+        std::size_t buckets = 1;
+        uint64_t trackable = sub_bucket_mask_;
+        while (trackable < highest_) {
+            trackable = (trackable << 1) | 1;
+            ++buckets;
+        }
+        counts_.assign((buckets + 1) * half_count_, 0);
+    }
+
+    void record(uint64_t value, uint64_t count = 1) {
+        value = std::min(value, highest_);
+        counts_[indexOf(value)] += count;
+        total_ += count;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+        sum_ += static_cast<long double>(value) * count;
+    }
+
+    // both histograms must have been built with the same range and precision
+    void merge(const HdrHistogram& other) {
+        for (std::size_t i = 0; i < counts_.size() && i < other.counts_.size(); ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+        sum_ += other.sum_;
+    }
+
+    void reset() {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        total_ = 0;
+        min_ = std::numeric_limits<uint64_t>::max();
+        max_ = 0;
+        sum_ = 0;
+    }
+
+    // smallest recorded value (to the histogram's precision) that percentile percent of values are at or below
+    uint64_t valueAtPercentile(double percentile) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        double clamped = std::clamp(percentile, 0.0, 100.0);
+        uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(clamped / 100.0 * total_ + 0.5));
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= target) {
+                return std::min(highestValueAt(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t min() const { return total_ == 0 ? 0 : min_; }
+    uint64_t max() const { return max_; }
+    double mean() const { return total_ == 0 ? 0 : static_cast<double>(sum_ / total_); }
+};
+
+#endif
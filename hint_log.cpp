@@ -0,0 +1,125 @@
+#include "hint_log.h"
+
+#include <iostream>
+
+HintLog::HintLog(const HintOptions& options, Send send, Alive alive)
+    : options_(options), send_(std::move(send)), alive_(std::move(alive)) {}
+
+HintLog::~HintLog() {
+    stop();
+}
+
+void HintLog::start() {
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    thread_ = std::thread(&HintLog::loop, this);
+}
+
+void HintLog::stop() {
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+bool HintLog::add(const std::string& peer, Hint hint) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!addLocked(peer, std::move(hint), true)) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+bool HintLog::addLocked(const std::string& peer, Hint&& hint, bool fresh) {
+    auto& peer_hints = hints_[peer];
+    auto it = peer_hints.find(hint.key);
+    if (it != peer_hints.end()) {
+        // the newer write wins, put or remove
+        if (fresh && hint.version >= it->second.version) {
+            it->second = std::move(hint);
+        }
+        return true;
+    }
+    if (size_ >= options_.max_hints) {
+        return false;
+    }
+    std::string key = hint.key;
+    peer_hints.emplace(std::move(key), std::move(hint));
+    ++size_;
+    return true;
+}
+
+std::vector<Hint> HintLog::take(const std::string& peer) {
+    std::vector<Hint> batch;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = hints_.find(peer);
+    if (it == hints_.end()) {
+        return batch;
+    }
+    auto& peer_hints = it->second;
+    while (!peer_hints.empty() && batch.size() < options_.batch_size) {
+        auto node = peer_hints.extract(peer_hints.begin());
+        batch.push_back(std::move(node.mapped()));
+    }
+    size_ -= batch.size();
+    if (peer_hints.empty()) {
+        hints_.erase(it);
+    }
+    return batch;
+}
+
+void HintLog::replay(const std::string& peer) {
+    uint64_t sent = 0;
+    while (running_ && alive_(peer)) {
+        std::vector<Hint> batch = take(peer);
+        if (batch.empty()) {
+            break;
+        }
+        if (!send_(peer, batch)) {
+            // back in, unless a newer write for the key was hinted meanwhile
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& hint : batch) {
+                if (!addLocked(peer, std::move(hint), false)) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            break;
+        }
+        sent += batch.size();
+        replayed_.fetch_add(batch.size(), std::memory_order_relaxed);
+    }
+    if (sent > 0) {
+        std::cout << "Replayed " << sent << " hints to " << peer << std::endl;
+    }
+}
+
+void HintLog::loop() {
+    while (running_) {
+        {
+            std::unique_lock<std::mutex> lock(wait_mutex_);
+            cv_.wait_for(lock, options_.replay_interval, [this]() { return !running_; });
+        }
+        std::vector<std::string> peers;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& [peer, peer_hints] : hints_) {
+                peers.push_back(peer);
+            }
+        }
+        for (const auto& peer : peers) {
+            replay(peer);
+        }
+    }
+}
+
+std::size_t HintLog::size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return size_;
+}
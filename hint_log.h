@@ -0,0 +1,84 @@
+#ifndef HINT_LOG_H
+#define HINT_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct HintOptions {
+    // hints kept over all peers; past it new ones are dropped and anti-entropy has to repair the key
+    std::size_t max_hints = 100000;
+    // hints sent to a peer per round trip
+    std::size_t batch_size = 500;
+    // how often peers that are back are checked for hints
+    std::chrono::milliseconds replay_interval{1000};
+};
+
+// a write a replica missed, the newest one per key
+struct Hint {
+    std::string key;
+    bool remove = false;
+    std::string value;
+    // wall clock, hints can outlive the entry
+    int64_t expiry_ms = 0;
+    uint64_t version = 0;
+};
+
+// hinted handoff: writes meant for a replica that is down or didn't answer are kept here, keyed by peer and
+// key, and replayed in batches once the peer is reachable again. Only the newest write per key is kept, so a
+// hot key costs one hint. In memory only, a restart leaves the rest to anti-entropy
+class HintLog {
+public:
+    // sends a batch to the peer, false if it has to be retried later
+    using Send = std::function<bool(const std::string& peer, const std::vector<Hint>& hints)>;
+    using Alive = std::function<bool(const std::string& peer)>;
+
+private:
+    HintOptions options_;
+    Send send_;
+    Alive alive_;
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::unordered_map<std::string, Hint>> hints_;
+    std::size_t size_ = 0;
+
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> replayed_{0};
+
+    std::atomic<bool> running_{false};
+    std::mutex wait_mutex_;
+    std::condition_variable cv_;
+    std::thread thread_;
+
+    // keeps the newer of the stored hint and this one, or with !fresh the stored one; caller must hold mutex_
+    bool addLocked(const std::string& peer, Hint&& hint, bool fresh);
+    std::vector<Hint> take(const std::string& peer);
+    void replay(const std::string& peer);
+    void loop();
+
+public:
+    HintLog(const HintOptions& options, Send send, Alive alive);
+    ~HintLog();
+    HintLog(const HintLog&) = delete;
+    HintLog& operator=(const HintLog&) = delete;
+
+    void start();
+    void stop();
+
+    // false if the log is full and the hint was dropped
+    bool add(const std::string& peer, Hint hint);
+
+    std::size_t size();
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    uint64_t replayed() const { return replayed_.load(std::memory_order_relaxed); }
+};
+
+#endif
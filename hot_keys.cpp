@@ -0,0 +1,109 @@
+#include "hot_keys.h"
+
+#include <algorithm>
+
+void SpaceSaving::siftDown(std::size_t position) {
+    while (true) {
+        std::size_t smallest = position;
+        for (std::size_t child = 2 * position + 1; child <= 2 * position + 2 && child < heap_.size(); ++child) {
+            if (heap_[child].count < heap_[smallest].count) {
+                smallest = child;
+            }
+        }
+        if (smallest == position) {
+            return;
+        }
+        std::swap(heap_[position], heap_[smallest]);
+        index_[heap_[position].key] = position;
+        index_[heap_[smallest].key] = smallest;
+        position = smallest;
+    }
+}
+
+void SpaceSaving::add(const std::string& key) {
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        heap_[it->second].count++;
+        siftDown(it->second);
+        return;
+    }
+    if (heap_.size() < capacity_) {
+        index_.emplace(key, heap_.size());
+        heap_.push_back(Counter{key, 1, 0});
+        std::size_t position = heap_.size() - 1;
+        while (position > 0 && heap_[(position - 1) / 2].count > heap_[position].count) {
+            std::size_t parent = (position - 1) / 2;
+            std::swap(heap_[position], heap_[parent]);
+            index_[heap_[position].key] = position;
+            index_[heap_[parent].key] = parent;
+            position = parent;
+        }
+        return;
+    }
+    Counter& smallest = heap_.front();
+    index_.erase(smallest.key);
+    smallest.key = key;
+    smallest.error = smallest.count;
+    smallest.count++;
+    index_.emplace(key, 0);
+    siftDown(0);
+}
+
+std::vector<HotKeyCount> SpaceSaving::top(std::size_t limit) const {
+    std::vector<HotKeyCount> counts;
+    counts.reserve(heap_.size());
+    for (const auto& counter : heap_) {
+        counts.push_back(HotKeyCount{counter.key, counter.count, counter.error});
+    }
+    std::size_t n = std::min(limit, counts.size());
+    std::partial_sort(counts.begin(), counts.begin() + n, counts.end(),
+                      [](const HotKeyCount& a, const HotKeyCount& b) { return a.count > b.count; });
+    counts.resize(n);
+    return counts;
+}
+
+void SpaceSaving::clear() {
+    heap_.clear();
+    index_.clear();
+}
+
+HotKeyTracker::HotKeyTracker(const HotKeyOptions& options)
+    : options_(options),
+      reads_(options.capacity),
+      writes_(options.capacity),
+      window_start_(std::chrono::steady_clock::now()) {
+    last_window_.sample_every = options_.sample_every;
+}
+
+void HotKeyTracker::record(SpaceSaving& sketch, const std::string& key) {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    rotateLocked(now);
+    sketch.add(key);
+}
+
+void HotKeyTracker::rotateLocked(std::chrono::steady_clock::time_point now) {
+    if (now - window_start_ < options_.window) {
+        return;
+    }
+    // a window nobody sampled in stretches until the next sample, the rate still comes out right
+    last_window_.reads = reads_.top(options_.capacity);
+    last_window_.writes = writes_.top(options_.capacity);
+    last_window_.window_seconds = std::chrono::duration<double>(now - window_start_).count();
+    reads_.clear();
+    writes_.clear();
+    window_start_ = now;
+}
+
+HotKeyTracker::Report HotKeyTracker::report(std::size_t limit) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    rotateLocked(std::chrono::steady_clock::now());
+    Report report = last_window_;
+    if (report.reads.size() > limit) {
+        report.reads.resize(limit);
+    }
+    if (report.writes.size() > limit) {
+        report.writes.resize(limit);
+    }
+    return report;
+}
@@ -0,0 +1,102 @@
+#ifndef HOT_KEYS_H
+#define HOT_KEYS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct HotKeyOptions {
+    // keys tracked per sketch; more catches colder keys but costs memory, not lookup time
+    std::size_t capacity = 256;
+    // record one in this many requests per thread, 0 disables tracking
+    uint32_t sample_every = 16;
+    std::chrono::seconds window{10};
+};
+
+struct HotKeyCount {
+    std::string key;
+    // sampled hits; the true count is between count - error and count
+    uint64_t count;
+    uint64_t error;
+};
+
+// Space-Saving top-k: a fixed number of counters, a key that isn't tracked takes over the smallest one and
+// inherits its count as error. Any key with more than 1/capacity of the hits is guaranteed to be tracked.
+// Not thread safe
+class SpaceSaving {
+private:
+    struct Counter {
+        std::string key;
+        uint64_t count;
+        uint64_t error;
+    };
+
+    std::size_t capacity_;
+    // min-heap on count, so the counter to take over is at the front
+    std::vector<Counter> heap_;
+    // position of every tracked key in heap_
+    std::unordered_map<std::string, std::size_t> index_;
+
+    void siftDown(std::size_t position);
+
+public:
+    explicit SpaceSaving(std::size_t capacity) : capacity_(capacity > 0 ? capacity : 1) {}
+
+    void add(const std::string& key);
+    // the most frequent keys, highest count first
+    std::vector<HotKeyCount> top(std::size_t limit) const;
+    void clear();
+};
+
+// sampled read and write frequencies per key over tumbling windows, reported for the last complete window.
+// The unsampled path is a thread-local counter increment
+class HotKeyTracker {
+public:
+    struct Report {
+        std::vector<HotKeyCount> reads;
+        std::vector<HotKeyCount> writes;
+        // length of the window the counts cover, 0 before the first one completed
+        double window_seconds = 0;
+        uint32_t sample_every = 0;
+    };
+
+private:
+    HotKeyOptions options_;
+
+    std::mutex mutex_;
+    SpaceSaving reads_;
+    SpaceSaving writes_;
+    std::chrono::steady_clock::time_point window_start_;
+    Report last_window_;
+
+    // one per kind, so a thread alternating reads and writes doesn't only ever sample one of them
+    static inline thread_local uint32_t read_tick_ = 0;
+    static inline thread_local uint32_t write_tick_ = 0;
+
+    bool sampled(uint32_t& tick) const { return options_.sample_every > 0 && ++tick % options_.sample_every == 0; }
+    void record(SpaceSaving& sketch, const std::string& key);
+    void rotateLocked(std::chrono::steady_clock::time_point now);
+
+public:
+    explicit HotKeyTracker(const HotKeyOptions& options);
+
+    void recordRead(const std::string& key) {
+        if (sampled(read_tick_)) {
+            record(reads_, key);
+        }
+    }
+    void recordWrite(const std::string& key) {
+        if (sampled(write_tick_)) {
+            record(writes_, key);
+        }
+    }
+
+    // the last complete window's hottest keys, at most limit of each kind
+    Report report(std::size_t limit);
+};
+
+#endif
@@ -0,0 +1,591 @@
+// open-loop load generator for a CacheMesh cluster.
+// requests are issued on a fixed schedule no matter how fast the cluster answers, and latency is
+// measured from the time a request was scheduled rather than when it was sent. A stalled server
+// therefore shows up as queueing delay on every request it held up instead of silently lowering the
+// offered rate, which is the coordinated-omission problem a closed-loop client like test_client.py has
+
+#include "hdr_histogram.h"
+#include "grpcpp/grpcpp.h"
+#include "distributed-cache.grpc.pb.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class KeyDistribution {
+    UNIFORM,
+    // YCSB-style zipfian, ranks are scrambled so the hot keys spread over the ring
+    ZIPF,
+    // a fixed fraction of the keys receives a fixed fraction of the operations
+    HOTSPOT
+};
+
+// inclusive [min, max], a single number on the command line means min == max
+struct SizeRange {
+    uint64_t min = 0;
+    uint64_t max = 0;
+
+    uint64_t pick(std::mt19937_64& rng) const {
+        return min == max ? min : min + rng() % (max - min + 1);
+    }
+};
+
+struct LoadOptions {
+    std::vector<std::string> targets;
+    // total requests per second over all workers
+    double rate = 1000;
+    std::chrono::seconds duration{30};
+    // issued but not recorded, lets connections and caches settle
+    std::chrono::seconds warmup{5};
+    std::size_t workers = 4;
+    std::size_t max_outstanding = 1024;
+    std::chrono::milliseconds timeout{1000};
+    double read_ratio = 0.9;
+    uint64_t keys = 100000;
+    KeyDistribution distribution = KeyDistribution::ZIPF;
+    double zipf_theta = 0.99;
+    double hotspot_keys = 0.2;
+    double hotspot_ops = 0.8;
+    SizeRange value_size{100, 100};
+    SizeRange ttl{300, 300};
+    // write every key once before the measured run so reads can hit
+    bool preload = false;
+    std::string out_path;
+};
+
+uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+class KeyGenerator {
+private:
+    KeyDistribution distribution_;
+    uint64_t keys_;
+    double theta_;
+    double zeta_n_ = 0;
+    double alpha_ = 0;
+    double eta_ = 0;
+    uint64_t hot_keys_ = 0;
+    double hot_ops_ = 0;
+
+    static double zeta(uint64_t n, double theta) {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
+
+public:
+    KeyGenerator(const LoadOptions& options)
+        : distribution_(options.distribution)
+        , keys_(std::max<uint64_t>(options.keys, 2))
+        , theta_(options.zipf_theta) {
+        if (distribution_ == KeyDistribution::ZIPF) {
+            // Gray et al., "Quickly generating billion-record synthetic databases"; O(keys) once at startup
+            zeta_n_ = zeta(keys_, theta_);
+            double zeta_2 = zeta(2, theta_);
+            alpha_ = 1.0 / (1.0 - theta_);
+            eta_ = (1.0 - std::pow(2.0 / keys_, 1.0 - theta_)) / (1.0 - zeta_2 / zeta_n_);
+        }
+        hot_keys_ = std::max<uint64_t>(1, static_cast<uint64_t>(keys_ * options.hotspot_keys));
+        hot_ops_ = options.hotspot_ops;
+    }
+
+    uint64_t next(std::mt19937_64& rng) {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        switch (distribution_) {
+            case KeyDistribution::UNIFORM:
+                return rng() % keys_;
+            case KeyDistribution::HOTSPOT:
+                if (uniform(rng) < hot_ops_ || hot_keys_ >= keys_) {
+                    return rng() % hot_keys_;
+                }
+                return hot_keys_ + rng() % (keys_ - hot_keys_);
+            case KeyDistribution::ZIPF: {
+                double u = uniform(rng);
+                double uz = u * zeta_n_;
+                uint64_t rank;
+                if (uz < 1.0) {
+                    rank = 0;
+                } else if (uz < 1.0 + std::pow(0.5, theta_)) {
+                    rank = 1;
+                } else {
+                    rank = std::min<uint64_t>(keys_ - 1, static_cast<uint64_t>(keys_ * std::pow(eta_ * u - eta_ + 1.0, alpha_)));
+                }
+                return splitmix64(rank) % keys_;
+            }
+        }
+        return 0;
+    }
+
+    static std::string keyName(uint64_t id) { return "key:" + std::to_string(id); }
+};
+
+enum class Op { GET, PUT };
+
+// one in-flight request, owned by the completion queue until its tag comes back
+struct Call {
+    Op op;
+    // when the schedule said to send it, latency is measured from here
+    Clock::time_point intended;
+    Clock::time_point sent;
+    bool measured;
+    grpc::ClientContext context;
+    grpc::Status status;
+    distributed_cache::GetResponse get_response;
+    distributed_cache::PutResponse put_response;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<distributed_cache::GetResponse>> get_reader;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<distributed_cache::PutResponse>> put_reader;
+};
+
+struct OpStats {
+    // microseconds from the scheduled send time, includes any time spent waiting to be sent
+    HdrHistogram latency;
+    // microseconds from the actual send, what a closed-loop client would have reported
+    HdrHistogram service;
+    uint64_t errors = 0;
+    uint64_t misses = 0;
+
+    void merge(const OpStats& other) {
+        latency.merge(other.latency);
+        service.merge(other.service);
+        errors += other.errors;
+        misses += other.misses;
+    }
+};
+
+// progress counters read by the reporting thread
+struct Progress {
+    std::atomic<uint64_t> completed{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> outstanding{0};
+};
+
+class Worker {
+private:
+    const LoadOptions& options_;
+    std::size_t id_;
+    Progress& progress_;
+    grpc::CompletionQueue cq_;
+    std::vector<std::unique_ptr<distributed_cache::DistributedCache::Stub>> stubs_;
+    KeyGenerator keys_;
+    std::mt19937_64 rng_;
+    std::string value_pool_;
+    std::size_t outstanding_ = 0;
+    // sends that went out late because max_outstanding was reached
+    uint64_t stalled_sends_ = 0;
+
+    OpStats get_stats_;
+    OpStats put_stats_;
+
+    void issue(Op op, uint64_t key_id, Clock::time_point intended, bool measured) {
+        auto* call = new Call();
+        call->op = op;
+        call->intended = intended;
+        call->sent = Clock::now();
+        call->measured = measured;
+        // gRPC deadlines only take system_clock time points
+        call->context.set_deadline(std::chrono::system_clock::now() + options_.timeout);
+
+        auto& stub = stubs_[rng_() % stubs_.size()];
+        std::string key = KeyGenerator::keyName(key_id);
+        if (op == Op::GET) {
+            distributed_cache::GetRequest request;
+            request.set_key(key);
+            call->get_reader = stub->AsyncGet(&call->context, request, &cq_);
+            call->get_reader->Finish(&call->get_response, &call->status, call);
+        } else {
+            distributed_cache::PutRequest request;
+            request.set_key(key);
+            uint64_t size = std::min<uint64_t>(options_.value_size.pick(rng_), value_pool_.size());
+            request.set_value(value_pool_.substr(rng_() % (value_pool_.size() - size + 1), size));
+            request.set_ttl(static_cast<int64_t>(options_.ttl.pick(rng_)));
+            call->put_reader = stub->AsyncPut(&call->context, request, &cq_);
+            call->put_reader->Finish(&call->put_response, &call->status, call);
+        }
+        ++outstanding_;
+        progress_.outstanding.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void complete(Call* call) {
+        auto now = Clock::now();
+        --outstanding_;
+        progress_.outstanding.fetch_sub(1, std::memory_order_relaxed);
+        progress_.completed.fetch_add(1, std::memory_order_relaxed);
+
+        // a miss is a normal answer for a cache
+        bool miss = call->op == Op::GET && call->status.error_code() == grpc::StatusCode::NOT_FOUND;
+        bool error = !call->status.ok() && !miss;
+        if (error) {
+            progress_.errors.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (call->measured) {
+            OpStats& stats = call->op == Op::GET ? get_stats_ : put_stats_;
+            stats.latency.record(std::chrono::duration_cast<std::chrono::microseconds>(now - call->intended).count());
+            stats.service.record(std::chrono::duration_cast<std::chrono::microseconds>(now - call->sent).count());
+            stats.errors += error ? 1 : 0;
+            stats.misses += miss ? 1 : 0;
+        }
+        delete call;
+    }
+
+    // wait for at most one completion until deadline
+    void poll(Clock::time_point deadline) {
+        void* tag;
+        bool ok;
+        auto wall_deadline = std::chrono::system_clock::now() + (deadline - Clock::now());
+        if (cq_.AsyncNext(&tag, &ok, wall_deadline) == grpc::CompletionQueue::GOT_EVENT) {
+            complete(static_cast<Call*>(tag));
+        }
+    }
+
+public:
+    Worker(const LoadOptions& options, std::size_t id, Progress& progress)
+        : options_(options)
+        , id_(id)
+        , progress_(progress)
+        , keys_(options)
+        , rng_(splitmix64(id + 1) ^ static_cast<uint64_t>(std::time(nullptr))) {
+        for (const auto& target : options_.targets) {
+            // a private subchannel pool gives every worker its own connections instead of sharing one per target
+            grpc::ChannelArguments args;
+            args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+            auto channel = grpc::CreateCustomChannel(target, grpc::InsecureChannelCredentials(), args);
+            stubs_.push_back(distributed_cache::DistributedCache::NewStub(channel));
+        }
+        // values are slices of one random buffer, so building a request costs one copy
+        value_pool_.resize(std::max<uint64_t>(options_.value_size.max, 1) * 2);
+        for (auto& c : value_pool_) {
+            c = static_cast<char>('a' + rng_() % 26);
+        }
+    }
+
+    ~Worker() {
+        cq_.Shutdown();
+        void* tag;
+        bool ok;
+        while (cq_.Next(&tag, &ok)) {
+            delete static_cast<Call*>(tag);
+        }
+    }
+
+    // writes this worker's share of the key space as fast as max_outstanding allows
+    void preload() {
+        for (uint64_t key = id_; key < options_.keys; key += options_.workers) {
+            while (outstanding_ >= options_.max_outstanding) {
+                poll(Clock::now() + std::chrono::milliseconds(100));
+            }
+            issue(Op::PUT, key, Clock::now(), false);
+        }
+        while (outstanding_ > 0) {
+            poll(Clock::now() + std::chrono::milliseconds(100));
+        }
+    }
+
+    void run(Clock::time_point start) {
+        auto interval = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(options_.workers / options_.rate));
+        auto measure_from = start + options_.warmup;
+        auto end = measure_from + options_.duration;
+        // stagger the workers so their sends interleave instead of bunching up
+        Clock::time_point next = start + interval * static_cast<Clock::rep>(id_) / static_cast<Clock::rep>(options_.workers);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+        while (next < end || outstanding_ > 0) {
+            auto now = Clock::now();
+            if (next < end && next <= now) {
+                if (outstanding_ < options_.max_outstanding) {
+                    Op op = uniform(rng_) < options_.read_ratio ? Op::GET : Op::PUT;
+                    // a late send keeps its scheduled time, the wait counts toward its latency
+                    if (now - next > interval) {
+                        ++stalled_sends_;
+                    }
+                    issue(op, keys_.next(rng_), next, next >= measure_from);
+                    next += interval;
+                    continue;
+                }
+                poll(now + std::chrono::milliseconds(10));
+                continue;
+            }
+            poll(next < end ? next : now + std::chrono::milliseconds(100));
+        }
+    }
+
+    const OpStats& getStats() const { return get_stats_; }
+    const OpStats& putStats() const { return put_stats_; }
+    uint64_t stalledSends() const { return stalled_sends_; }
+};
+
+bool parseSizeRange(const std::string& value, SizeRange& range) {
+    std::size_t colon = value.find(':');
+    range.min = std::stoull(value.substr(0, colon));
+    range.max = colon == std::string::npos ? range.min : std::stoull(value.substr(colon + 1));
+    return range.min <= range.max;
+}
+
+std::vector<std::string> splitList(const std::string& value) {
+    std::vector<std::string> items;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+const std::vector<double> PERCENTILES = {50, 90, 99, 99.9, 99.99};
+
+// "p99.9", independent of the stream's float formatting
+std::string percentileLabel(double percentile) {
+    std::ostringstream label;
+    label << "p" << percentile;
+    return label.str();
+}
+
+void printStats(const std::string& name, const OpStats& stats, double seconds) {
+    std::cout << std::left << std::setw(6) << name << std::right
+              << " count=" << stats.latency.count()
+              << " rate=" << std::fixed << std::setprecision(1) << stats.latency.count() / seconds << "/s"
+              << " errors=" << stats.errors;
+    if (name == "get") {
+        std::cout << " misses=" << stats.misses;
+    }
+    std::cout << std::endl;
+    for (const auto* histogram : {&stats.latency, &stats.service}) {
+        std::cout << "  " << std::left << std::setw(9) << (histogram == &stats.latency ? "latency" : "service") << std::right
+                  << std::setprecision(1) << " mean=" << histogram->mean() / 1000.0 << "ms";
+        for (double p : PERCENTILES) {
+            std::cout << " " << percentileLabel(p) << "=" << std::setprecision(2) << histogram->valueAtPercentile(p) / 1000.0 << "ms";
+        }
+        std::cout << " max=" << histogram->max() / 1000.0 << "ms" << std::endl;
+    }
+}
+
+void writeHistogramJson(std::ostream& out, const HdrHistogram& histogram) {
+    out << "{\"mean_us\": " << histogram.mean() << ", \"max_us\": " << histogram.max() << ", \"percentiles_us\": {";
+    for (std::size_t i = 0; i < PERCENTILES.size(); ++i) {
+        out << (i == 0 ? "" : ", ") << "\"" << percentileLabel(PERCENTILES[i]) << "\": " << histogram.valueAtPercentile(PERCENTILES[i]);
+    }
+    out << "}}";
+}
+
+bool writeJson(const LoadOptions& options, const OpStats& gets, const OpStats& puts, double seconds, uint64_t stalled) {
+    std::ofstream out(options.out_path);
+    if (!out) {
+        std::cerr << "Failed to open " << options.out_path << std::endl;
+        return false;
+    }
+    out << "{\n  \"timestamp\": " << std::time(nullptr)
+        << ",\n  \"target_rate\": " << options.rate
+        << ",\n  \"achieved_rate\": " << (gets.latency.count() + puts.latency.count()) / seconds
+        << ",\n  \"duration_seconds\": " << seconds
+        << ",\n  \"read_ratio\": " << options.read_ratio
+        << ",\n  \"keys\": " << options.keys
+        << ",\n  \"stalled_sends\": " << stalled;
+    const std::pair<const char*, const OpStats*> ops[] = {{"get", &gets}, {"put", &puts}};
+    for (const auto& [name, stats] : ops) {
+        out << ",\n  \"" << name << "\": {\"count\": " << stats->latency.count()
+            << ", \"errors\": " << stats->errors << ", \"misses\": " << stats->misses << ", \"latency\": ";
+        writeHistogramJson(out, stats->latency);
+        out << ", \"service\": ";
+        writeHistogramJson(out, stats->service);
+        out << "}";
+    }
+    out << "\n}\n";
+    return true;
+}
+
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " --targets=HOST:PORT[,HOST:PORT...] [options]" << std::endl;
+    std::cerr << "  --rate=N                requests per second over all workers (default: 1000)" << std::endl;
+    std::cerr << "  --duration=S            measured seconds (default: 30)" << std::endl;
+    std::cerr << "  --warmup=S              unmeasured seconds before that (default: 5)" << std::endl;
+    std::cerr << "  --workers=N             threads, each with its own completion queue and connections (default: 4)" << std::endl;
+    std::cerr << "  --max-outstanding=N     in-flight requests per worker before sends are delayed (default: 1024)" << std::endl;
+    std::cerr << "  --timeout-ms=N          per-request deadline (default: 1000)" << std::endl;
+    std::cerr << "  --read-ratio=F          fraction of gets, the rest are puts (default: 0.9)" << std::endl;
+    std::cerr << "  --keys=N                key space size (default: 100000)" << std::endl;
+    std::cerr << "  --distribution=D       uniform, zipf or hotspot (default: zipf)" << std::endl;
+    std::cerr << "  --zipf-theta=F          zipf skew, not 1 (default: 0.99)" << std::endl;
+    std::cerr << "  --hotspot=K:O           fraction K of the keys gets fraction O of the ops (default: 0.2:0.8)" << std::endl;
+    std::cerr << "  --value-size=N|MIN:MAX  put value bytes, fixed or uniform (default: 100)" << std::endl;
+    std::cerr << "  --ttl=N|MIN:MAX         put ttl seconds, fixed or uniform (default: 300)" << std::endl;
+    std::cerr << "  --preload               write every key once before the run" << std::endl;
+    std::cerr << "  --out=PATH              also write the results as JSON" << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    LoadOptions options;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            std::size_t eq = arg.find('=');
+            std::string name = arg.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+            if (name == "--targets") {
+                options.targets = splitList(value);
+            } else if (name == "--rate") {
+                options.rate = std::stod(value);
+            } else if (name == "--duration") {
+                options.duration = std::chrono::seconds(std::stoll(value));
+            } else if (name == "--warmup") {
+                options.warmup = std::chrono::seconds(std::stoll(value));
+            } else if (name == "--workers") {
+                options.workers = std::max<std::size_t>(1, std::stoull(value));
+            } else if (name == "--max-outstanding") {
+                options.max_outstanding = std::max<std::size_t>(1, std::stoull(value));
+            } else if (name == "--timeout-ms") {
+                options.timeout = std::chrono::milliseconds(std::stoll(value));
+            } else if (name == "--read-ratio") {
+                options.read_ratio = std::stod(value);
+            } else if (name == "--keys") {
+                options.keys = std::max<uint64_t>(2, std::stoull(value));
+            } else if (name == "--distribution") {
+                if (value == "uniform") {
+                    options.distribution = KeyDistribution::UNIFORM;
+                } else if (value == "zipf") {
+                    options.distribution = KeyDistribution::ZIPF;
+                } else if (value == "hotspot") {
+                    options.distribution = KeyDistribution::HOTSPOT;
+                } else {
+                    std::cerr << "Unknown distribution: " << value << std::endl;
+                    return 1;
+                }
+            } else if (name == "--zipf-theta") {
+                options.zipf_theta = std::stod(value);
+            } else if (name == "--hotspot") {
+                std::size_t colon = value.find(':');
+                options.hotspot_keys = std::stod(value.substr(0, colon));
+                if (colon != std::string::npos) {
+                    options.hotspot_ops = std::stod(value.substr(colon + 1));
+                }
+            } else if (name == "--value-size") {
+                if (!parseSizeRange(value, options.value_size)) {
+                    std::cerr << "Invalid value size range: " << value << std::endl;
+                    return 1;
+                }
+            } else if (name == "--ttl") {
+                if (!parseSizeRange(value, options.ttl)) {
+                    std::cerr << "Invalid ttl range: " << value << std::endl;
+                    return 1;
+                }
+            } else if (name == "--preload") {
+                options.preload = true;
+            } else if (name == "--out") {
+                options.out_path = value;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Invalid option value: " << e.what() << std::endl;
+        return 1;
+    }
+    if (options.targets.empty() || options.rate <= 0 || options.zipf_theta == 1.0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Progress progress;
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (std::size_t i = 0; i < options.workers; ++i) {
+        workers.push_back(std::make_unique<Worker>(options, i, progress));
+    }
+
+    if (options.preload) {
+        std::cout << "Preloading " << options.keys << " keys..." << std::endl;
+        std::vector<std::thread> threads;
+        for (auto& worker : workers) {
+            threads.emplace_back([&worker]() { worker->preload(); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        progress.completed = 0;
+        progress.errors = 0;
+    }
+
+    std::cout << "Offering " << options.rate << " req/s to " << options.targets.size() << " targets for "
+              << options.warmup.count() << "s warmup + " << options.duration.count() << "s" << std::endl;
+
+    auto start = Clock::now() + std::chrono::milliseconds(100);
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back([&worker, start]() { worker->run(start); });
+    }
+
+    // one progress line per second while the schedule runs
+    std::atomic<bool> finished{false};
+    std::thread reporter([&]() {
+        uint64_t last_completed = 0;
+        auto tick = start;
+        auto end = start + options.warmup + options.duration;
+        while (!finished) {
+            tick += std::chrono::seconds(1);
+            std::this_thread::sleep_until(tick);
+            if (finished || tick > end) {
+                break;
+            }
+            uint64_t completed = progress.completed.load();
+            std::cout << "[" << std::chrono::duration_cast<std::chrono::seconds>(tick - start).count() << "s"
+                      << (tick <= start + options.warmup ? " warmup" : "") << "] "
+                      << (completed - last_completed) << " req/s, "
+                      << progress.errors.load() << " errors, "
+                      << progress.outstanding.load() << " outstanding" << std::endl;
+            last_completed = completed;
+        }
+    });
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    finished = true;
+    reporter.join();
+
+    OpStats gets;
+    OpStats puts;
+    uint64_t stalled = 0;
+    for (const auto& worker : workers) {
+        gets.merge(worker->getStats());
+        puts.merge(worker->putStats());
+        stalled += worker->stalledSends();
+    }
+
+    double seconds = std::chrono::duration<double>(options.duration).count();
+    std::cout << std::endl;
+    printStats("get", gets, seconds);
+    printStats("put", puts, seconds);
+    if (stalled > 0) {
+        std::cout << stalled << " sends were delayed by --max-outstanding, their wait is included in latency" << std::endl;
+    }
+
+    if (!options.out_path.empty() && !writeJson(options, gets, puts, seconds, stalled)) {
+        return 1;
+    }
+    return 0;
+}
@@ -2,44 +2,381 @@
 #define LRU_H
 
 #include <unordered_map>
+#include <atomic>
+#include <deque>
 #include <list>
+#include <memory_resource>
+#include <string>
+#include <string_view>
 #include <cstddef>
+#include <cstdint>
 #include <optional>
-#include <mutex> 
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <tuple>
+#include <vector>
+#include <algorithm>
+
+// why an entry entered or left the cache, reported to the listener
+enum class CacheEvent {
+    INSERTED,
+    // overwritten by a newer put, reported before the INSERTED of the new value
+    REPLACED,
+    REMOVED,
+    EVICTED,
+    EXPIRED,
+    // a versioned remove left a tombstone, after the REMOVED of the entry if there was one; value is empty
+    TOMBSTONED,
+    // the tombstone aged out or a newer write replaced it
+    TOMBSTONE_DROPPED
+};
+
+// how the cache keeps keys and values: as they are, indexed by a copy of the key
+template <typename T>
+struct CacheStorage {
+    using Stored = T;
+    using IndexKey = T;
+    static Stored make(const T& value, std::pmr::memory_resource*) { return value; }
+    static void assign(Stored& stored, const T& value) { stored = value; }
+    static void load(const Stored& stored, T& value) { value = stored; }
+    static const IndexKey& indexKey(const T& key) { return key; }
+};
+
+// strings are copied into the cache's memory resource and indexed by a view of the stored key,
+// so the key bytes exist once
+template <>
+struct CacheStorage<std::string> {
+    using Stored = std::pmr::string;
+    using IndexKey = std::string_view;
+    static Stored make(const std::string& value, std::pmr::memory_resource* resource) {
+        return Stored(value.data(), value.size(), resource);
+    }
+    static void assign(Stored& stored, const std::string& value) {
+        // reuse the buffer unless it would waste more than half of it, and grow to the exact size
+        if (value.size() > stored.capacity() || value.size() < stored.capacity() / 2) {
+            Stored(value.data(), value.size(), stored.get_allocator()).swap(stored);
+        } else {
+            stored.assign(value.data(), value.size());
+        }
+    }
+    static void load(const Stored& stored, std::string& value) { value.assign(stored.data(), stored.size()); }
+    static IndexKey indexKey(std::string_view key) { return key; }
+};
 
 template <typename K, typename V>
 class LRUCache {
 
+public:
+    using StoredKey = typename CacheStorage<K>::Stored;
+    using StoredValue = typename CacheStorage<V>::Stored;
+    // invoked with the cache lock held, so it must be cheap and must not call back into the cache
+    using Listener = std::function<void(CacheEvent event, const StoredKey& key, const StoredValue& value, uint64_t version,
+                                        std::chrono::steady_clock::time_point expiry)>;
+    // index of the partition a key belongs to, out-of-range indexes fall into partition 0
+    using Partitioner = std::function<std::size_t(const K& key)>;
+    // bytes an entry counts against its partition's byte limit
+    using Weigher = std::function<std::size_t(const K& key, const V& value)>;
+
+    // own limits of one partition, 0 means none; the cache capacity still bounds all partitions together
+    struct PartitionLimits {
+        std::size_t max_entries = 0;
+        std::size_t max_bytes = 0;
+        // false evicts in insertion order (FIFO) instead of least recently used
+        bool promote_on_get = true;
+    };
+
 private:
+    using KeyStorage = CacheStorage<K>;
+    using ValueStorage = CacheStorage<V>;
+
     struct CacheItem {
-        K key;
-        V value;
+        StoredKey key;
+        StoredValue value;
         std::chrono::steady_clock::time_point expiry;
+        // ordering stamp assigned by the writer, 0 if unknown
+        uint64_t version;
+        std::size_t partition;
+        std::size_t weight;
 
-        CacheItem(const K& k, const V& v, int64_t ttl_seconds): 
-            key(k), 
-            value(v), 
-            expiry(std::chrono::steady_clock::now() + std::chrono::seconds(ttl_seconds))
+        CacheItem(const K& k, const V& v, std::chrono::steady_clock::time_point exp, uint64_t ver, std::size_t part, std::size_t w,
+                  std::pmr::memory_resource* resource):
+            key(KeyStorage::make(k, resource)),
+            value(ValueStorage::make(v, resource)),
+            expiry(exp),
+            version(ver),
+            partition(part),
+            weight(w)
             {};
     };
 
+    // entries of one partition, most recently used first. The counters are only written under the
+    // cache lock but can be read without it
+    struct Partition {
+        PartitionLimits limits;
+        std::pmr::list<CacheItem> items;
+        std::atomic<std::size_t> entries{0};
+        std::atomic<std::size_t> bytes{0};
+
+        explicit Partition(std::pmr::memory_resource* resource): items(resource) {}
+    };
+
+    using ItemIterator = typename std::pmr::list<CacheItem>::iterator;
+    using CacheMap = std::pmr::unordered_map<typename KeyStorage::IndexKey, ItemIterator>;
+
+    // what a versioned remove leaves of a key, so that a put older than the remove arriving later is refused.
+    // Allocated from the default resource, tombstones don't take entry memory
+    struct Tombstone {
+        StoredKey key;
+        uint64_t version;
+        std::chrono::steady_clock::time_point expiry;
+    };
+    using TombstoneIterator = typename std::list<Tombstone>::iterator;
+
     std::size_t capacity_;
-    // maps to an iterator to the cache list
-    std::unordered_map<K, typename std::list<CacheItem>::iterator> cache_map_;
-    // cache list 
-    std::list<CacheItem> cache_list_;
-    
+    // entries, their list and index nodes come from here
+    std::pmr::memory_resource* resource_;
+    // maps to an iterator into the list of the key's partition
+    CacheMap cache_map_;
+    // a deque, since a partition can't be moved
+    std::deque<Partition> partitions_;
+    Partitioner partitioner_;
+    Weigher weigher_;
+
+    // oldest first; all live equally long, so this is also expiry order
+    std::list<Tombstone> tombstones_;
+    std::unordered_map<typename KeyStorage::IndexKey, TombstoneIterator> tombstone_map_;
+    std::chrono::steady_clock::duration tombstone_ttl_{};
+    std::size_t max_tombstones_ = 0;
+    // handed to the listener as the value of a tombstone
+    const StoredValue no_value_{};
+
     std::mutex cache_mutex_;
+    Listener listener_;
+    // contended acquisitions of cache_mutex_ and the time spent waiting for them,
+    // only written once the lock is held, so they add no contention of their own
+    std::atomic<uint64_t> lock_contentions_{0};
+    std::atomic<uint64_t> lock_wait_nanos_{0};
+    // the same wait, per calling thread, so a caller can attribute it to one operation
+    static inline thread_local uint64_t thread_lock_wait_nanos_ = 0;
+
+    // the uncontended path costs a try_lock, the clock is only read when we have to wait
+    std::unique_lock<std::mutex> lockCache(){
+        std::unique_lock<std::mutex> lock(cache_mutex_, std::try_to_lock);
+        if (!lock.owns_lock()){
+            auto start = std::chrono::steady_clock::now();
+            lock.lock();
+            auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            lock_wait_nanos_.fetch_add(waited.count(), std::memory_order_relaxed);
+            lock_contentions_.fetch_add(1, std::memory_order_relaxed);
+            thread_lock_wait_nanos_ += waited.count();
+        }
+        return lock;
+    }
+
+    void notify(CacheEvent event, const CacheItem& item){
+        if (listener_){
+            listener_(event, item.key, item.value, item.version, item.expiry);
+        }
+    }
+
+    void notify(CacheEvent event, const Tombstone& tombstone){
+        if (listener_){
+            listener_(event, tombstone.key, no_value_, tombstone.version, tombstone.expiry);
+        }
+    }
+
+    // whether the key was removed at or after version; caller must hold cache_mutex_
+    bool buriedSinceLocked(const K& key, uint64_t version) const {
+        if (tombstone_map_.empty()){
+            return false;
+        }
+        auto it = tombstone_map_.find(KeyStorage::indexKey(key));
+        return it != tombstone_map_.end() && it->second->version >= version;
+    }
+
+    void dropTombstoneLocked(TombstoneIterator tombstone){
+        notify(CacheEvent::TOMBSTONE_DROPPED, *tombstone);
+        tombstone_map_.erase(KeyStorage::indexKey(tombstone->key));
+        tombstones_.erase(tombstone);
+    }
+
+    void buryLocked(const K& key, uint64_t version){
+        auto it = tombstone_map_.find(KeyStorage::indexKey(key));
+        if (it != tombstone_map_.end()){
+            dropTombstoneLocked(it->second);
+        }
+        tombstones_.push_back(Tombstone{KeyStorage::make(key, std::pmr::get_default_resource()), version,
+                                        std::chrono::steady_clock::now() + tombstone_ttl_});
+        tombstone_map_.emplace(KeyStorage::indexKey(tombstones_.back().key), std::prev(tombstones_.end()));
+        notify(CacheEvent::TOMBSTONED, tombstones_.back());
+        if (tombstones_.size() > max_tombstones_){
+            dropTombstoneLocked(tombstones_.begin());
+        }
+    }
+
+    void promoteLocked(ItemIterator item){
+        Partition& partition = partitions_[item->partition];
+        if (partition.limits.promote_on_get){
+            partition.items.splice(partition.items.begin(), partition.items, item);
+        }
+    }
+
+    std::size_t partitionOf(const K& key) const {
+        std::size_t partition = partitioner_ ? partitioner_(key) : 0;
+        return partition < partitions_.size() ? partition : 0;
+    }
+
+    static void adjust(std::atomic<std::size_t>& counter, std::size_t add, std::size_t subtract){
+        counter.store(counter.load(std::memory_order_relaxed) + add - subtract, std::memory_order_relaxed);
+    }
+
+    // caller must hold cache_mutex_
+    void unlinkLocked(ItemIterator item){
+        Partition& partition = partitions_[item->partition];
+        adjust(partition.entries, 0, 1);
+        adjust(partition.bytes, 0, item->weight);
+        cache_map_.erase(KeyStorage::indexKey(item->key));
+        partition.items.erase(item);
+    }
+
+    void evictTailLocked(Partition& partition){
+        auto tail = std::prev(partition.items.end());
+        notify(CacheEvent::EVICTED, *tail);
+        unlinkLocked(tail);
+    }
+
+    // a partition over its own limits only evicts its own entries, and a full cache evicts from the inserting
+    // partition unless that one is under its fair share, so one partition filling up can't push out another's
+    // entries. The entry just inserted is never evicted, even if it alone is over the byte limit
+    void enforceLimitsLocked(std::size_t index){
+        Partition& partition = partitions_[index];
+        const PartitionLimits& limits = partition.limits;
+        while (partition.items.size() > 1
+               && ((limits.max_entries > 0 && partition.items.size() > limits.max_entries)
+                   || (limits.max_bytes > 0 && partition.bytes.load(std::memory_order_relaxed) > limits.max_bytes))){
+            evictTailLocked(partition);
+        }
+        if (cache_map_.size() > capacity_){
+            // a partition's fair share is its configured max_entries, or else the capacity split evenly among the
+            // partitions holding anything. The inserting partition pays for the insert if it was already at its
+            // share before it; otherwise the partition furthest over its own share does, so a tenant without a
+            // quota only pushes out another one that holds more than its share
+            std::size_t active = 0;
+            for (const auto& candidate : partitions_){
+                active += candidate.items.empty() ? 0 : 1;
+            }
+            auto share = [&](const Partition& candidate) -> std::ptrdiff_t {
+                return static_cast<std::ptrdiff_t>(candidate.limits.max_entries > 0
+                    ? candidate.limits.max_entries : capacity_ / std::max<std::size_t>(active, 1));
+            };
+            auto excess = [&](const Partition& candidate) {
+                return static_cast<std::ptrdiff_t>(candidate.items.size()) - share(candidate);
+            };
+            Partition* victim = nullptr;
+            if (partition.items.size() > 1 && excess(partition) > 0){
+                victim = &partition;
+            }else{
+                for (auto& candidate : partitions_){
+                    // the entry just inserted stays
+                    std::size_t evictable = candidate.items.size() - (&candidate == &partition ? 1 : 0);
+                    if (evictable > 0 && (!victim || excess(candidate) > excess(*victim))){
+                        victim = &candidate;
+                    }
+                }
+            }
+            if (victim){
+                evictTailLocked(*victim);
+            }
+        }
+    }
+
+    // caller must hold cache_mutex_
+    void putLocked(const K& key, const V& value, int64_t ttl_seconds, uint64_t version){
+        putLocked(key, value, std::chrono::steady_clock::now() + std::chrono::seconds(ttl_seconds), version);
+    }
+
+    void putLocked(const K& key, const V& value, std::chrono::steady_clock::time_point expiry, uint64_t version){
+        if (!tombstone_map_.empty()){
+            // the key is back, the caller already checked the write is newer than the remove where it has to be
+            auto tombstone = tombstone_map_.find(KeyStorage::indexKey(key));
+            if (tombstone != tombstone_map_.end()){
+                dropTombstoneLocked(tombstone->second);
+            }
+        }
+        std::size_t weight = weigher_ ? weigher_(key, value) : 0;
+        std::size_t index;
+        auto it = cache_map_.find(KeyStorage::indexKey(key));
+        if (it == cache_map_.end()){
+            index = partitionOf(key);
+            Partition& partition = partitions_[index];
+            partition.items.emplace_front(key, value, expiry, version, index, weight, resource_);
+            cache_map_.emplace(KeyStorage::indexKey(partition.items.front().key), partition.items.begin());
+            adjust(partition.entries, 1, 0);
+            adjust(partition.bytes, weight, 0);
+        }else{
+            // get the iterator
+            auto list_iterator = it->second;
+            index = list_iterator->partition;
+            Partition& partition = partitions_[index];
+            notify(CacheEvent::REPLACED, *list_iterator);
+            adjust(partition.bytes, weight, list_iterator->weight);
+            ValueStorage::assign(list_iterator->value, value);
+            list_iterator->expiry = expiry;
+            list_iterator->version = version;
+            list_iterator->weight = weight;
+            // move to front
+            partition.items.splice(partition.items.begin(), partition.items, list_iterator);
+
+        }
+        notify(CacheEvent::INSERTED, partitions_[index].items.front());
+
+        enforceLimitsLocked(index);
+    }
 
 public:
-    LRUCache(std::size_t capacity): capacity_(capacity) {};
-    
+    // a live entry as peek() copies it
+    struct Entry {
+        V value;
+        uint64_t version = 0;
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    // without a resource, entries are allocated from the default one
+    LRUCache(std::size_t capacity, std::pmr::memory_resource* resource = std::pmr::get_default_resource()):
+        capacity_(capacity), resource_(resource), cache_map_(resource) {
+        partitions_.emplace_back(resource_);
+    };
+
+    // set before the cache is shared between threads
+    void setListener(Listener listener) { listener_ = std::move(listener); }
+
+    // keep a tombstone for ttl after every versioned remove, at most max_tombstones of them with the oldest
+    // dropped first. Off by default; set before the cache is shared between threads
+    void setTombstones(std::chrono::steady_clock::duration ttl, std::size_t max_tombstones){
+        tombstone_ttl_ = ttl;
+        max_tombstones_ = max_tombstones;
+    }
+
+    // split the cache into partitions with limits of their own, set before the cache holds anything
+    void setPartitions(const std::vector<PartitionLimits>& limits, Partitioner partitioner, Weigher weigher){
+        partitions_.clear();
+        for (std::size_t i = 0; i < std::max<std::size_t>(limits.size(), 1); ++i){
+            partitions_.emplace_back(resource_);
+        }
+        for (std::size_t i = 0; i < limits.size(); ++i){
+            partitions_[i].limits = limits[i];
+        }
+        partitioner_ = std::move(partitioner);
+        weigher_ = std::move(weigher);
+    }
+
     // return a copy of the value
     bool get(const K& key, V& value) {
-        std::lock_guard<std::mutex> lock(cache_mutex_);
+        auto lock = lockCache();
 
         // iterator for unordered_map
-        auto it = cache_map_.find(key);
+        auto it = cache_map_.find(KeyStorage::indexKey(key));
         // check if end of iterator
         if (it == cache_map_.end()){
             return false;
@@ -47,56 +384,166 @@ public:
 
         auto list_iterator = it->second;
 
-        cache_list_.splice(cache_list_.begin(), cache_list_, list_iterator);
+        promoteLocked(list_iterator);
 
-        value = list_iterator->value;
+        ValueStorage::load(list_iterator->value, value);
         return true;
 
     }
 
-    // insert a key-value pair
-    void put(const K& key, const V& value, int64_t ttl_seconds = 60){
-        std::lock_guard<std::mutex> lock(cache_mutex_);
+    // same as get, also copying the version
+    bool get(const K& key, V& value, uint64_t& version) {
+        auto lock = lockCache();
+        auto it = cache_map_.find(KeyStorage::indexKey(key));
+        if (it == cache_map_.end()){
+            return false;
+        }
+        promoteLocked(it->second);
+        ValueStorage::load(it->second->value, value);
+        version = it->second->version;
+        return true;
+    }
 
-        if (cache_map_.find(key) == cache_map_.end()){
-            // create an iterator? 
-            cache_list_.emplace_front(key, value, ttl_seconds);
-            cache_map_[key] = cache_list_.begin();
-        }else{
-            // get the iterator
-            auto list_iterator = cache_map_[key];
-            list_iterator->value = value;
-            // move to front 
-            cache_list_.splice(cache_list_.begin(), cache_list_, list_iterator);
+    // copy the value with its version and remaining ttl, without touching the recency order
+    bool peek(const K& key, V& value, uint64_t& version, int64_t& ttl_remaining) {
+        auto lock = lockCache();
+        auto it = cache_map_.find(KeyStorage::indexKey(key));
+        if (it == cache_map_.end()){
+            return false;
+        }
+        auto remaining = it->second->expiry - std::chrono::steady_clock::now();
+        if (remaining <= std::chrono::steady_clock::duration::zero()){
+            return false;
+        }
+        ValueStorage::load(it->second->value, value);
+        version = it->second->version;
+        ttl_remaining = std::chrono::duration_cast<std::chrono::seconds>(remaining).count() + 1;
+        return true;
+    }
 
+    // copy the live entry, absent if expired, without touching the recency order
+    bool peek(const K& key, Entry& entry) {
+        auto lock = lockCache();
+        auto it = cache_map_.find(KeyStorage::indexKey(key));
+        if (it == cache_map_.end() || it->second->expiry <= std::chrono::steady_clock::now()){
+            return false;
         }
+        ValueStorage::load(it->second->value, entry.value);
+        entry.version = it->second->version;
+        entry.expiry = it->second->expiry;
+        return true;
+    }
 
-        // check if capacity is exceeded 
-        if (cache_map_.size() > capacity_){
-            auto it = std::prev(cache_list_.end());
+    // insert a key-value pair
+    void put(const K& key, const V& value, int64_t ttl_seconds = 60, uint64_t version = 0){
+        auto lock = lockCache();
+        putLocked(key, value, ttl_seconds, version);
+    }
 
-        
-            cache_map_.erase(it->key);
+    // insert only if the key is absent or holds an older version and wasn't removed by a newer remove,
+    // returns whether it was applied
+    bool putIfNewer(const K& key, const V& value, int64_t ttl_seconds, uint64_t version){
+        auto lock = lockCache();
+        auto it = cache_map_.find(KeyStorage::indexKey(key));
+        if ((it != cache_map_.end() && it->second->version >= version) || buriedSinceLocked(key, version)){
+            return false;
+        }
+        putLocked(key, value, ttl_seconds, version);
+        return true;
+    }
 
-            cache_list_.pop_back();
+    // same with an absolute expiry, as a peeked entry carries it
+    bool putIfNewer(const K& key, const V& value, std::chrono::steady_clock::time_point expiry, uint64_t version){
+        auto lock = lockCache();
+        auto it = cache_map_.find(KeyStorage::indexKey(key));
+        if ((it != cache_map_.end() && it->second->version >= version) || buriedSinceLocked(key, version)){
+            return false;
+        }
+        putLocked(key, value, expiry, version);
+        return true;
+    }
 
+    // insert many (key, value, ttl, version) items under a single lock acquisition, later items end up most recently used
+    void putBatch(const std::vector<std::tuple<K, V, int64_t, uint64_t>>& items){
+        auto lock = lockCache();
+        for (const auto& [key, value, ttl_seconds, version] : items){
+            putLocked(key, value, ttl_seconds, version);
         }
-        
+    }
 
+    // putIfNewer for many items under a single lock acquisition; applied[i] tells whether items[i] was stored.
+    // returns how many were
+    std::size_t putBatchIfNewer(const std::vector<std::tuple<K, V, int64_t, uint64_t>>& items, std::vector<bool>& applied){
+        auto lock = lockCache();
+        applied.assign(items.size(), false);
+        std::size_t stored = 0;
+        for (std::size_t i = 0; i < items.size(); ++i){
+            const auto& [key, value, ttl_seconds, version] = items[i];
+            auto it = cache_map_.find(KeyStorage::indexKey(key));
+            if ((it != cache_map_.end() && it->second->version >= version) || buriedSinceLocked(key, version)){
+                continue;
+            }
+            putLocked(key, value, ttl_seconds, version);
+            applied[i] = true;
+            ++stored;
+        }
+        return stored;
     }
 
     // delete a key-value pair
     void remove(const K& key){
-        std::lock_guard<std::mutex> lock(cache_mutex_);
-        auto it = cache_map_.find(key);
+        auto lock = lockCache();
+        auto it = cache_map_.find(KeyStorage::indexKey(key));
         // first check if key exists
         if (it == cache_map_.end()){
             return;
         }
 
-        cache_list_.erase(it->second);
-        cache_map_.erase(it);
+        notify(CacheEvent::REMOVED, *it->second);
+        unlinkLocked(it->second);
+
+    }
 
+    // remove as of version: an entry or tombstone written after it stays, and with tombstones on the key
+    // remembers the remove. Returns whether the remove was newer than what the key held
+    bool remove(const K& key, uint64_t version){
+        auto lock = lockCache();
+        auto it = cache_map_.find(KeyStorage::indexKey(key));
+        if ((it != cache_map_.end() && it->second->version >= version) || buriedSinceLocked(key, version)){
+            return false;
+        }
+        if (it != cache_map_.end()){
+            notify(CacheEvent::REMOVED, *it->second);
+            unlinkLocked(it->second);
+        }
+        if (max_tombstones_ > 0 && tombstone_ttl_ > std::chrono::steady_clock::duration::zero()){
+            buryLocked(key, version);
+        }
+        return true;
+    }
+
+    // drop every expired entry and tombstone, returns how many entries were removed
+    std::size_t removeExpired(){
+        auto lock = lockCache();
+        auto now = std::chrono::steady_clock::now();
+        std::size_t removed = 0;
+
+        for (auto& partition : partitions_){
+            auto it = partition.items.begin();
+            while (it != partition.items.end()){
+                auto next = std::next(it);
+                if (it->expiry <= now) {
+                    notify(CacheEvent::EXPIRED, *it);
+                    unlinkLocked(it);
+                    ++removed;
+                }
+                it = next;
+            }
+        }
+        while (!tombstones_.empty() && tombstones_.front().expiry <= now){
+            dropTombstoneLocked(tombstones_.begin());
+        }
+        return removed;
     }
 
     // return the number of elements in the cache
@@ -105,13 +552,52 @@ public:
     // return true if the cache is empty
     bool empty() const { return cache_map_.size() == 0;} ;
 
+    std::size_t tombstones() const { return tombstone_map_.size(); }
 
-    std::mutex& getMutex( ){return this->cache_mutex_; };
+    // version of the key's live tombstone
+    bool tombstone(const K& key, uint64_t& version){
+        auto lock = lockCache();
+        auto it = tombstone_map_.find(KeyStorage::indexKey(key));
+        if (it == tombstone_map_.end() || it->second->expiry <= std::chrono::steady_clock::now()){
+            return false;
+        }
+        version = it->second->version;
+        return true;
+    }
 
-    std::unordered_map<K, typename std::list<CacheItem>::iterator>& getCacheMap() { return cache_map_; };
+    std::size_t partitionEntries(std::size_t partition) const { return partitions_[partition].entries.load(std::memory_order_relaxed); }
+    std::size_t partitionBytes(std::size_t partition) const { return partitions_[partition].bytes.load(std::memory_order_relaxed); }
+
+    // visit every entry as (key, value, version, expiry) under the cache lock, so fn must not call back into the cache
+    template <typename Fn>
+    void forEach(Fn&& fn){
+        auto lock = lockCache();
+        for (const auto& partition : partitions_){
+            for (const auto& item : partition.items){
+                fn(item.key, item.value, item.version, item.expiry);
+            }
+        }
+    }
+
+
+    // visit every tombstone as (key, version, expiry) under the cache lock, like forEach
+    template <typename Fn>
+    void forEachTombstone(Fn&& fn){
+        auto lock = lockCache();
+        for (const auto& tombstone : tombstones_){
+            fn(tombstone.key, tombstone.version, tombstone.expiry);
+        }
+    }
+
+    uint64_t lockContentions() const { return lock_contentions_.load(std::memory_order_relaxed); }
+    uint64_t lockWaitNanos() const { return lock_wait_nanos_.load(std::memory_order_relaxed); }
+    // total lock wait of the calling thread so far
+    static uint64_t threadLockWaitNanos() { return thread_lock_wait_nanos_; }
+
+    std::mutex& getMutex( ){return this->cache_mutex_; };
 
+    CacheMap& getCacheMap() { return cache_map_; };
 
-    std::list<CacheItem>& getCacheList()  { return cache_list_; };
 };
 
 #endif
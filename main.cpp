@@ -1,5 +1,6 @@
 #include "node.h"
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 
@@ -7,31 +8,168 @@
 int main(int argc, char* argv[]){
 
     if(argc < 3){
-        std::cerr << "Usage: " << argv[0] << " <address> <peer1> <peer2> ..." << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [options] <address> <peer1> <peer2> ..." << std::endl;
+        std::cerr << "Options:" << std::endl;
+        std::cerr << "  --wal-dir=PATH          directory holding the per-node WAL segments (default: wal)" << std::endl;
+        std::cerr << "  --wal-segment-mb=N      rotate WAL segments at N MiB (default: 64)" << std::endl;
+        std::cerr << "  --wal-direct-io         write WAL segments with O_DIRECT" << std::endl;
+        std::cerr << "  --no-io-uring           use pwritev even if io_uring is available" << std::endl;
+        std::cerr << "  --no-wal-preallocate    do not fallocate new WAL segments" << std::endl;
+        std::cerr << "  --wal-queue-capacity=N  slots in the WAL write queue (default: 65536)" << std::endl;
+        std::cerr << "  --wal-backpressure=P    block, fail or spill when the write queue is full (default: block)" << std::endl;
+        std::cerr << "  --anti-entropy-interval=S  seconds between replica Merkle tree exchanges, 0 disables (default: 10)" << std::endl;
+        std::cerr << "  --cache-arena=PATH      mirror the cache into PATH (e.g. /dev/shm/node1) for warm restarts" << std::endl;
+        std::cerr << "  --cache-arena-slot-size=N  bytes per cache arena slot (default: 4096)" << std::endl;
+        std::cerr << "  --metrics-port=N        serve Prometheus metrics on http://0.0.0.0:N/metrics" << std::endl;
+        std::cerr << "  --trace-sample-rate=F   trace this fraction of requests phase by phase (default: 0)" << std::endl;
+        std::cerr << "  --slow-request-us=N     keep requests slower than N microseconds in the slow log (default: off)" << std::endl;
+        std::cerr << "  --slow-log-size=N       slow log entries kept (default: 256)" << std::endl;
+        std::cerr << "  --namespace=NAME[:entries=N,bytes=N[K|M|G],policy=lru|fifo,ttl=S]" << std::endl;
+        std::cerr << "                          give a tenant its own quota, eviction policy and default ttl, repeatable" << std::endl;
+        std::cerr << "  --ssd-tier=DIR          keep entries evicted from memory in segment files under DIR" << std::endl;
+        std::cerr << "  --ssd-tier-mb=N         SSD tier size in MB (default: 10240)" << std::endl;
+        std::cerr << "  --ssd-segment-mb=N      SSD tier segment size in MB (default: 64)" << std::endl;
+        std::cerr << "  --slab-mb=N             allocate cache entries from N MB of size-classed slab pages (default: off)" << std::endl;
+        std::cerr << "  --slab-growth-factor=F  chunk size ratio between slab classes (default: 1.25)" << std::endl;
+        std::cerr << "  --hot-key-sample=N      count one in N requests towards the hot keys, 0 disables (default: 16)" << std::endl;
+        std::cerr << "  --hot-key-window=S      seconds per hot key window (default: 10)" << std::endl;
+        std::cerr << "  --replication-timeout-ms=N  deadline of a write to a replica before it is hinted (default: 1000)" << std::endl;
+        std::cerr << "  --heartbeat-ms=N        ping peers every N ms to detect failures, 0 disables hinted handoff (default: 500)" << std::endl;
+        std::cerr << "  --phi-threshold=F       failure detector suspicion above which a peer counts as down (default: 8)" << std::endl;
+        std::cerr << "  --max-hints=N           writes kept for peers that are down (default: 100000)" << std::endl;
+        std::cerr << "  --tombstone-ttl=S       seconds a remove is remembered to refuse older writes, 0 disables (default: 600)" << std::endl;
+        std::cerr << "  --max-tombstones=N      removes remembered at most (default: 1000000)" << std::endl;
+        std::cerr << "  --fast-start            serve right away and replay the WAL in the background" << std::endl;
+        std::cerr << "  --max-watchers=N        clients with an open Watch stream (default: 16)" << std::endl;
+        std::cerr << "  --max-tracked-keys=N    keys tracked for client invalidation before ranges are dropped (default: 1000000)" << std::endl;
+        std::cerr << "  --access-log=PATH       append a sampled key access trace for cachemesh_sim to PATH" << std::endl;
+        std::cerr << "  --access-log-sample=F   fraction of keys whose accesses are logged (default: 0.01)" << std::endl;
         return 1;
     }
 
-    std::string address = argv[1];
-    std::vector<std::string> peers;
-    for(int i = 2; i < argc; ++i){
-        peers.push_back(argv[i]);
+    std::string wal_dir = "wal";
+    NodeOptions options;
+    std::vector<std::string> positional;
+
+    // options are --name=value or bare --name switches, everything else is an address
+    for(int i = 1; i < argc; ++i){
+        std::string arg = argv[i];
+        if(arg.rfind("--", 0) != 0){
+            positional.push_back(arg);
+            continue;
+        }
+        std::string name = arg.substr(2);
+        std::string value;
+        auto equals = name.find('=');
+        if(equals != std::string::npos){
+            value = name.substr(equals + 1);
+            name = name.substr(0, equals);
+        }
+
+        if(name == "wal-dir"){
+            wal_dir = value;
+        }else if(name == "wal-segment-mb"){
+            options.wal.segment_size = std::stoull(value) * 1024 * 1024;
+        }else if(name == "wal-direct-io"){
+            options.wal.direct_io = true;
+        }else if(name == "no-io-uring"){
+            options.wal.use_io_uring = false;
+        }else if(name == "no-wal-preallocate"){
+            options.wal.preallocate = false;
+        }else if(name == "wal-queue-capacity"){
+            options.write_queue.capacity = std::stoull(value);
+        }else if(name == "wal-backpressure"){
+            if(value == "block"){
+                options.write_queue.backpressure = BackpressurePolicy::BLOCK;
+            }else if(value == "fail"){
+                options.write_queue.backpressure = BackpressurePolicy::FAIL_FAST;
+            }else if(value == "spill"){
+                options.write_queue.backpressure = BackpressurePolicy::SPILL;
+            }else{
+                std::cerr << "Unknown backpressure policy: " << value << std::endl;
+                return 1;
+            }
+        }else if(name == "anti-entropy-interval"){
+            options.anti_entropy_interval = std::chrono::seconds(std::stoll(value));
+        }else if(name == "cache-arena"){
+            options.cache_arena_path = value;
+        }else if(name == "cache-arena-slot-size"){
+            options.cache_arena_slot_size = std::stoull(value);
+        }else if(name == "metrics-port"){
+            options.metrics_port = std::stoi(value);
+        }else if(name == "trace-sample-rate"){
+            options.tracing.sample_rate = std::stod(value);
+        }else if(name == "slow-request-us"){
+            options.tracing.slow_threshold = std::chrono::microseconds(std::stoll(value));
+        }else if(name == "slow-log-size"){
+            options.tracing.slow_log_capacity = std::stoull(value);
+        }else if(name == "namespace"){
+            options.namespaces.push_back(parseNamespaceOptions(value));
+        }else if(name == "ssd-tier"){
+            options.ssd_tier.path = value;
+        }else if(name == "ssd-tier-mb"){
+            options.ssd_tier.max_bytes = std::stoull(value) * 1024 * 1024;
+        }else if(name == "ssd-segment-mb"){
+            options.ssd_tier.segment_size = std::stoull(value) * 1024 * 1024;
+        }else if(name == "slab-mb"){
+            options.slab.max_bytes = std::stoull(value) * 1024 * 1024;
+        }else if(name == "slab-growth-factor"){
+            options.slab.growth_factor = std::stod(value);
+        }else if(name == "hot-key-sample"){
+            options.hot_keys.sample_every = static_cast<uint32_t>(std::stoul(value));
+        }else if(name == "hot-key-window"){
+            options.hot_keys.window = std::chrono::seconds(std::stoll(value));
+        }else if(name == "replication-timeout-ms"){
+            options.replication_timeout = std::chrono::milliseconds(std::stoll(value));
+        }else if(name == "heartbeat-ms"){
+            options.failure_detector.heartbeat_interval = std::chrono::milliseconds(std::stoll(value));
+        }else if(name == "phi-threshold"){
+            options.failure_detector.phi_threshold = std::stod(value);
+        }else if(name == "max-hints"){
+            options.hints.max_hints = std::stoull(value);
+        }else if(name == "tombstone-ttl"){
+            options.tombstone_ttl = std::chrono::seconds(std::stoll(value));
+        }else if(name == "max-tombstones"){
+            options.max_tombstones = std::stoull(value);
+        }else if(name == "fast-start"){
+            options.fast_start = true;
+        }else if(name == "max-watchers"){
+            options.tracking.max_clients = std::stoull(value);
+        }else if(name == "max-tracked-keys"){
+            options.tracking.max_keys = std::max<std::size_t>(1, std::stoull(value));
+        }else if(name == "access-log"){
+            options.access_log.path = value;
+        }else if(name == "access-log-sample"){
+            options.access_log.sample_rate = std::stod(value);
+        }else{
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    if(positional.size() < 2){
+        std::cerr << "Usage: " << argv[0] << " [options] <address> <peer1> <peer2> ..." << std::endl;
+        return 1;
     }
+
+    std::string address = positional[0];
+    std::vector<std::string> peers(positional.begin() + 1, positional.end());
     try{
-        Node node(address, peers);
+        Node node(address, peers, 10000, wal_dir, options);
         node.start();
         std::cout << "Node started at " << address << std::endl;
 
         std::string input;
         std::getline(std::cin, input);
-   
+
 
         node.stop();
     }catch(const std::exception& e){
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
-        
+
     }
 
     return 0;
 
-}
\ No newline at end of file
+}
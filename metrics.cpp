@@ -0,0 +1,372 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace {
+
+std::string seriesKey(const std::string& name, const MetricsRegistry::Labels& labels) {
+    std::string key = name;
+    for (const auto& [label, value] : labels) {
+        key += '\0' + label + '=' + value;
+    }
+    return key;
+}
+
+std::string escapeLabelValue(const std::string& value) {
+    std::string out;
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out.push_back(c);
+        }
+    }
+    return out;
+}
+
+// {a="1",b="2"} with an optional extra label, empty if there are no labels at all
+std::string formatLabels(const MetricsRegistry::Labels& labels, const std::string& extra_name = "", const std::string& extra_value = "") {
+    std::string out;
+    for (const auto& [label, value] : labels) {
+        out += (out.empty() ? "" : ",") + label + "=\"" + escapeLabelValue(value) + "\"";
+    }
+    if (!extra_name.empty()) {
+        out += (out.empty() ? "" : ",") + extra_name + "=\"" + extra_value + "\"";
+    }
+    return out.empty() ? out : "{" + out + "}";
+}
+
+const char* typeName(MetricsRegistry::Type type) {
+    switch (type) {
+        case MetricsRegistry::Type::COUNTER: return "counter";
+        case MetricsRegistry::Type::GAUGE: return "gauge";
+        case MetricsRegistry::Type::HISTOGRAM: return "histogram";
+    }
+    return "untyped";
+}
+
+}
+
+MetricsRegistry& MetricsRegistry::instance() {
+    // never destroyed, threads may still record while static destructors run
+    static MetricsRegistry* registry = new MetricsRegistry();
+    return *registry;
+}
+
+MetricsRegistry::Shard& MetricsRegistry::acquireShard() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_shards_.empty()) {
+            // the mutex orders the old owner's last stores before the new owner's first loads
+            Shard* shard = free_shards_.back();
+            free_shards_.pop_back();
+            return *shard;
+        }
+    }
+    auto shard = std::make_unique<Shard>();
+    Shard& result = *shard;
+    std::lock_guard<std::mutex> lock(mutex_);
+    shards_.push_back(std::move(shard));
+    return result;
+}
+
+void MetricsRegistry::releaseShard(Shard& shard) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_shards_.push_back(&shard);
+}
+
+std::size_t MetricsRegistry::registerSeries(const std::string& name, const std::string& help, Type type, const Labels& labels, bool& created) {
+    std::string key = seriesKey(name, labels);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        created = false;
+        return it->second;
+    }
+    created = true;
+    series_.push_back(Series{name, help, type, labels, UINT32_MAX, nullptr, nullptr});
+    index_[key] = series_.size() - 1;
+    return series_.size() - 1;
+}
+
+MetricsRegistry::Counter MetricsRegistry::counter(const std::string& name, const std::string& help, const Labels& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool created;
+    Series& series = series_[registerSeries(name, help, Type::COUNTER, labels, created)];
+    if (created) {
+        if (next_counter_ >= MAX_COUNTERS) {
+            std::cerr << "Metrics counter limit reached, " << name << " will not be recorded" << std::endl;
+        } else {
+            series.slot = next_counter_++;
+        }
+    }
+    return Counter{series.slot};
+}
+
+MetricsRegistry::Histogram MetricsRegistry::histogram(const std::string& name, const std::string& help, const Labels& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool created;
+    Series& series = series_[registerSeries(name, help, Type::HISTOGRAM, labels, created)];
+    if (created) {
+        if (next_histogram_ >= MAX_HISTOGRAMS) {
+            std::cerr << "Metrics histogram limit reached, " << name << " will not be recorded" << std::endl;
+        } else {
+            series.slot = next_histogram_++;
+        }
+    }
+    return Histogram{series.slot};
+}
+
+void MetricsRegistry::gauge(const std::string& name, const std::string& help, const Labels& labels, std::function<double()> read, const void* owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool created;
+    Series& series = series_[registerSeries(name, help, Type::GAUGE, labels, created)];
+    // a later owner of the same series replaces the earlier one
+    series.read = std::move(read);
+    series.owner = owner;
+}
+
+void MetricsRegistry::counterCallback(const std::string& name, const std::string& help, const Labels& labels, std::function<double()> read, const void* owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool created;
+    Series& series = series_[registerSeries(name, help, Type::COUNTER, labels, created)];
+    series.read = std::move(read);
+    series.owner = owner;
+}
+
+void MetricsRegistry::removeCallbacks(const void* owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& series : series_) {
+        if (series.owner == owner) {
+            series.read = nullptr;
+            series.owner = nullptr;
+        }
+    }
+}
+
+std::vector<MetricsRegistry::Sample> MetricsRegistry::collect() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Sample> samples;
+    samples.reserve(series_.size());
+    for (const auto& series : series_) {
+        Sample sample;
+        sample.name = series.name;
+        sample.help = series.help;
+        sample.type = series.type;
+        sample.labels = series.labels;
+
+        if (series.read) {
+            sample.value = series.read();
+        } else if (series.type == Type::COUNTER && series.slot < MAX_COUNTERS) {
+            uint64_t total = 0;
+            for (const auto& shard : shards_) {
+                total += shard->counters[series.slot].load(std::memory_order_relaxed);
+            }
+            sample.value = static_cast<double>(total);
+        } else if (series.type == Type::HISTOGRAM && series.slot < MAX_HISTOGRAMS) {
+            for (const auto& shard : shards_) {
+                const HistogramCells& cells = shard->histograms[series.slot];
+                for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+                    sample.buckets[i] += cells.buckets[i].load(std::memory_order_relaxed);
+                }
+                sample.count += cells.count.load(std::memory_order_relaxed);
+                sample.sum += cells.sum.load(std::memory_order_relaxed);
+            }
+        } else {
+            // a callback whose owner went away, or a series past the slot limit
+            continue;
+        }
+        samples.push_back(std::move(sample));
+    }
+    return samples;
+}
+
+double MetricsRegistry::Sample::percentile(double percentile) const {
+    // buckets and count are loaded separately, so trust the buckets
+    uint64_t total = 0;
+    for (uint64_t bucket : buckets) {
+        total += bucket;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    double target = percentile / 100.0 * total;
+    double seen = 0;
+    for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        if (buckets[i] == 0 || seen + buckets[i] < target) {
+            seen += buckets[i];
+            continue;
+        }
+        double lower = i == 0 ? 0 : static_cast<double>(uint64_t{1} << (i - 1));
+        if (i == HISTOGRAM_BUCKETS - 1) {
+            // open-ended, the lower bound is all we know
+            return lower;
+        }
+        double upper = static_cast<double>(uint64_t{1} << i);
+        return lower + (upper - lower) * (target - seen) / buckets[i];
+    }
+    return static_cast<double>(uint64_t{1} << (HISTOGRAM_BUCKETS - 2));
+}
+
+std::string MetricsRegistry::prometheusText() {
+    std::vector<Sample> samples = collect();
+    // the format wants every series of a family together, families stay in registration order
+    std::map<std::string, std::size_t> family_order;
+    for (const auto& sample : samples) {
+        family_order.emplace(sample.name, family_order.size());
+    }
+    std::stable_sort(samples.begin(), samples.end(), [&family_order](const Sample& a, const Sample& b) {
+        return family_order[a.name] < family_order[b.name];
+    });
+
+    std::ostringstream out;
+    // counters past a million should still print as integers
+    out.precision(15);
+    std::string last_name;
+    for (const auto& sample : samples) {
+        if (sample.name != last_name) {
+            out << "# HELP " << sample.name << " " << sample.help << "\n";
+            out << "# TYPE " << sample.name << " " << typeName(sample.type) << "\n";
+            last_name = sample.name;
+        }
+        if (sample.type != Type::HISTOGRAM) {
+            out << sample.name << formatLabels(sample.labels) << " " << sample.value << "\n";
+            continue;
+        }
+        uint64_t cumulative = 0;
+        for (std::size_t i = 0; i + 1 < HISTOGRAM_BUCKETS; ++i) {
+            cumulative += sample.buckets[i];
+            out << sample.name << "_bucket" << formatLabels(sample.labels, "le", std::to_string(uint64_t{1} << i))
+                << " " << cumulative << "\n";
+        }
+        cumulative += sample.buckets[HISTOGRAM_BUCKETS - 1];
+        out << sample.name << "_bucket" << formatLabels(sample.labels, "le", "+Inf") << " " << cumulative << "\n";
+        out << sample.name << "_sum" << formatLabels(sample.labels) << " " << sample.sum << "\n";
+        out << sample.name << "_count" << formatLabels(sample.labels) << " " << cumulative << "\n";
+    }
+    return out.str();
+}
+
+MetricsHttpServer::MetricsHttpServer(int port): port_(port) {}
+
+MetricsHttpServer::~MetricsHttpServer() {
+    stop();
+}
+
+void MetricsHttpServer::start() {
+    listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+        throw std::runtime_error(std::string("Failed to create metrics socket: ") + std::strerror(errno));
+    }
+    int reuse = 1;
+    ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(static_cast<uint16_t>(port_));
+    if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listen_fd_, 16) != 0) {
+        int error = errno;
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+        throw std::runtime_error("Failed to listen for metrics on port " + std::to_string(port_) + ": " + std::strerror(error));
+    }
+
+    running_ = true;
+    thread_ = std::thread(&MetricsHttpServer::serveLoop, this);
+    std::cout << "Metrics available at http://0.0.0.0:" << port_ << "/metrics" << std::endl;
+}
+
+void MetricsHttpServer::stop() {
+    running_ = false;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    if (listen_fd_ >= 0) {
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+    }
+}
+
+void MetricsHttpServer::serveLoop() {
+    while (running_) {
+        // wake up regularly to notice stop()
+        pollfd pfd{listen_fd_, POLLIN, 0};
+        if (::poll(&pfd, 1, 200) <= 0) {
+            continue;
+        }
+        int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        handleConnection(fd);
+        ::close(fd);
+    }
+}
+
+void MetricsHttpServer::addHandler(const std::string& path, const std::string& content_type, std::function<std::string()> render) {
+    handlers_[path] = Handler{content_type, std::move(render)};
+}
+
+void MetricsHttpServer::handleConnection(int fd) {
+    // a scraper that stalls must not wedge the loop
+    timeval timeout{1, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        ssize_t received = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            return;
+        }
+        request.append(buffer, received);
+    }
+
+    // "GET /path?query HTTP/1.1"
+    std::string path;
+    if (request.rfind("GET ", 0) == 0) {
+        path = request.substr(4, request.find_first_of(" ?\r", 4) - 4);
+    }
+
+    std::string status = "200 OK";
+    std::string content_type = "text/plain; version=0.0.4";
+    std::string body;
+    auto handler = handlers_.find(path);
+    if (path == "/metrics") {
+        body = MetricsRegistry::instance().prometheusText();
+    } else if (handler != handlers_.end()) {
+        content_type = handler->second.content_type;
+        body = handler->second.render();
+    } else {
+        status = "404 Not Found";
+        content_type = "text/plain";
+        body = "try /metrics\n";
+    }
+
+    std::string response = "HTTP/1.1 " + status + "\r\n"
+        "Content-Type: " + content_type + "\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body;
+    std::size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t written = ::send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (written <= 0) {
+            return;
+        }
+        sent += written;
+    }
+}
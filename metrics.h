@@ -0,0 +1,209 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// process-wide metrics. Every thread records into its own shard of plain cells, so the hot path is a
+// thread_local lookup and an uncontended relaxed store; shards are only summed when someone collects.
+// registration takes a lock and belongs in constructors, recording is lock-free
+class MetricsRegistry {
+public:
+    using Labels = std::vector<std::pair<std::string, std::string>>;
+
+    static constexpr std::size_t MAX_COUNTERS = 1024;
+    static constexpr std::size_t MAX_HISTOGRAMS = 128;
+    // bucket i holds values in (2^(i-1), 2^i], the last one everything larger
+    static constexpr std::size_t HISTOGRAM_BUCKETS = 28;
+
+    enum class Type {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM
+    };
+
+    // handles returned by registration, cheap to copy; a default-constructed handle records nothing
+    struct Counter {
+        uint32_t slot = UINT32_MAX;
+    };
+    struct Histogram {
+        uint32_t slot = UINT32_MAX;
+    };
+
+    // one labelled series as of collect()
+    struct Sample {
+        std::string name;
+        std::string help;
+        Type type;
+        Labels labels;
+        // counters and gauges
+        double value = 0;
+        // histograms, buckets are not cumulative
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        std::array<uint64_t, HISTOGRAM_BUCKETS> buckets{};
+
+        // estimated by interpolating inside the bucket holding the percentile
+        double percentile(double percentile) const;
+    };
+
+private:
+    struct HistogramCells {
+        std::array<std::atomic<uint64_t>, HISTOGRAM_BUCKETS> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+    };
+
+    // written only by the thread that owns it, read by collect()
+    struct Shard {
+        std::array<std::atomic<uint64_t>, MAX_COUNTERS> counters{};
+        std::array<HistogramCells, MAX_HISTOGRAMS> histograms{};
+    };
+
+    struct Series {
+        std::string name;
+        std::string help;
+        Type type;
+        Labels labels;
+        uint32_t slot;
+        // set for series read from a callback at collection time
+        std::function<double()> read;
+        const void* owner = nullptr;
+    };
+
+    std::mutex mutex_;
+    std::vector<Series> series_;
+    // name + labels to position in series_, keeps registration idempotent
+    std::map<std::string, std::size_t> index_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    // shards of threads that exited, handed to the next new thread with their totals intact so short-lived
+    // threads (one per replica write) don't grow shards_ without bound
+    std::vector<Shard*> free_shards_;
+    uint32_t next_counter_ = 0;
+    uint32_t next_histogram_ = 0;
+
+    MetricsRegistry() = default;
+    // a free shard, or a newly allocated and registered one; shards live as long as the registry
+    Shard& acquireShard();
+    void releaseShard(Shard& shard);
+
+    // gives the thread's shard back when the thread exits
+    struct ShardLease {
+        Shard* shard = nullptr;
+        ~ShardLease() {
+            if (shard != nullptr) {
+                instance().releaseShard(*shard);
+            }
+        }
+    };
+
+    Shard& localShard() {
+        thread_local ShardLease lease;
+        if (lease.shard == nullptr) {
+            lease.shard = &acquireShard();
+        }
+        return *lease.shard;
+    }
+    std::size_t registerSeries(const std::string& name, const std::string& help, Type type, const Labels& labels, bool& created);
+
+    // single writer per cell, so a plain load and store is enough and avoids a locked instruction
+    static void bump(std::atomic<uint64_t>& cell, uint64_t amount) {
+        cell.store(cell.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+public:
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    static MetricsRegistry& instance();
+
+    Counter counter(const std::string& name, const std::string& help, const Labels& labels = {});
+    Histogram histogram(const std::string& name, const std::string& help, const Labels& labels = {});
+    // series whose value another component already keeps, read on every collect().
+    // the owner must call removeCallbacks before the callback's captures go away
+    void gauge(const std::string& name, const std::string& help, const Labels& labels, std::function<double()> read, const void* owner);
+    void counterCallback(const std::string& name, const std::string& help, const Labels& labels, std::function<double()> read, const void* owner);
+    void removeCallbacks(const void* owner);
+
+    void add(Counter counter, uint64_t amount = 1) {
+        if (counter.slot < MAX_COUNTERS) {
+            bump(localShard().counters[counter.slot], amount);
+        }
+    }
+
+    void observe(Histogram histogram, uint64_t value) {
+        if (histogram.slot >= MAX_HISTOGRAMS) {
+            return;
+        }
+        HistogramCells& cells = localShard().histograms[histogram.slot];
+        std::size_t bucket = value <= 1 ? 0 : 64 - __builtin_clzll(value - 1);
+        bump(cells.buckets[bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1], 1);
+        bump(cells.count, 1);
+        bump(cells.sum, value);
+    }
+
+    // every series with its shards summed up, in registration order
+    std::vector<Sample> collect();
+    // Prometheus text exposition format 0.0.4
+    std::string prometheusText();
+};
+
+// records the microseconds between construction and destruction into a histogram
+class ScopedLatency {
+private:
+    MetricsRegistry::Histogram histogram_;
+    std::chrono::steady_clock::time_point start_;
+
+public:
+    explicit ScopedLatency(MetricsRegistry::Histogram histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedLatency() {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        MetricsRegistry::instance().observe(histogram_, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    }
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+};
+
+// minimal HTTP listener answering GET /metrics with MetricsRegistry::prometheusText(), plus any
+// extra pages registered before start()
+class MetricsHttpServer {
+private:
+    struct Handler {
+        std::string content_type;
+        std::function<std::string()> render;
+    };
+
+    int port_;
+    std::map<std::string, Handler> handlers_;
+    int listen_fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+
+    void serveLoop();
+    void handleConnection(int fd);
+
+public:
+    explicit MetricsHttpServer(int port);
+    ~MetricsHttpServer();
+
+    // serves GET path with whatever render returns, must be called before start()
+    void addHandler(const std::string& path, const std::string& content_type, std::function<std::string()> render);
+
+    // throws if the port can't be bound
+    void start();
+    void stop();
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// bounded multi-producer / single-consumer ring of preallocated slots.
+// each slot carries a sequence number that tells producers and the consumer whose turn it is,
+// so neither side ever takes a lock
+template <typename T>
+class MPSCRing {
+private:
+    struct Slot {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::size_t capacity_;
+    std::size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+
+    // keep the producer and consumer cursors on separate cache lines
+    alignas(64) std::atomic<std::size_t> enqueue_pos_{0};
+    alignas(64) std::atomic<std::size_t> dequeue_pos_{0};
+
+    static std::size_t roundUpToPowerOfTwo(std::size_t n) {
+        std::size_t power = 1;
+        while (power < n) {
+            power <<= 1;
+        }
+        return power;
+    }
+
+public:
+    explicit MPSCRing(std::size_t capacity)
+        : capacity_(roundUpToPowerOfTwo(capacity < 2 ? 2 : capacity))
+        , mask_(capacity_ - 1)
+        , slots_(std::make_unique<Slot[]>(capacity_)) {
+        for (std::size_t i = 0; i < capacity_; ++i) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPSCRing(const MPSCRing&) = delete;
+    MPSCRing& operator=(const MPSCRing&) = delete;
+
+    // any thread, false if the ring is full
+    bool tryPush(T&& value) {
+        std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots_[pos & mask_];
+            std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                // the slot is free for this lap, claim it
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // the consumer hasn't released this slot yet
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value = std::move(value);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer thread only, false if the ring is empty
+    bool tryPop(T& value) {
+        std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        Slot* slot = &slots_[pos & mask_];
+        std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence != pos + 1) {
+            return false;
+        }
+        value = std::move(slot->value);
+        // hand the slot back to producers for the next lap
+        slot->sequence.store(pos + capacity_, std::memory_order_release);
+        dequeue_pos_.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer thread only, moves up to max_items into out and returns how many
+    std::size_t drain(std::vector<T>& out, std::size_t max_items) {
+        std::size_t count = 0;
+        T value;
+        while (count < max_items && tryPop(value)) {
+            out.push_back(std::move(value));
+            ++count;
+        }
+        return count;
+    }
+
+    // approximate while producers are running
+    std::size_t size() const {
+        std::size_t enqueued = enqueue_pos_.load(std::memory_order_acquire);
+        std::size_t dequeued = dequeue_pos_.load(std::memory_order_acquire);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    std::size_t capacity() const { return capacity_; }
+};
+
+#endif
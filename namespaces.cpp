@@ -0,0 +1,99 @@
+#include "namespaces.h"
+#include <stdexcept>
+
+namespace {
+
+std::size_t parseSize(const std::string& text) {
+    std::size_t end = 0;
+    std::size_t value = std::stoull(text, &end);
+    std::string suffix = text.substr(end);
+    if (suffix == "K" || suffix == "k") {
+        return value << 10;
+    }
+    if (suffix == "M" || suffix == "m") {
+        return value << 20;
+    }
+    if (suffix == "G" || suffix == "g") {
+        return value << 30;
+    }
+    if (!suffix.empty()) {
+        throw std::invalid_argument("bad size: " + text);
+    }
+    return value;
+}
+
+}
+
+NamespaceOptions parseNamespaceOptions(const std::string& spec) {
+    NamespaceOptions options;
+    std::size_t colon = spec.find(':');
+    options.name = spec.substr(0, colon);
+    if (options.name.empty() || options.name.find('\0') != std::string::npos) {
+        throw std::invalid_argument("bad namespace name in: " + spec);
+    }
+    if (colon == std::string::npos) {
+        return options;
+    }
+
+    std::size_t start = colon + 1;
+    while (start <= spec.size()) {
+        std::size_t comma = spec.find(',', start);
+        std::string setting = spec.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        std::size_t equals = setting.find('=');
+        if (equals == std::string::npos) {
+            throw std::invalid_argument("expected name=value in: " + spec);
+        }
+        std::string name = setting.substr(0, equals);
+        std::string value = setting.substr(equals + 1);
+        if (name == "entries") {
+            options.max_entries = parseSize(value);
+        } else if (name == "bytes") {
+            options.max_bytes = parseSize(value);
+        } else if (name == "ttl") {
+            options.default_ttl = std::stoll(value);
+        } else if (name == "policy" && value == "lru") {
+            options.policy = EvictionPolicy::LRU;
+        } else if (name == "policy" && value == "fifo") {
+            options.policy = EvictionPolicy::FIFO;
+        } else {
+            throw std::invalid_argument("unknown namespace setting: " + setting);
+        }
+        if (comma == std::string::npos) {
+            break;
+        }
+        start = comma + 1;
+    }
+    return options;
+}
+
+std::string namespacedKey(const std::string& ns, const std::string& key) {
+    if (ns.empty()) {
+        return key;
+    }
+    std::string stored;
+    stored.reserve(ns.size() + key.size() + 2);
+    stored += '\0';
+    stored += ns;
+    stored += '\0';
+    stored += key;
+    return stored;
+}
+
+void splitNamespacedKey(const std::string& stored_key, std::string& ns, std::string& key) {
+    std::size_t end = stored_key.empty() || stored_key[0] != '\0' ? std::string::npos : stored_key.find('\0', 1);
+    if (end == std::string::npos) {
+        ns.clear();
+        key = stored_key;
+        return;
+    }
+    ns = stored_key.substr(1, end - 1);
+    key = stored_key.substr(end + 1);
+}
+
+std::string namespaceOf(std::string_view stored_key) {
+    if (stored_key.empty() || stored_key[0] != '\0') {
+        return std::string();
+    }
+    std::size_t end = stored_key.find('\0', 1);
+    return end == std::string_view::npos ? std::string() : std::string(stored_key.substr(1, end - 1));
+}
@@ -0,0 +1,40 @@
+#ifndef NAMESPACES_H
+#define NAMESPACES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// name of the default namespace on the command line and in metric labels; requests leave the field empty
+inline const std::string DEFAULT_NAMESPACE = "default";
+
+enum class EvictionPolicy {
+    LRU,
+    // evict in insertion order, reads don't keep an entry alive
+    FIFO
+};
+
+// limits and defaults of one tenant's share of the cache, 0 means no limit of its own
+struct NamespaceOptions {
+    std::string name;
+    std::size_t max_entries = 0;
+    // counted as key plus value bytes
+    std::size_t max_bytes = 0;
+    EvictionPolicy policy = EvictionPolicy::LRU;
+    // seconds, used for writes that don't set a ttl
+    int64_t default_ttl = 0;
+};
+
+// "NAME" or "NAME:entries=N,bytes=N[K|M|G],policy=lru|fifo,ttl=SECONDS", throws std::invalid_argument
+NamespaceOptions parseNamespaceOptions(const std::string& spec);
+
+// the key the cache, ring, WAL replay and replicas see. Keys of the default namespace are stored as they
+// are, any other as "\0<namespace>\0<key>", so default keys must not start with a NUL byte
+std::string namespacedKey(const std::string& ns, const std::string& key);
+// splits a stored key back into namespace (empty for the default one) and key
+void splitNamespacedKey(const std::string& stored_key, std::string& ns, std::string& key);
+// the namespace part alone, cheaper than a split
+std::string namespaceOf(std::string_view stored_key);
+
+#endif
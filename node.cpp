@@ -1,31 +1,165 @@
 #include "node.h"
+#include <charconv>
+#include <limits>
 #include <future>
 
+namespace {
+
+// recovered entries stored per lock acquisition while the node serves, small enough not to stall requests
+constexpr std::size_t WARM_BATCH_SIZE = 1024;
+
+// a cache call as a trace phase, with the time this thread spent waiting for the cache lock as a span of its own
+class CachePhase {
+private:
+    using Cache = LRUCache<std::string, std::string>;
+    RequestTrace* trace_;
+    RequestTrace::Phase phase_;
+    std::chrono::steady_clock::time_point start_;
+    uint64_t wait_before_;
+
+public:
+    CachePhase(RequestTrace* trace, const char* name)
+        : trace_(trace)
+        , phase_(trace, name)
+        , start_(std::chrono::steady_clock::now())
+        , wait_before_(Cache::threadLockWaitNanos()) {}
+    CachePhase(const CachePhase&) = delete;
+    CachePhase& operator=(const CachePhase&) = delete;
+    ~CachePhase() {
+        uint64_t waited = Cache::threadLockWaitNanos() - wait_before_;
+        if (trace_ && waited > 0) {
+            // the lock is taken first thing, so the wait starts with the call
+            trace_->addSpan("cache_lock_wait", start_, start_ + std::chrono::nanoseconds(waited));
+        }
+    }
+};
+
+// whole seconds left until expiry, rounded up so logging and replicating an entry never shortens it
+int64_t ttlSeconds(std::chrono::steady_clock::time_point expiry) {
+    auto remaining = expiry - std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::seconds>(remaining).count() + 1;
+}
+
+std::chrono::steady_clock::time_point expiryIn(int64_t ttl_seconds) {
+    return std::chrono::steady_clock::now() + std::chrono::seconds(ttl_seconds);
+}
+
+}
+
 
 Node::Node(
     const std::string& address,
     const std::vector<std::string>& peers,
     std::size_t cache_capacity,
-    const std::string& wal_path 
+    const std::string& wal_path,
+    const NodeOptions& options
     ):
     address_(address), 
     peers_(peers),
     cache_capacity_(cache_capacity),
-    lru_cache_(std::make_unique<LRUCache<std::string, std::string>>(cache_capacity)),
+    slab_(options.slab.max_bytes > 0 ? std::make_unique<SlabAllocator>(options.slab) : nullptr),
+    lru_cache_(std::make_unique<LRUCache<std::string, std::string>>(
+        cache_capacity, slab_ ? slab_.get() : std::pmr::get_default_resource())),
     consistent_hash_(52),
-    write_queue_(std::make_unique<WriteQueue>(wal_path, address)),
-    recovery_manager_(std::make_unique<RecoveryManager>(wal_path)){
+    write_queue_(std::make_unique<WriteQueue>(wal_path, address, options.write_queue, options.wal)),
+    recovery_manager_(std::make_unique<RecoveryManager>(wal_path)),
+    replication_timeout_(options.replication_timeout),
+    metrics_port_(options.metrics_port),
+    tracer_(address, options.tracing),
+    hot_keys_(options.hot_keys),
+    tracker_(options.tracking),
+    max_watchers_(options.tracking.max_clients),
+    access_log_(options.access_log, address){
         
         std::cout << "Starting Node initialization..." << std::endl;
+        lru_cache_->setTombstones(options.tombstone_ttl, options.max_tombstones);
         
         std::cout << "Adding nodes to hash ring..." << std::endl;
         consistent_hash_.addNode(address);
         for(const auto& peer: peers) {
             consistent_hash_.addNode(peer);
+            peer_warming_[peer] = false;
+        }
+
+        version_tag_ = std::hash<std::string>{}(address_) & 0xff;
+        setupNamespaces(options.namespaces);
+        if (!options.ssd_tier.path.empty()) {
+            ssd_tier_ = std::make_unique<SsdTier>(options.ssd_tier);
+            // running before recovery, so what recovery evicts lands in the tier
+            ssd_tier_->start();
+        }
+        if (options.failure_detector.heartbeat_interval.count() > 0 && !peers_.empty()) {
+            failure_detector_ = std::make_unique<FailureDetector>(
+                peers_,
+                options.failure_detector,
+                [this](const std::string& peer, std::chrono::milliseconds deadline) {
+                    auto stub = distributed_cache::DistributedCache::NewStub(getOrCreateChannel(peer));
+                    grpc::ClientContext context;
+                    context.set_deadline(std::chrono::system_clock::now() + deadline);
+                    distributed_cache::PingRequest request;
+                    request.set_from(address_);
+                    distributed_cache::PingResponse response;
+                    if (!stub->Ping(&context, request, &response).ok()) {
+                        return false;
+                    }
+                    peer_warming_.at(peer) = response.warming();
+                    return true;
+                });
+            hint_log_ = std::make_unique<HintLog>(
+                options.hints,
+                [this](const std::string& peer, const std::vector<Hint>& hints) { return sendHints(peer, hints); },
+                [this](const std::string& peer) { return !suspected(peer); });
+        }
+        registerMetrics();
+
+        if (options.anti_entropy_interval.count() > 0) {
+            anti_entropy_ = std::make_unique<AntiEntropy>(
+                address_,
+                consistent_hash_,
+                *lru_cache_,
+                3,
+                options.anti_entropy_interval,
+                // evicted entries remembered, as many as the cache holds
+                cache_capacity,
+                [this](const std::string& peer) { return getOrCreateChannel(peer); },
+                [this](const distributed_cache::CacheEntry& entry) { return applyRepair(entry); }
+            );
+        }
+        if (!options.cache_arena_path.empty()) {
+            // one spare slot, an insert is mirrored before the eviction it causes frees a slot
+            cache_arena_ = std::make_unique<CacheArena>(
+                options.cache_arena_path, address_, cache_capacity + 1, options.cache_arena_slot_size);
         }
+        // set before recovery so the recovered entries are tracked too
+        lru_cache_->setListener([this](CacheEvent event, std::string_view key, std::string_view value, uint64_t version,
+                                       std::chrono::steady_clock::time_point expiry) {
+            onCacheEvent(event, key, value, version, expiry);
+        });
         
-        std::cout << "Starting recovery from WAL..." << std::endl;
-        recovery_manager_->recoverFromWAL(address_, *lru_cache_);
+        bool restored = false;
+        if (cache_arena_ && cache_arena_->attached()) {
+            std::cout << "Restoring cache from arena..." << std::endl;
+            bool complete = cache_arena_->complete();
+            cache_arena_->restore(*lru_cache_);
+            // a complete arena already holds what the WAL would rebuild, skip the replay
+            restored = complete;
+            if (!complete) {
+                std::cout << "Cache arena lacks entries that didn't fit or were lost, replaying the WAL too" << std::endl;
+            }
+        }
+        if (!restored && options.fast_start) {
+            // start() replays the WAL once the server is up
+            warming_ = true;
+        } else if (!restored) {
+            std::cout << "Starting recovery from WAL..." << std::endl;
+            // on top of what an incomplete arena restored, which is as new as the log
+            recovery_manager_->recoverFromWAL(address_, [this](RecoveryManager::Items& items) {
+                std::vector<bool> applied;
+                lru_cache_->putBatchIfNewer(items, applied);
+                return true;
+            }, std::numeric_limits<std::size_t>::max());
+            arenaReplayed();
+        }
         
         std::cout << "Starting write queue..." << std::endl;
         write_queue_->start();
@@ -36,58 +170,365 @@ Node::Node(
 
 Node::~Node() {
     stop();
+    MetricsRegistry::instance().removeCallbacks(this);
+}
+void Node::warmUp() {
+    std::cout << "Replaying WAL in the background..." << std::endl;
+    try {
+        recovery_manager_->recoverFromWAL(address_, [this](RecoveryManager::Items& items) {
+            if (!is_running_) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(warm_mutex_);
+            items.erase(std::remove_if(items.begin(), items.end(), [this](const auto& item) {
+                return warm_removes_.count(std::get<0>(item)) > 0;
+            }), items.end());
+            // writes made since the node came up carry newer versions than anything in the log and win
+            std::vector<bool> applied;
+            lru_cache_->putBatchIfNewer(items, applied);
+            return true;
+        }, WARM_BATCH_SIZE);
+        if (is_running_) {
+            arenaReplayed();
+        }
+    } catch (const std::exception& e) {
+        // the node is already serving; what the replay missed is left to replicas and anti-entropy
+        std::cerr << "WAL replay failed, serving what was recovered: " << e.what() << std::endl;
+    }
+    std::lock_guard<std::mutex> lock(warm_mutex_);
+    warm_removes_.clear();
+    warming_ = false;
+    std::cout << "Node is warm" << std::endl;
+}
+
+void Node::arenaReplayed() {
+    if (cache_arena_) {
+        std::lock_guard<std::mutex> lock(lru_cache_->getMutex());
+        cache_arena_->replayed();
+    }
+}
+
+bool Node::peerWarming(const std::string& peer) const {
+    auto it = peer_warming_.find(peer);
+    return it != peer_warming_.end() && it->second;
+}
+
+bool Node::readFromReplica(const std::vector<std::string>& responsible_nodes, const distributed_cache::GetRequest& request,
+                           distributed_cache::GetResponse* response, RequestTrace* trace) {
+    distributed_cache::GetRequest local_request = request;
+    local_request.set_local_only(true);
+    for (const auto& peer : responsible_nodes) {
+        if (peer == address_ || suspected(peer) || peerWarming(peer)) {
+            continue;
+        }
+        RequestTrace::Phase phase(trace, "warming_fallback " + peer);
+        distributed_cache::GetResponse peer_response;
+        if (ForwardGetRequest(peer, &local_request, &peer_response, trace).ok() && peer_response.success()) {
+            MetricsRegistry::instance().add(warming_fallbacks_);
+            *response = std::move(peer_response);
+            return true;
+        }
+    }
+    return false;
 }
+
 void Node::cleanup() {
     // clean up the expired items
     while(is_running_){
-        {
-            
-            std::lock_guard<std::mutex> lock(lru_cache_->getMutex());
-            auto now = std::chrono::steady_clock::now();
-
-            // these should be references to avoid copying
-            auto& cache_list = lru_cache_->getCacheList();
-            auto& cache_map = lru_cache_->getCacheMap();
-            auto it = cache_list.begin();
-
-            while (it != cache_list.end()){
-                if (it->expiry <= now) {
-                    cache_map.erase(it->key);
-                    it = cache_list.erase(it);
-
-                }else{
-                    ++it;
-                }
-            }
-        }
+        lru_cache_->removeExpired();
         std::this_thread::sleep_for(std::chrono::seconds(1));
 
     }
 }
 
+uint64_t Node::nextVersion() {
+    uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t candidate = (now << 8) | version_tag_;
+    uint64_t last = last_version_.load();
+    uint64_t next;
+    do {
+        // never go backwards, even if the clock does; +256 keeps the tag byte intact
+        next = std::max(candidate, last + 256);
+    } while (!last_version_.compare_exchange_weak(last, next));
+    return next;
+}
+
+void Node::registerMetrics() {
+    auto& metrics = MetricsRegistry::instance();
+    const std::string rpc_latency = "cachemesh_rpc_latency_microseconds";
+    const std::string rpc_help = "Server-side latency of client RPCs, including forwarding and replication";
+    get_latency_ = metrics.histogram(rpc_latency, rpc_help, {{"method", "Get"}});
+    put_latency_ = metrics.histogram(rpc_latency, rpc_help, {{"method", "Put"}});
+    remove_latency_ = metrics.histogram(rpc_latency, rpc_help, {{"method", "Remove"}});
+    replication_latency_ = metrics.histogram("cachemesh_replication_latency_microseconds", "Latency of one replica write");
+
+    cache_expirations_ = metrics.counter("cachemesh_cache_expirations_total", "Entries dropped after their TTL ran out");
+    bulk_loaded_ = metrics.counter("cachemesh_bulk_loaded_total", "Entries stored by BulkLoad");
+    warming_fallbacks_ = metrics.counter("cachemesh_warming_fallback_reads_total", "Local misses a replica answered while the WAL was replaying");
+    metrics.gauge("cachemesh_tracking_clients", "Open Watch streams", {},
+                  [this]() { return static_cast<double>(tracker_.clients()); }, this);
+    metrics.gauge("cachemesh_tracked_keys", "Keys clients track for invalidation", {},
+                  [this]() { return static_cast<double>(tracker_.tracked()); }, this);
+    metrics.counterCallback("cachemesh_tracking_overflows_total", "Key ranges invalidated to keep the tracking table bounded", {},
+                            [this]() { return static_cast<double>(tracker_.overflows()); }, this);
+    if (access_log_.enabled()) {
+        metrics.counterCallback("cachemesh_access_log_dropped_total", "Sampled accesses dropped because the access log fell behind", {},
+                                [this]() { return static_cast<double>(access_log_.dropped()); }, this);
+    }
+    metrics.gauge("cachemesh_warming", "1 while the WAL replays in the background", {},
+                  [this]() { return warming_ ? 1.0 : 0.0; }, this);
+    for (auto& [name, state] : namespaces_) {
+        MetricsRegistry::Labels labels{{"namespace", name.empty() ? DEFAULT_NAMESPACE : name}};
+        state.hits = metrics.counter("cachemesh_cache_hits_total", "Gets answered from the local cache", labels);
+        state.misses = metrics.counter("cachemesh_cache_misses_total", "Gets for keys owned here but not in the local cache", labels);
+        state.evictions = metrics.counter("cachemesh_cache_evictions_total", "Entries evicted to stay within capacity or quota", labels);
+        std::size_t partition = state.partition;
+        metrics.gauge("cachemesh_namespace_entries", "Entries held by a namespace", labels,
+                      [this, partition]() { return static_cast<double>(lru_cache_->partitionEntries(partition)); }, this);
+        metrics.gauge("cachemesh_namespace_bytes", "Key and value bytes held by a namespace", labels,
+                      [this, partition]() { return static_cast<double>(lru_cache_->partitionBytes(partition)); }, this);
+    }
+
+    for (const auto& peer : peers_) {
+        PeerMetrics& peer_metrics = peer_metrics_[peer];
+        const std::string forwards = "cachemesh_forwarded_requests_total";
+        const std::string forwards_help = "Client requests forwarded to the owning node";
+        peer_metrics.forwarded_gets = metrics.counter(forwards, forwards_help, {{"peer", peer}, {"method", "Get"}});
+        peer_metrics.forwarded_puts = metrics.counter(forwards, forwards_help, {{"peer", peer}, {"method", "Put"}});
+        peer_metrics.forwarded_removes = metrics.counter(forwards, forwards_help, {{"peer", peer}, {"method", "Remove"}});
+        peer_metrics.replicated = metrics.counter("cachemesh_replication_success_total", "Replica writes acknowledged by the peer", {{"peer", peer}});
+        peer_metrics.replication_failures = metrics.counter("cachemesh_replication_failure_total", "Replica writes that failed", {{"peer", peer}});
+    }
+
+    if (ssd_tier_) {
+        metrics.counterCallback("cachemesh_ssd_tier_hits_total", "Memory misses served from the SSD tier", {},
+                                [this]() { return static_cast<double>(ssd_tier_->hits()); }, this);
+        metrics.counterCallback("cachemesh_ssd_tier_misses_total", "Memory misses the SSD tier could not serve either", {},
+                                [this]() { return static_cast<double>(ssd_tier_->misses()); }, this);
+        metrics.counterCallback("cachemesh_ssd_tier_collected_segments_total", "SSD tier segments compacted by GC", {},
+                                [this]() { return static_cast<double>(ssd_tier_->collectedSegments()); }, this);
+        metrics.gauge("cachemesh_ssd_tier_entries", "Entries held by the SSD tier", {},
+                      [this]() { return static_cast<double>(ssd_tier_->entries()); }, this);
+        metrics.gauge("cachemesh_ssd_tier_bytes", "Bytes of SSD tier segments on disk", {},
+                      [this]() { return static_cast<double>(ssd_tier_->bytes()); }, this);
+    }
+    if (failure_detector_) {
+        for (const auto& peer : peers_) {
+            metrics.gauge("cachemesh_peer_phi", "Failure detector suspicion of a peer, above the threshold it gets hints only", {{"peer", peer}},
+                          [this, peer]() { return failure_detector_->phi(peer); }, this);
+        }
+        metrics.gauge("cachemesh_hints", "Replica writes waiting in the hint log", {},
+                      [this]() { return static_cast<double>(hint_log_->size()); }, this);
+        metrics.counterCallback("cachemesh_hints_dropped_total", "Hints dropped because the hint log was full", {},
+                                [this]() { return static_cast<double>(hint_log_->dropped()); }, this);
+        metrics.counterCallback("cachemesh_hints_replayed_total", "Hints delivered to a recovered peer", {},
+                                [this]() { return static_cast<double>(hint_log_->replayed()); }, this);
+    }
+    if (slab_) {
+        metrics.gauge("cachemesh_slab_page_bytes", "Slab pages carved for cache entries", {},
+                      [this]() { return static_cast<double>(slab_->stats().page_bytes); }, this);
+        metrics.gauge("cachemesh_slab_requested_bytes", "Bytes the cache entries asked the slab allocator for", {},
+                      [this]() { return static_cast<double>(slab_->stats().requested_bytes); }, this);
+        metrics.gauge("cachemesh_slab_fragmentation_ratio", "Share of slab page bytes not holding requested bytes", {},
+                      [this]() { return slab_->stats().fragmentation(); }, this);
+        metrics.gauge("cachemesh_slab_heap_bytes", "Cache entry bytes that did not fit the slab pages", {},
+                      [this]() { return static_cast<double>(slab_->stats().heap_bytes); }, this);
+        metrics.counterCallback("cachemesh_slab_page_moves_total", "Slab pages reassigned to another size class", {},
+                                [this]() { return static_cast<double>(slab_->stats().page_moves); }, this);
+    }
+    metrics.gauge("cachemesh_cache_entries", "Entries in the local cache", {},
+                  [this]() { return static_cast<double>(lru_cache_->size()); }, this);
+    metrics.gauge("cachemesh_cache_tombstones", "Removed keys remembered to refuse older writes", {},
+                  [this]() { return static_cast<double>(lru_cache_->tombstones()); }, this);
+    metrics.counterCallback("cachemesh_cache_lock_contentions_total", "Cache lock acquisitions that had to wait", {},
+                            [this]() { return static_cast<double>(lru_cache_->lockContentions()); }, this);
+    metrics.counterCallback("cachemesh_cache_lock_wait_seconds_total", "Time spent waiting for the cache lock", {},
+                            [this]() { return lru_cache_->lockWaitNanos() / 1e9; }, this);
+}
+
+void Node::setupNamespaces(const std::vector<NamespaceOptions>& namespaces) {
+    NamespaceOptions default_options;
+    default_options.name = DEFAULT_NAMESPACE;
+    namespaces_[""] = NamespaceState{default_options, 0, {}, {}, {}};
+    for (const auto& options : namespaces) {
+        if (options.name == DEFAULT_NAMESPACE) {
+            namespaces_[""].options = options;
+        } else {
+            namespaces_[options.name] = NamespaceState{options, 0, {}, {}, {}};
+        }
+    }
+
+    std::vector<LRUCache<std::string, std::string>::PartitionLimits> limits;
+    std::unordered_map<std::string, std::size_t> partitions;
+    auto add = [&](const std::string& name, NamespaceState& state) {
+        state.partition = limits.size();
+        partitions[name] = state.partition;
+        limits.push_back({state.options.max_entries, state.options.max_bytes, state.options.policy == EvictionPolicy::LRU});
+    };
+    // the default namespace first, it gets partition 0 and with it any key of an unknown namespace
+    add("", namespaces_[""]);
+    for (auto& [name, state] : namespaces_) {
+        if (!name.empty()) {
+            add(name, state);
+        }
+    }
+    lru_cache_->setPartitions(
+        limits,
+        [partitions](const std::string& key) {
+            auto it = partitions.find(namespaceOf(key));
+            return it == partitions.end() ? 0 : it->second;
+        },
+        [](const std::string& key, const std::string& value) { return key.size() + value.size(); });
+}
+
+grpc::Status Node::resolveKey(const std::string& ns, const std::string& key, std::string& stored_key, const NamespaceState*& state) const {
+    // the default namespace is stored under "", naming it explicitly selects it as well
+    std::string name = ns == DEFAULT_NAMESPACE ? std::string() : ns;
+    auto it = namespaces_.find(name);
+    if (it == namespaces_.end()) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Unknown namespace: " + ns);
+    }
+    if (name.empty() && !key.empty() && key[0] == '\0') {
+        // would be mistaken for a namespaced key
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Keys must not start with a NUL byte");
+    }
+    stored_key = namespacedKey(name, key);
+    state = &it->second;
+    return grpc::Status::OK;
+}
+
+const Node::PeerMetrics* Node::peerMetrics(const std::string& peer) const {
+    auto it = peer_metrics_.find(peer);
+    return it == peer_metrics_.end() ? nullptr : &it->second;
+}
+
+void Node::recordReplication(const std::string& peer, bool ok) {
+    if (const PeerMetrics* peer_metrics = peerMetrics(peer)) {
+        MetricsRegistry::instance().add(ok ? peer_metrics->replicated : peer_metrics->replication_failures);
+    }
+}
+
+void Node::onCacheEvent(CacheEvent event, std::string_view key, std::string_view value, uint64_t version,
+                        std::chrono::steady_clock::time_point expiry) {
+    if (event == CacheEvent::EVICTED) {
+        auto it = namespaces_.find(namespaceOf(key));
+        if (it != namespaces_.end()) {
+            MetricsRegistry::instance().add(it->second.evictions);
+        }
+    } else if (event == CacheEvent::EXPIRED) {
+        MetricsRegistry::instance().add(cache_expirations_);
+    }
+    if (anti_entropy_) {
+        anti_entropy_->onCacheEvent(event, key, version, expiry);
+    }
+    if (cache_arena_) {
+        cache_arena_->onCacheEvent(event, key, value, version, expiry);
+    }
+    if (ssd_tier_) {
+        ssd_tier_->onCacheEvent(event, key, value, version, expiry);
+    }
+    // an evicted entry hasn't changed, clients may keep their copy
+    if (event != CacheEvent::EVICTED && event != CacheEvent::TOMBSTONE_DROPPED) {
+        tracker_.invalidate(key);
+    }
+}
+
+bool Node::promoteFromTier(const std::string& key, std::string& value, uint64_t& version) {
+    int64_t ttl;
+    if (!ssd_tier_ || !ssd_tier_->take(key, value, version, ttl)) {
+        return false;
+    }
+    // the WAL still has the entry, so promotion needs no log record. A write that raced it wins
+    if (!lru_cache_->putIfNewer(key, value, ttl, version)) {
+        return lru_cache_->get(key, value, version);
+    }
+    return true;
+}
+
+bool Node::applyRepair(const distributed_cache::CacheEntry& entry) {
+    if (entry.removed()) {
+        if (!write_queue_->logRemove(entry.key(), entry.version())) {
+            return false;
+        }
+        bool removed = lru_cache_->remove(entry.key(), entry.version());
+        if (ssd_tier_) {
+            ssd_tier_->drop(entry.key(), entry.version());
+        }
+        return removed;
+    }
+    if (!write_queue_->logPut(entry.key(), entry.value(), entry.ttl(), entry.version())) {
+        return false;
+    }
+    return lru_cache_->putIfNewer(entry.key(), entry.value(), entry.ttl(), entry.version());
+}
+
 void Node::start(){
     is_running_ = true;
     grpc::ServerBuilder builder;
     grpc::ResourceQuota quota;
 
-    quota.SetMaxThreads(12);
+    quota.SetMaxThreads(12 + static_cast<int>(max_watchers_));
     builder.SetResourceQuota(quota);
     builder.AddListeningPort(address_, grpc::InsecureServerCredentials());
     builder.RegisterService(this);
     server_ = builder.BuildAndStart();
     std::cout << "Cache node started at " << address_ << std::endl;
 
+    access_log_.start();
+
     // pointer to member function
     cleanup_thread_ = std::thread(&Node::cleanup, this);
+    if (warming_) {
+        recovery_thread_ = std::thread(&Node::warmUp, this);
+    }
+
+    if (anti_entropy_) {
+        anti_entropy_->start();
+    }
+    if (failure_detector_) {
+        failure_detector_->start();
+        hint_log_->start();
+    }
+
+    if (metrics_port_ > 0) {
+        metrics_server_ = std::make_unique<MetricsHttpServer>(metrics_port_);
+        metrics_server_->addHandler("/debug/slowlog", "application/json",
+                                    [this]() { return Tracer::chromeTraceJson(tracer_.slowLog()); });
+        metrics_server_->addHandler("/debug/traces", "application/json",
+                                    [this]() { return Tracer::chromeTraceJson(tracer_.sampledTraces()); });
+        if (slab_) {
+            metrics_server_->addHandler("/debug/slabs", "text/plain", [this]() { return slab_->report(); });
+        }
+        metrics_server_->start();
+    }
     
 
 }
 
 void Node::stop(){
     is_running_ = false;
+    if (recovery_thread_.joinable()) {
+        // the replay stops at its next batch
+        recovery_thread_.join();
+    }
+    if (metrics_server_) {
+        metrics_server_->stop();
+    }
+    if (anti_entropy_) {
+        anti_entropy_->stop();
+    }
+    if (hint_log_) {
+        hint_log_->stop();
+        failure_detector_->stop();
+    }
+    access_log_.stop();
     if (write_queue_) {
         write_queue_->stop();
     }
+    if (ssd_tier_) {
+        ssd_tier_->stop();
+    }
     // if server is running
     if(server_){
         server_->Shutdown();
@@ -104,24 +545,61 @@ void Node::stop(){
 
 // get the 
 grpc::Status Node::Get(grpc::ServerContext* context, const distributed_cache::GetRequest* request, distributed_cache::GetResponse* response) {
-    std::string key = request->key();
+    ScopedLatency latency(get_latency_);
+    ActiveTrace trace(tracer_, context, "Get", request->key());
+    std::string key;
+    const NamespaceState* ns = nullptr;
+    grpc::Status resolved = resolveKey(request->namespace_(), request->key(), key, ns);
+    if (!resolved.ok()) {
+        return resolved;
+    }
+    hot_keys_.recordRead(key);
     std::string value;
 
-    auto responsible_nodes = consistent_hash_.getNodes(request->key(), 3);
+    std::vector<std::string> responsible_nodes;
+    {
+        RequestTrace::Phase phase(trace.get(), "hash_ring");
+        responsible_nodes = consistent_hash_.getNodes(key, 3);
+    }
     bool is_responsible = std::find(responsible_nodes.begin(), responsible_nodes.end(), address_) != responsible_nodes.end();
 
     if (is_responsible) {
-        bool found = lru_cache_->get(key, value);
-        // forward to any of the responsible nodes
+        bool found;
+        uint64_t version = 0;
+        {
+            CachePhase phase(trace.get(), "cache_get");
+            found = lru_cache_->get(key, value, version);
+        }
+        if (!found && ssd_tier_) {
+            RequestTrace::Phase phase(trace.get(), "ssd_tier");
+            found = promoteFromTier(key, value, version);
+        }
+        MetricsRegistry::instance().add(found ? ns->hits : ns->misses);
+        access_log_.record(AccessOp::GET, key, found ? value.size() : 0);
 
         if (found) {
             response->set_value(value);
+            response->set_version(version);
             response->set_success(true);
             return grpc::Status::OK;
         }
+        if (warming_ && !request->local_only() && readFromReplica(responsible_nodes, *request, response, trace.get())) {
+            return grpc::Status::OK;
+        }
     }else{
-        // forward to other nodes if value not found locally 
-        return ForwardGetRequest(responsible_nodes[0], request, response);
+        // forward to other nodes if value not found locally; a warming owner only when no other is up and warm
+        std::string owner = responsible_nodes[0];
+        for (const auto& node : responsible_nodes) {
+            if (!peerWarming(node) && !suspected(node)) {
+                owner = node;
+                break;
+            }
+        }
+        if (const PeerMetrics* peer_metrics = peerMetrics(owner)) {
+            MetricsRegistry::instance().add(peer_metrics->forwarded_gets);
+        }
+        RequestTrace::Phase phase(trace.get(), "forward " + owner);
+        return ForwardGetRequest(owner, request, response, trace.get());
     
     }
 
@@ -133,7 +611,22 @@ grpc::Status Node::Get(grpc::ServerContext* context, const distributed_cache::Ge
 
 
 grpc::Status Node::Put(grpc::ServerContext* context, const distributed_cache::PutRequest* request, distributed_cache::PutResponse* response) {
-    std::vector<std::string> responsible_nodes = consistent_hash_.getNodes(request->key(), 3);
+    ScopedLatency latency(put_latency_);
+    ActiveTrace trace(tracer_, context, "Put", request->key());
+    std::string key;
+    const NamespaceState* ns = nullptr;
+    grpc::Status resolved = resolveKey(request->namespace_(), request->key(), key, ns);
+    if (!resolved.ok()) {
+        return resolved;
+    }
+    if (!request->is_replica()) {
+        hot_keys_.recordWrite(key);
+    }
+    std::vector<std::string> responsible_nodes;
+    {
+        RequestTrace::Phase phase(trace.get(), "hash_ring");
+        responsible_nodes = consistent_hash_.getNodes(key, 3);
+    }
 
     // check if this node is one of the responsible nodes 
     auto it = std::find(responsible_nodes.begin(), responsible_nodes.end(), address_);
@@ -155,139 +648,826 @@ grpc::Status Node::Put(grpc::ServerContext* context, const distributed_cache::Pu
             return grpc::Status(grpc::StatusCode::INTERNAL, "No responsible nodes");
         }
         // forward to any of the responsible nodes
-        return ForwardPutRequest(responsible_nodes[0], request, response);
+        if (const PeerMetrics* peer_metrics = peerMetrics(responsible_nodes[0])) {
+            MetricsRegistry::instance().add(peer_metrics->forwarded_puts);
+        }
+        RequestTrace::Phase phase(trace.get(), "forward " + responsible_nodes[0]);
+        return ForwardPutRequest(responsible_nodes[0], request, response, trace.get());
 
     }
 
-    write_queue_->logPut(request->key(), request->value(), request->ttl());
+    // held until the write is applied, so a read-modify-write on the key can't interleave with it
+    std::unique_lock<std::mutex> key_lock(keyLock(key));
+    // replicas keep the coordinator's version, everything else is a fresh write
+    bool is_replica_write = request->is_replica() && request->version() != 0;
+    uint64_t version = is_replica_write ? request->version() : nextVersion();
+    int64_t ttl = ttlFor(*ns, request->ttl());
+
+    bool logged;
+    {
+        RequestTrace::Phase phase(trace.get(), "wal_enqueue");
+        logged = write_queue_->logPut(key, request->value(), ttl, version);
+    }
+    if(!logged){
+        response->set_success(false);
+        return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Write queue is full");
+    }
 
 
   
-    lru_cache_->put(request->key(), request->value(), request->ttl());
+    {
+        CachePhase phase(trace.get(), "cache_put");
+        if(is_replica_write){
+            // a replica write that lost a race with a newer one is dropped
+            lru_cache_->putIfNewer(key, request->value(), ttl, version);
+        }else{
+            lru_cache_->put(key, request->value(), ttl, version);
+        }
+    }
+    key_lock.unlock();
 
     if(request->is_replica()){
         response->set_success(true);
         return grpc::Status::OK;
     }
+    access_log_.record(AccessOp::PUT, key, request->value().size());
 
-    std::vector<std::future<grpc::Status>> replication_futures;
+    response->set_success(replicate(responsible_nodes, key, request->value(), ttl, version, trace.get()));
+    return grpc::Status::OK;
+}
+
+bool Node::replicate(const std::vector<std::string>& responsible_nodes, const std::string& key, const std::string& value,
+                     int64_t ttl, uint64_t version, RequestTrace* trace) {
+    std::vector<std::pair<std::string, std::future<grpc::Status>>> replication_futures;
+    bool all_successful = true;
+    auto hintPut = [&](const std::string& peer) {
+        int64_t expiry_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() + ttl * 1000;
+        if (!hint(peer, Hint{key, false, value, expiry_ms, version})) {
+            all_successful = false;
+        }
+    };
 
     for(const auto& peer: responsible_nodes){
         if(peer == address_){
             continue;
         }
-        replication_futures.push_back(
+        if(suspected(peer)){
+            // no point waiting for a replica that is down, it gets the write when it is back
+            hintPut(peer);
+            continue;
+        }
+        replication_futures.emplace_back(peer,
             std::async(
                 std::launch::async,
                 &Node::ReplicateToNode,
                 this,
                 peer,
-                request->key(),
-                request->value(),
-                request->ttl()
+                key,
+                value,
+                ttl,
+                version,
+                trace
             )
         );
     }
-    bool all_successful = true;
-    // wait for all futures to complete
-    for(auto& future: replication_futures){
+    // the slowest live replica decides how long the client waits, bounded by the replication deadline
+    RequestTrace::Phase wait_phase(trace, "replication_wait");
+    for(auto& [peer, future]: replication_futures){
         grpc::Status status = future.get();
         if(!status.ok()){
-            all_successful = false;
-        
-            std::cout << "Failed to replicate to node: " << status.error_message() << std::endl;
+            std::cout << "Failed to replicate to node " << peer << ": " << status.error_message() << std::endl;
+            hintPut(peer);
         }
     }
-    response->set_success(all_successful);
-    return grpc::Status::OK;
+    return all_successful;
 }
 
 
-grpc::Status Node::ReplicateToNode(const std::string& node, const std::string& key, const std::string& value, int64_t ttl) {
+grpc::Status Node::ReplicateToNode(const std::string& node, const std::string& key, const std::string& value, int64_t ttl, uint64_t version,
+                                   RequestTrace* trace) {
+    RequestTrace::Phase phase(trace, "replicate " + node);
 
     auto channel = getOrCreateChannel(node);
     auto stub = distributed_cache::DistributedCache::NewStub(channel);
 
     distributed_cache::PutRequest put_request;
-    put_request.set_key(key);
+    std::string ns;
+    std::string plain_key;
+    splitNamespacedKey(key, ns, plain_key);
+    put_request.set_namespace_(ns);
+    put_request.set_key(plain_key);
     put_request.set_value(value);
     put_request.set_ttl(ttl);
     put_request.set_is_replica(true);
+    put_request.set_version(version);
     distributed_cache::PutResponse put_response;
 
     grpc::ClientContext context;
-    return stub->Put(&context, put_request, &put_response);
+    context.set_deadline(std::chrono::system_clock::now() + replication_timeout_);
+    Tracer::inject(context, trace);
+    grpc::Status status;
+    {
+        ScopedLatency latency(replication_latency_);
+        status = stub->Put(&context, put_request, &put_response);
+    }
+    recordReplication(node, status.ok());
+    return status;
 
 }
 
+grpc::Status Node::RemoveOnReplica(const std::string& node, const std::string& key, uint64_t version, RequestTrace* trace) {
+    RequestTrace::Phase phase(trace, "replicate " + node);
+    auto stub = distributed_cache::DistributedCache::NewStub(getOrCreateChannel(node));
+    distributed_cache::RemoveRequest request;
+    std::string ns;
+    std::string plain_key;
+    splitNamespacedKey(key, ns, plain_key);
+    request.set_namespace_(ns);
+    request.set_key(plain_key);
+    request.set_is_replica(true);
+    request.set_version(version);
+    distributed_cache::RemoveResponse response;
+
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + replication_timeout_);
+    Tracer::inject(context, trace);
+    grpc::Status status = stub->Remove(&context, request, &response);
+    recordReplication(node, status.ok());
+    return status;
+}
+
+bool Node::replicateRemove(const std::vector<std::string>& responsible_nodes, const std::string& key, uint64_t version, RequestTrace* trace) {
+    std::vector<std::pair<std::string, std::future<grpc::Status>>> remove_futures;
+    bool all_successful = true;
+    for (const auto& peer : responsible_nodes) {
+        if (peer == address_) {
+            continue;
+        }
+        if (suspected(peer)) {
+            all_successful = hint(peer, Hint{key, true, "", 0, version}) && all_successful;
+            continue;
+        }
+        remove_futures.emplace_back(peer, std::async(std::launch::async, &Node::RemoveOnReplica, this, peer, key, version, trace));
+    }
+
+    RequestTrace::Phase wait_phase(trace, "replication_wait");
+    for (auto& [peer, future] : remove_futures) {
+        if (!future.get().ok()) {
+            all_successful = hint(peer, Hint{key, true, "", 0, version}) && all_successful;
+        }
+    }
+    return all_successful;
+}
+
+bool Node::hint(const std::string& peer, Hint hint) {
+    return hint_log_ && hint_log_->add(peer, std::move(hint));
+}
+
+bool Node::sendHints(const std::string& peer, const std::vector<Hint>& hints) {
+    auto stub = distributed_cache::DistributedCache::NewStub(getOrCreateChannel(peer));
+    int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    distributed_cache::BulkLoadRequest puts;
+    for (const auto& hint : hints) {
+        std::string ns;
+        std::string key;
+        splitNamespacedKey(hint.key, ns, key);
+        if (hint.remove) {
+            // versioned, so a write the peer took directly since it came back survives the replay
+            if (!RemoveOnReplica(peer, hint.key, hint.version).ok()) {
+                return false;
+            }
+            continue;
+        }
+        if (hint.expiry_ms <= now_ms) {
+            continue;
+        }
+        auto* record = puts.add_records();
+        record->set_namespace_(ns);
+        record->set_key(key);
+        record->set_value(hint.value);
+        // rounded up, like every remaining ttl
+        record->set_ttl((hint.expiry_ms - now_ms + 999) / 1000);
+        record->set_version(hint.version);
+    }
+    if (puts.records_size() == 0) {
+        return true;
+    }
+
+    // the peer keeps whichever version is newer, so a replay that raced a fresh write is harmless
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + replication_timeout_);
+    distributed_cache::BulkLoadResponse response;
+    auto writer = stub->BulkLoad(&context, &response);
+    if (!writer->Write(puts)) {
+        writer->Finish();
+        return false;
+    }
+    writer->WritesDone();
+    return writer->Finish().ok();
+}
+
 
 grpc::Status Node::Remove(grpc::ServerContext* context, const distributed_cache::RemoveRequest* request, distributed_cache::RemoveResponse* response) {
-    std::string key = request->key();
-    auto responsible_nodes = consistent_hash_.getNodes(key, 3);
+    ScopedLatency latency(remove_latency_);
+    ActiveTrace trace(tracer_, context, "Remove", request->key());
+    std::string key;
+    const NamespaceState* ns = nullptr;
+    grpc::Status resolved = resolveKey(request->namespace_(), request->key(), key, ns);
+    if (!resolved.ok()) {
+        return resolved;
+    }
+    std::vector<std::string> responsible_nodes;
+    {
+        RequestTrace::Phase phase(trace.get(), "hash_ring");
+        responsible_nodes = consistent_hash_.getNodes(key, 3);
+    }
     bool is_responsible = std::find(responsible_nodes.begin(), responsible_nodes.end(), address_) != responsible_nodes.end();
 
     if (!is_responsible) {
         // Forward to responsible node
-        return ForwardRemoveRequest(responsible_nodes[0], request, response);
+        if (const PeerMetrics* peer_metrics = peerMetrics(responsible_nodes[0])) {
+            MetricsRegistry::instance().add(peer_metrics->forwarded_removes);
+        }
+        RequestTrace::Phase phase(trace.get(), "forward " + responsible_nodes[0]);
+        return ForwardRemoveRequest(responsible_nodes[0], request, response, trace.get());
     }
 
-    // Log the remove operation
-    write_queue_->logRemove(key);
+    std::unique_lock<std::mutex> key_lock(keyLock(key));
+    // replicas keep the coordinator's version, like replica puts, and only remove what is older
+    uint64_t version = request->is_replica() && request->version() != 0 ? request->version() : nextVersion();
+
+    // Log the remove operation, versioned so recovery orders it against puts that raced it
+    bool logged;
+    {
+        RequestTrace::Phase phase(trace.get(), "wal_enqueue");
+        logged = write_queue_->logRemove(key, version);
+    }
+    if (!logged) {
+        response->set_success(false);
+        return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Write queue is full");
+    }
     
     // Remove from local cache
-    lru_cache_->remove(key);
+    {
+        CachePhase phase(trace.get(), "cache_remove");
+        if (warming_) {
+            // under the replay's lock, so a batch can't slip the key back in between the check and the remove
+            std::lock_guard<std::mutex> lock(warm_mutex_);
+            if (warming_) {
+                warm_removes_.insert(key);
+            }
+            lru_cache_->remove(key, version);
+        } else {
+            lru_cache_->remove(key, version);
+        }
+        if (ssd_tier_) {
+            // an evicted key lives on only in the tier, where the cache's remove doesn't reach without a tombstone
+            ssd_tier_->drop(key, version);
+        }
+    }
+    key_lock.unlock();
 
-    // Remove from replicas
-    std::vector<std::future<grpc::Status>> remove_futures;
-    for (const auto& peer : responsible_nodes) {
-        if (peer != address_) {
-            remove_futures.push_back(
-                std::async(std::launch::async,
-                    [this, &peer, request]() {
-                        distributed_cache::RemoveResponse peer_response;
-                        return this->ForwardRemoveRequest(peer, request, &peer_response);
-                    }
-                )
-            );
+    if (request->is_replica()) {
+        response->set_success(true);
+        return grpc::Status::OK;
+    }
+    access_log_.record(AccessOp::REMOVE, key, 0);
+
+    response->set_success(replicateRemove(responsible_nodes, key, version, trace.get()));
+    return grpc::Status::OK;
+}
+
+template <typename Request, typename Response>
+grpc::Status Node::forwardToPrimary(const std::string& node, const Request& request, Response* response,
+                    grpc::Status (distributed_cache::DistributedCache::Stub::*call)(grpc::ClientContext*, const Request&, Response*),
+                    RequestTrace* trace) {
+    RequestTrace::Phase phase(trace, "forward " + node);
+    auto stub = distributed_cache::DistributedCache::NewStub(getOrCreateChannel(node));
+    grpc::ClientContext client_context;
+    Tracer::inject(client_context, trace);
+    return ((*stub).*call)(&client_context, request, response);
+}
+
+bool Node::updateOnPrimary(const std::string& key, const std::function<bool(std::optional<Cache::Entry>&)>& fn,
+                           Cache::Entry& result, bool& log_failed) {
+    log_failed = false;
+    if (ssd_tier_) {
+        // bring an evicted entry back first, or the operation would start over from an absent key
+        std::string value;
+        uint64_t version;
+        promoteFromTier(key, value, version);
+    }
+    // the key's other local writers wait here, so nothing is applied between the read and the store, while a
+    // write queue that blocks when full only holds up this key rather than the whole cache
+    std::lock_guard<std::mutex> key_lock(keyLock(key));
+    std::optional<Cache::Entry> entry;
+    Cache::Entry current;
+    if (lru_cache_->peek(key, current)) {
+        entry = std::move(current);
+    }
+    bool stored = false;
+    if (fn(entry) && entry) {
+        entry->version = nextVersion();
+        if (!write_queue_->logPut(key, entry->value, ttlSeconds(entry->expiry), entry->version)) {
+            log_failed = true;
+        } else {
+            // a repair or bulk load with a newer version can still land without the key lock; it wins here as it
+            // does in recovery
+            stored = lru_cache_->putIfNewer(key, entry->value, entry->expiry, entry->version);
+            if (stored) {
+                result = *entry;
+            }
         }
     }
+    // a declined operation still read the key
+    access_log_.record(stored ? AccessOp::PUT : AccessOp::GET, key, stored ? result.value.size() : 0);
+    return stored;
+}
 
-    // Wait for all removals to complete
-    bool all_successful = true;
-    for (auto& future : remove_futures) {
-        grpc::Status status = future.get();
-        if (!status.ok()) {
-            all_successful = false;
+grpc::Status Node::CompareAndSet(grpc::ServerContext* context, const distributed_cache::CompareAndSetRequest* request, distributed_cache::CompareAndSetResponse* response) {
+    ActiveTrace trace(tracer_, context, "CompareAndSet", request->key());
+    std::string key;
+    const NamespaceState* ns = nullptr;
+    grpc::Status resolved = resolveKey(request->namespace_(), request->key(), key, ns);
+    if (!resolved.ok()) {
+        return resolved;
+    }
+    std::vector<std::string> responsible_nodes;
+    {
+        RequestTrace::Phase phase(trace.get(), "hash_ring");
+        responsible_nodes = consistent_hash_.getNodes(key, 3);
+    }
+    if (responsible_nodes.empty()) {
+        return grpc::Status(grpc::StatusCode::INTERNAL, "No responsible nodes");
+    }
+    if (responsible_nodes[0] != address_) {
+        return forwardToPrimary(responsible_nodes[0], *request, response, &distributed_cache::DistributedCache::Stub::CompareAndSet, trace.get());
+    }
+
+    Cache::Entry result;
+    bool log_failed;
+    bool matched = false;
+    bool stored;
+    {
+        CachePhase phase(trace.get(), "cache_update");
+        stored = updateOnPrimary(key, [&](std::optional<Cache::Entry>& entry) {
+            uint64_t current = entry ? entry->version : 0;
+            if (current != request->expected_version()) {
+                // hand back what is there so the caller can retry without another Get
+                response->set_version(current);
+                response->set_value(entry ? entry->value : "");
+                return false;
+            }
+            matched = true;
+            entry = Cache::Entry{request->value(), 0, expiryIn(ttlFor(*ns, request->ttl()))};
+            return true;
+        }, result, log_failed);
+    }
+    if (log_failed) {
+        response->set_success(false);
+        return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Write queue is full");
+    }
+    if (matched && !stored) {
+        // the version matched but a newer repair or bulk load landed before the store
+        response->set_success(false);
+        return grpc::Status(grpc::StatusCode::ABORTED, "Key changed concurrently, retry");
+    }
+    if (!stored) {
+        response->set_success(false);
+        return grpc::Status::OK;
+    }
+    response->set_version(result.version);
+    response->set_success(replicate(responsible_nodes, key, result.value, ttlSeconds(result.expiry), result.version, trace.get()));
+    return grpc::Status::OK;
+}
+
+grpc::Status Node::Increment(grpc::ServerContext* context, const distributed_cache::IncrementRequest* request, distributed_cache::IncrementResponse* response) {
+    ActiveTrace trace(tracer_, context, "Increment", request->key());
+    std::string key;
+    const NamespaceState* ns = nullptr;
+    grpc::Status resolved = resolveKey(request->namespace_(), request->key(), key, ns);
+    if (!resolved.ok()) {
+        return resolved;
+    }
+    std::vector<std::string> responsible_nodes;
+    {
+        RequestTrace::Phase phase(trace.get(), "hash_ring");
+        responsible_nodes = consistent_hash_.getNodes(key, 3);
+    }
+    if (responsible_nodes.empty()) {
+        return grpc::Status(grpc::StatusCode::INTERNAL, "No responsible nodes");
+    }
+    if (responsible_nodes[0] != address_) {
+        return forwardToPrimary(responsible_nodes[0], *request, response, &distributed_cache::DistributedCache::Stub::Increment, trace.get());
+    }
+
+    grpc::Status status = grpc::Status::OK;
+    int64_t value = 0;
+    Cache::Entry result;
+    bool log_failed;
+    bool stored;
+    {
+        CachePhase phase(trace.get(), "cache_update");
+        stored = updateOnPrimary(key, [&](std::optional<Cache::Entry>& entry) {
+            if (!entry) {
+                value = request->initial();
+                entry = Cache::Entry{std::to_string(value), 0, expiryIn(ttlFor(*ns, request->ttl()))};
+                return true;
+            }
+            int64_t current;
+            const std::string& text = entry->value;
+            auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), current);
+            if (error != std::errc() || end != text.data() + text.size()) {
+                status = grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, "Value is not a decimal integer");
+                return false;
+            }
+            if (__builtin_add_overflow(current, request->delta(), &value)) {
+                status = grpc::Status(grpc::StatusCode::OUT_OF_RANGE, "Increment overflows int64");
+                return false;
+            }
+            entry->value = std::to_string(value);
+            return true;
+        }, result, log_failed);
+    }
+    if (log_failed) {
+        status = grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Write queue is full");
+    } else if (status.ok() && !stored) {
+        // a newer repair or bulk load landed in between; nothing was stored, so nothing is replicated
+        status = grpc::Status(grpc::StatusCode::ABORTED, "Key changed concurrently, retry");
+    }
+    if (!status.ok()) {
+        response->set_success(false);
+        return status;
+    }
+    response->set_value(value);
+    response->set_version(result.version);
+    response->set_success(replicate(responsible_nodes, key, result.value, ttlSeconds(result.expiry), result.version, trace.get()));
+    return grpc::Status::OK;
+}
+
+grpc::Status Node::Append(grpc::ServerContext* context, const distributed_cache::AppendRequest* request, distributed_cache::AppendResponse* response) {
+    ActiveTrace trace(tracer_, context, "Append", request->key());
+    std::string key;
+    const NamespaceState* ns = nullptr;
+    grpc::Status resolved = resolveKey(request->namespace_(), request->key(), key, ns);
+    if (!resolved.ok()) {
+        return resolved;
+    }
+    std::vector<std::string> responsible_nodes;
+    {
+        RequestTrace::Phase phase(trace.get(), "hash_ring");
+        responsible_nodes = consistent_hash_.getNodes(key, 3);
+    }
+    if (responsible_nodes.empty()) {
+        return grpc::Status(grpc::StatusCode::INTERNAL, "No responsible nodes");
+    }
+    if (responsible_nodes[0] != address_) {
+        return forwardToPrimary(responsible_nodes[0], *request, response, &distributed_cache::DistributedCache::Stub::Append, trace.get());
+    }
+
+    Cache::Entry result;
+    bool log_failed;
+    bool stored;
+    {
+        CachePhase phase(trace.get(), "cache_update");
+        stored = updateOnPrimary(key, [&](std::optional<Cache::Entry>& entry) {
+            if (!entry) {
+                entry = Cache::Entry{request->value(), 0, expiryIn(ttlFor(*ns, request->ttl()))};
+            } else {
+                entry->value += request->value();
+            }
+            return true;
+        }, result, log_failed);
+    }
+    if (log_failed) {
+        response->set_success(false);
+        return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Write queue is full");
+    }
+    if (!stored) {
+        response->set_success(false);
+        return grpc::Status(grpc::StatusCode::ABORTED, "Key changed concurrently, retry");
+    }
+    response->set_version(result.version);
+    response->set_success(replicate(responsible_nodes, key, result.value, ttlSeconds(result.expiry), result.version, trace.get()));
+    return grpc::Status::OK;
+}
+
+grpc::Status Node::GetAndTouch(grpc::ServerContext* context, const distributed_cache::GetAndTouchRequest* request, distributed_cache::GetAndTouchResponse* response) {
+    ActiveTrace trace(tracer_, context, "GetAndTouch", request->key());
+    std::string key;
+    const NamespaceState* ns = nullptr;
+    grpc::Status resolved = resolveKey(request->namespace_(), request->key(), key, ns);
+    if (!resolved.ok()) {
+        return resolved;
+    }
+    std::vector<std::string> responsible_nodes;
+    {
+        RequestTrace::Phase phase(trace.get(), "hash_ring");
+        responsible_nodes = consistent_hash_.getNodes(key, 3);
+    }
+    if (responsible_nodes.empty()) {
+        return grpc::Status(grpc::StatusCode::INTERNAL, "No responsible nodes");
+    }
+    if (responsible_nodes[0] != address_) {
+        return forwardToPrimary(responsible_nodes[0], *request, response, &distributed_cache::DistributedCache::Stub::GetAndTouch, trace.get());
+    }
+
+    Cache::Entry result;
+    bool log_failed;
+    bool found = false;
+    bool stored;
+    {
+        CachePhase phase(trace.get(), "cache_update");
+        stored = updateOnPrimary(key, [&](std::optional<Cache::Entry>& entry) {
+            if (!entry) {
+                return false;
+            }
+            found = true;
+            entry->expiry = expiryIn(ttlFor(*ns, request->ttl()));
+            return true;
+        }, result, log_failed);
+    }
+    if (log_failed) {
+        response->set_success(false);
+        return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Write queue is full");
+    }
+    if (found && !stored) {
+        response->set_success(false);
+        return grpc::Status(grpc::StatusCode::ABORTED, "Key changed concurrently, retry");
+    }
+    if (!stored) {
+        MetricsRegistry::instance().add(ns->misses);
+        response->set_success(false);
+        return grpc::Status(grpc::StatusCode::NOT_FOUND, "Key not found");
+    }
+    MetricsRegistry::instance().add(ns->hits);
+    response->set_value(result.value);
+    response->set_version(result.version);
+    // the new expiry has to reach the replicas, or they would drop the entry early
+    response->set_success(replicate(responsible_nodes, key, result.value, ttlSeconds(result.expiry), result.version, trace.get()));
+    return grpc::Status::OK;
+}
+
+grpc::Status Node::GetMerkleNodes(grpc::ServerContext* context, const distributed_cache::MerkleNodesRequest* request, distributed_cache::MerkleNodesResponse* response) {
+    if (!anti_entropy_) {
+        return grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "Anti-entropy is disabled");
+    }
+    return anti_entropy_->getMerkleNodes(*request, response);
+}
+
+grpc::Status Node::GetBucketEntries(grpc::ServerContext* context, const distributed_cache::BucketEntriesRequest* request, distributed_cache::BucketEntriesResponse* response) {
+    if (!anti_entropy_) {
+        return grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "Anti-entropy is disabled");
+    }
+    return anti_entropy_->getBucketEntries(*request, response);
+}
+
+grpc::Status Node::FetchEntries(grpc::ServerContext* context, const distributed_cache::FetchEntriesRequest* request, grpc::ServerWriter<distributed_cache::CacheEntry>* writer) {
+    if (!anti_entropy_) {
+        return grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "Anti-entropy is disabled");
+    }
+    return anti_entropy_->fetchEntries(*request, writer);
+}
+
+grpc::Status Node::Stats(grpc::ServerContext* context, const distributed_cache::StatsRequest* request, distributed_cache::StatsResponse* response) {
+    for (const auto& sample : MetricsRegistry::instance().collect()) {
+        auto* metric = response->add_metrics();
+        metric->set_name(sample.name);
+        for (const auto& [label, value] : sample.labels) {
+            (*metric->mutable_labels())[label] = value;
+        }
+        if (sample.type == MetricsRegistry::Type::HISTOGRAM) {
+            metric->set_count(sample.count);
+            metric->set_sum(sample.sum);
+            metric->set_p50(sample.percentile(50));
+            metric->set_p90(sample.percentile(90));
+            metric->set_p99(sample.percentile(99));
+            metric->set_p999(sample.percentile(99.9));
+        } else {
+            metric->set_value(sample.value);
+        }
+    }
+    return grpc::Status::OK;
+}
+
+grpc::Status Node::DumpTraces(grpc::ServerContext* context, const distributed_cache::DumpTracesRequest* request, distributed_cache::DumpTracesResponse* response) {
+    std::vector<TraceRecord> records = request->slow_only() ? tracer_.slowLog() : tracer_.sampledTraces();
+    for (const auto& record : records) {
+        auto* trace = response->add_traces();
+        trace->set_trace_id(record.trace_id);
+        trace->set_node(record.node);
+        trace->set_method(record.method);
+        trace->set_key(record.key);
+        trace->set_start_us(record.start_us);
+        trace->set_duration_us(record.duration_us);
+        trace->set_sampled(record.sampled);
+        trace->set_slow(record.slow);
+        for (const auto& span : record.spans) {
+            auto* out = trace->add_spans();
+            out->set_name(span.name);
+            out->set_offset_us(span.offset_us);
+            out->set_duration_us(span.duration_us);
+        }
+    }
+    response->set_chrome_trace_json(Tracer::chromeTraceJson(records));
+    return grpc::Status::OK;
+}
+
+grpc::Status Node::HotKeys(grpc::ServerContext* context, const distributed_cache::HotKeysRequest* request, distributed_cache::HotKeysResponse* response) {
+    HotKeyTracker::Report report = hot_keys_.report(request->limit() > 0 ? request->limit() : SIZE_MAX);
+    // sampled counts scaled back up to requests per second
+    double scale = report.window_seconds > 0 ? report.sample_every / report.window_seconds : 0;
+    auto fill = [&](const std::vector<HotKeyCount>& counts, google::protobuf::RepeatedPtrField<distributed_cache::HotKey>* out) {
+        for (const auto& count : counts) {
+            auto* hot_key = out->Add();
+            std::string ns;
+            std::string key;
+            splitNamespacedKey(count.key, ns, key);
+            hot_key->set_namespace_(ns);
+            hot_key->set_key(key);
+            hot_key->set_rate(count.count * scale);
+            hot_key->set_error(count.error * scale);
+        }
+    };
+    fill(report.reads, response->mutable_reads());
+    fill(report.writes, response->mutable_writes());
+    response->set_window_seconds(report.window_seconds);
+    response->set_sample_every(report.sample_every);
+    return grpc::Status::OK;
+}
+
+grpc::Status Node::BulkLoad(grpc::ServerContext* context, grpc::ServerReader<distributed_cache::BulkLoadRequest>* reader, distributed_cache::BulkLoadResponse* response) {
+    distributed_cache::BulkLoadRequest request;
+    std::vector<std::tuple<std::string, std::string, int64_t, uint64_t>> items;
+    std::vector<bool> applied;
+    std::vector<LogEntry> entries;
+    uint64_t loaded = 0;
+    uint64_t stale = 0;
+    uint64_t misrouted = 0;
+    uint64_t rejected = 0;
+    grpc::Status status = grpc::Status::OK;
+
+    while (status.ok() && reader->Read(&request)) {
+        entries.clear();
+        auto now = std::chrono::system_clock::now();
+        for (auto& record : *request.mutable_records()) {
+            std::string key;
+            const NamespaceState* ns = nullptr;
+            if (!resolveKey(record.namespace_(), record.key(), key, ns).ok()) {
+                ++rejected;
+                continue;
+            }
+            std::vector<std::string> responsible_nodes = consistent_hash_.getNodes(key, 3);
+            if (std::find(responsible_nodes.begin(), responsible_nodes.end(), address_) == responsible_nodes.end()) {
+                ++misrouted;
+                continue;
+            }
+            entries.push_back(LogEntry{
+                .op_type = LogEntry::OpType::PUT,
+                .key = std::move(key),
+                .value = std::move(*record.mutable_value()),
+                .ttl = ttlFor(*ns, record.ttl()),
+                .timestamp = now,
+                .version = record.version() != 0 ? record.version() : nextVersion()
+            });
+        }
+
+        // one WAL write for the batch before any of it is served, so a failed write leaves nothing undurable in
+        // the cache. Entries that turn out stale are logged too; recovery orders them behind the newer writes
+        if (!write_queue_->logBatch(entries)) {
+            status = grpc::Status(grpc::StatusCode::INTERNAL, "Failed to write the bulk load to the WAL");
+            break;
+        }
+        items.clear();
+        for (auto& entry : entries) {
+            items.emplace_back(std::move(entry.key), std::move(entry.value), entry.ttl, entry.version);
+        }
+        // then the whole batch under one cache lock
+        std::size_t stored = lru_cache_->putBatchIfNewer(items, applied);
+        loaded += stored;
+        stale += items.size() - stored;
+        MetricsRegistry::instance().add(bulk_loaded_, stored);
+    }
+
+    response->set_loaded(loaded);
+    response->set_stale(stale);
+    response->set_misrouted(misrouted);
+    response->set_rejected(rejected);
+    return status;
+}
+
+grpc::Status Node::Ping(grpc::ServerContext* context, const distributed_cache::PingRequest* request, distributed_cache::PingResponse* response) {
+    response->set_node(address_);
+    response->set_warming(warming_);
+    return grpc::Status::OK;
+}
+
+grpc::Status Node::Watch(grpc::ServerContext* context, const distributed_cache::WatchRequest* request,
+                         grpc::ServerWriter<distributed_cache::Invalidation>* writer) {
+    uint64_t client_id;
+    if (!tracker_.connect(client_id)) {
+        return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Too many watching clients");
+    }
+    distributed_cache::Invalidation hello;
+    hello.set_client_id(client_id);
+    bool open = writer->Write(hello);
+
+    Invalidation invalidation;
+    while (open && is_running_ && !context->IsCancelled()) {
+        // wakes up now and then to notice a cancelled stream or a stopping node
+        if (!tracker_.wait(client_id, invalidation, std::chrono::milliseconds(1000)) || invalidation.empty()) {
+            continue;
         }
+        distributed_cache::Invalidation message;
+        message.set_all(invalidation.all);
+        for (const auto& stored_key : invalidation.keys) {
+            auto* key = message.add_keys();
+            splitNamespacedKey(stored_key, *key->mutable_namespace_(), *key->mutable_key());
+        }
+        for (const auto& [first, last] : invalidation.ranges) {
+            auto* range = message.add_ranges();
+            std::string ns;
+            splitNamespacedKey(first, *range->mutable_namespace_(), *range->mutable_first());
+            splitNamespacedKey(last, ns, *range->mutable_last());
+        }
+        open = writer->Write(message);
     }
+    tracker_.disconnect(client_id);
+    return grpc::Status::OK;
+}
 
-    response->set_success(all_successful);
+grpc::Status Node::Track(grpc::ServerContext* context, const distributed_cache::TrackRequest* request,
+                         distributed_cache::TrackResponse* response) {
+    std::vector<std::string> keys;
+    keys.reserve(request->keys_size());
+    for (const auto& key : request->keys()) {
+        std::string stored_key;
+        const NamespaceState* ns = nullptr;
+        grpc::Status resolved = resolveKey(request->namespace_(), key, stored_key, ns);
+        if (!resolved.ok()) {
+            return resolved;
+        }
+        auto owners = consistent_hash_.getNodes(stored_key, 3);
+        if (std::find(owners.begin(), owners.end(), address_) == owners.end()) {
+            response->add_not_owned(key);
+            continue;
+        }
+        keys.push_back(std::move(stored_key));
+    }
+    if (!tracker_.track(request->client_id(), keys)) {
+        return grpc::Status(grpc::StatusCode::NOT_FOUND, "Unknown client, open a Watch stream first");
+    }
+
+    for (const auto& prefix : request->prefixes()) {
+        std::string stored_prefix;
+        const NamespaceState* ns = nullptr;
+        grpc::Status resolved = resolveKey(request->namespace_(), prefix, stored_prefix, ns);
+        if (!resolved.ok()) {
+            return resolved;
+        }
+        if (stored_prefix.empty()) {
+            // would match the keys of every namespace
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "The default namespace has no empty prefix");
+        }
+        if (!tracker_.trackPrefix(request->client_id(), stored_prefix)) {
+            return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Prefix table is full");
+        }
+    }
     return grpc::Status::OK;
 }
 
 grpc::Status Node::ForwardPutRequest(const std::string& node,
                     const distributed_cache::PutRequest* request,
-                    distributed_cache::PutResponse* response){
+                    distributed_cache::PutResponse* response,
+                    RequestTrace* trace){
     auto channel = getOrCreateChannel(node);
     auto stub = distributed_cache::DistributedCache::NewStub(channel);
     grpc::ClientContext client_context;
+    Tracer::inject(client_context, trace);
     return stub->Put(&client_context, *request, response);
 }
 
 grpc::Status Node::ForwardGetRequest(const std::string& node,
                     const distributed_cache::GetRequest* request,
-                    distributed_cache::GetResponse* response){
+                    distributed_cache::GetResponse* response,
+                    RequestTrace* trace){
     auto channel = getOrCreateChannel(node);
     auto stub = distributed_cache::DistributedCache::NewStub(channel);
     grpc::ClientContext client_context;
+    Tracer::inject(client_context, trace);
     return stub->Get(&client_context, *request, response);
 }
 grpc::Status Node::ForwardRemoveRequest(const std::string& node,
                     const distributed_cache::RemoveRequest* request,
-                    distributed_cache::RemoveResponse* response){
+                    distributed_cache::RemoveResponse* response,
+                    RequestTrace* trace){
     auto channel = getOrCreateChannel(node);
     auto stub = distributed_cache::DistributedCache::NewStub(channel);
     grpc::ClientContext client_context;
+    Tracer::inject(client_context, trace);
     return stub->Remove(&client_context, *request, response);
 }
 
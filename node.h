@@ -6,24 +6,86 @@
 #include "wal.h"
 #include "recovery.h"
 #include "write_queue.h"
+#include "anti_entropy.h"
+#include "cache_arena.h"
+#include "metrics.h"
+#include "tracing.h"
+#include "namespaces.h"
+#include "ssd_tier.h"
+#include "slab_allocator.h"
+#include "hot_keys.h"
+#include "failure_detector.h"
+#include "hint_log.h"
+#include "client_tracking.h"
+#include "access_log.h"
 #include "grpcpp/grpcpp.h"
 #include "distributed-cache.grpc.pb.h"
 
 #include <mutex>
+#include <array>
 #include <cstddef>
 #include <atomic>
 #include <string>
 #include <vector>
 #include <memory>
 #include <thread>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
 
 
+// optional features and tuning knobs, the defaults keep the original behaviour
+struct NodeOptions {
+    WALOptions wal;
+    WriteQueueOptions write_queue;
+    // how often replicas compare Merkle trees, 0 disables anti-entropy
+    std::chrono::seconds anti_entropy_interval{10};
+    // file mirroring the cache for warm restarts (e.g. under /dev/shm), empty disables it
+    std::string cache_arena_path;
+    // bytes per arena slot, entries that don't fit are only recovered from the WAL
+    std::size_t cache_arena_slot_size = 4096;
+    // port of the Prometheus /metrics endpoint, 0 disables it
+    int metrics_port = 0;
+    // request sampling and the slow log, both off by default
+    TracingOptions tracing;
+    // tenants with their own share of the cache, must be the same on every node. One named "default"
+    // configures the default namespace, which otherwise only has the cache capacity as its limit
+    std::vector<NamespaceOptions> namespaces;
+    // disk tier for entries evicted from memory, an empty path disables it
+    SsdTierOptions ssd_tier;
+    // size-classed memory for the cache entries, off unless max_bytes is set
+    SlabOptions slab;
+    // sampled top-k of read and written keys
+    HotKeyOptions hot_keys;
+    // deadline of every replica write, a replica that misses it gets a hint instead
+    std::chrono::milliseconds replication_timeout{1000};
+    // peers the detector suspects get no replica writes, only hints, until they answer heartbeats again
+    FailureDetectorOptions failure_detector;
+    HintOptions hints;
+    // keys and prefixes clients track through Watch streams
+    TrackingOptions tracking;
+    // sampled key access trace for cachemesh_sim, off unless a path is set
+    AccessLogOptions access_log;
+    // how long a remove is remembered, so a replica write or hint older than it arriving late can't bring the
+    // key back; 0 disables tombstones
+    std::chrono::seconds tombstone_ttl{600};
+    std::size_t max_tombstones = 1000000;
+    // start serving right away and replay the WAL in the background; reads the replay hasn't reached yet
+    // fall back to a replica. A restore from the cache arena is fast enough to stay in the foreground
+    bool fast_start = false;
+};
+
 // NEED TO INHERIT LATER
 class Node: public distributed_cache::DistributedCache::Service {
 private:
+    using Cache = LRUCache<std::string, std::string>;
+
     std::string address_;
     std::vector<std::string> peers_;
     std::size_t cache_capacity_;
+    // declared before the cache, which allocates from it
+    std::unique_ptr<SlabAllocator> slab_;
     std::unique_ptr<LRUCache<std::string, std::string>> lru_cache_;
     std::unique_ptr<grpc::Server> server_;
     ConsistentHash consistent_hash_;
@@ -31,6 +93,64 @@ private:
     std::thread cleanup_thread_;
     std::unique_ptr<WriteQueue> write_queue_;
     std::unique_ptr<RecoveryManager> recovery_manager_;
+    std::unique_ptr<AntiEntropy> anti_entropy_;
+    std::unique_ptr<CacheArena> cache_arena_;
+    std::unique_ptr<SsdTier> ssd_tier_;
+    std::unique_ptr<FailureDetector> failure_detector_;
+    std::unique_ptr<HintLog> hint_log_;
+    std::chrono::milliseconds replication_timeout_;
+    // set while the WAL replays in the background
+    std::atomic<bool> warming_{false};
+    std::thread recovery_thread_;
+    // keys removed while warming, so the replay doesn't bring them back. Held across every replay batch
+    std::mutex warm_mutex_;
+    std::unordered_set<std::string> warm_removes_;
+    // striped by key hash, held by the local puts, removes and read-modify-writes of a key from the version they
+    // assign until the write is applied. Lets a read-modify-write log outside the cache lock
+    std::array<std::mutex, 256> key_locks_;
+    // what the last heartbeat said about each peer, keys are fixed after construction
+    std::unordered_map<std::string, std::atomic<bool>> peer_warming_;
+
+    // low byte of every version this node assigns, keeps versions from different writers apart
+    uint64_t version_tag_;
+    std::atomic<uint64_t> last_version_{0};
+
+    // metric handles, registered in the constructor so the RPC paths only record
+    struct PeerMetrics {
+        MetricsRegistry::Counter forwarded_gets;
+        MetricsRegistry::Counter forwarded_puts;
+        MetricsRegistry::Counter forwarded_removes;
+        MetricsRegistry::Counter replicated;
+        MetricsRegistry::Counter replication_failures;
+    };
+    MetricsRegistry::Histogram get_latency_;
+    MetricsRegistry::Histogram put_latency_;
+    MetricsRegistry::Histogram remove_latency_;
+    MetricsRegistry::Histogram replication_latency_;
+    MetricsRegistry::Counter cache_expirations_;
+    MetricsRegistry::Counter bulk_loaded_;
+    MetricsRegistry::Counter warming_fallbacks_;
+    // read-only after construction, so lookups need no lock
+    std::unordered_map<std::string, PeerMetrics> peer_metrics_;
+
+    // a namespace's cache partition and its counters
+    struct NamespaceState {
+        NamespaceOptions options;
+        std::size_t partition;
+        MetricsRegistry::Counter hits;
+        MetricsRegistry::Counter misses;
+        MetricsRegistry::Counter evictions;
+    };
+    // keyed by the name requests use, empty for the default namespace; read-only after construction
+    std::unordered_map<std::string, NamespaceState> namespaces_;
+    int metrics_port_;
+    std::unique_ptr<MetricsHttpServer> metrics_server_;
+    Tracer tracer_;
+    HotKeyTracker hot_keys_;
+    ClientTracker tracker_;
+    // Watch streams hold a server thread each, the pool grows by that many
+    std::size_t max_watchers_;
+    AccessLog access_log_;
 
     std::mutex channel_mutex_;
     std::unordered_map<std::string, std::shared_ptr<grpc::Channel>> channel_pool_;
@@ -42,7 +162,8 @@ public:
         const std::string& address,
         const std::vector<std::string>& peers,
         std::size_t cache_capacity = 10000,
-        const std::string& wal_path = "/Users/wangweisheng/Code/ws/distributed-cache-system-v2/wal.log"
+        const std::string& wal_path = "wal",
+        const NodeOptions& options = NodeOptions()
     );
     ~Node();
     void start();
@@ -60,6 +181,48 @@ public:
     grpc::Status Remove(grpc::ServerContext* context,
                        const distributed_cache::RemoveRequest* request,
                        distributed_cache::RemoveResponse* response);
+    grpc::Status CompareAndSet(grpc::ServerContext* context,
+                       const distributed_cache::CompareAndSetRequest* request,
+                       distributed_cache::CompareAndSetResponse* response);
+    grpc::Status Increment(grpc::ServerContext* context,
+                       const distributed_cache::IncrementRequest* request,
+                       distributed_cache::IncrementResponse* response);
+    grpc::Status Append(grpc::ServerContext* context,
+                       const distributed_cache::AppendRequest* request,
+                       distributed_cache::AppendResponse* response);
+    grpc::Status GetAndTouch(grpc::ServerContext* context,
+                       const distributed_cache::GetAndTouchRequest* request,
+                       distributed_cache::GetAndTouchResponse* response);
+    grpc::Status GetMerkleNodes(grpc::ServerContext* context,
+                       const distributed_cache::MerkleNodesRequest* request,
+                       distributed_cache::MerkleNodesResponse* response);
+    grpc::Status GetBucketEntries(grpc::ServerContext* context,
+                       const distributed_cache::BucketEntriesRequest* request,
+                       distributed_cache::BucketEntriesResponse* response);
+    grpc::Status FetchEntries(grpc::ServerContext* context,
+                       const distributed_cache::FetchEntriesRequest* request,
+                       grpc::ServerWriter<distributed_cache::CacheEntry>* writer);
+    grpc::Status Stats(grpc::ServerContext* context,
+                       const distributed_cache::StatsRequest* request,
+                       distributed_cache::StatsResponse* response);
+    grpc::Status DumpTraces(grpc::ServerContext* context,
+                       const distributed_cache::DumpTracesRequest* request,
+                       distributed_cache::DumpTracesResponse* response);
+    grpc::Status HotKeys(grpc::ServerContext* context,
+                       const distributed_cache::HotKeysRequest* request,
+                       distributed_cache::HotKeysResponse* response);
+    grpc::Status BulkLoad(grpc::ServerContext* context,
+                       grpc::ServerReader<distributed_cache::BulkLoadRequest>* reader,
+                       distributed_cache::BulkLoadResponse* response);
+    grpc::Status Ping(grpc::ServerContext* context,
+                       const distributed_cache::PingRequest* request,
+                       distributed_cache::PingResponse* response);
+    grpc::Status Watch(grpc::ServerContext* context,
+                       const distributed_cache::WatchRequest* request,
+                       grpc::ServerWriter<distributed_cache::Invalidation>* writer);
+    grpc::Status Track(grpc::ServerContext* context,
+                       const distributed_cache::TrackRequest* request,
+                       distributed_cache::TrackResponse* response);
 
 
 
@@ -67,19 +230,77 @@ public:
 
 
 private:
-    grpc::Status ReplicateToNode(const std::string& node, const std::string& key, const std::string& value, int64_t ttl);
+    // trace, when set, is passed on to the peer; ReplicateToNode also records its own span since it runs on its own thread
+    grpc::Status ReplicateToNode(const std::string& node, const std::string& key, const std::string& value, int64_t ttl, uint64_t version,
+                    RequestTrace* trace = nullptr);
     grpc::Status ForwardPutRequest(const std::string& node,
                     const distributed_cache::PutRequest* request,
-                    distributed_cache::PutResponse* response);
+                    distributed_cache::PutResponse* response,
+                    RequestTrace* trace = nullptr);
     grpc::Status ForwardGetRequest(const std::string& node,
                     const distributed_cache::GetRequest* request,
-                    distributed_cache::GetResponse* response);
+                    distributed_cache::GetResponse* response,
+                    RequestTrace* trace = nullptr);
     grpc::Status ForwardRemoveRequest(const std::string& node,
                     const distributed_cache::RemoveRequest* request,
-                    distributed_cache::RemoveResponse* response);
+                    distributed_cache::RemoveResponse* response,
+                    RequestTrace* trace = nullptr);
+    grpc::Status RemoveOnReplica(const std::string& node, const std::string& key, uint64_t version, RequestTrace* trace = nullptr);
+
+        // send an atomic operation on to the primary owner of its key
+    template <typename Request, typename Response>
+    grpc::Status forwardToPrimary(const std::string& node, const Request& request, Response* response,
+                    grpc::Status (distributed_cache::DistributedCache::Stub::*call)(grpc::ClientContext*, const Request&, Response*),
+                    RequestTrace* trace);
+    // write to every replica in responsible_nodes but this node in parallel. Suspected replicas and those that
+    // fail get a hint instead; true if every replica either acknowledged or was hinted
+    bool replicate(const std::vector<std::string>& responsible_nodes, const std::string& key, const std::string& value,
+                   int64_t ttl, uint64_t version, RequestTrace* trace);
+    // read-modify-write on the primary under the key's lock. fn edits a copy of the live entry (nullopt if absent)
+    // and returns whether to store it; the result gets a fresh version and is logged before it is applied.
+    // returns whether anything was stored, log_failed tells a full write queue apart from fn declining
+    bool updateOnPrimary(const std::string& key, const std::function<bool(std::optional<Cache::Entry>&)>& fn,
+                         Cache::Entry& result, bool& log_failed);
+
+    // replicate a remove the same way
+    bool replicateRemove(const std::vector<std::string>& responsible_nodes, const std::string& key, uint64_t version, RequestTrace* trace);
+    bool suspected(const std::string& peer) const { return failure_detector_ && failure_detector_->suspect(peer); }
+    // false without a hint log or when it is full
+    bool hint(const std::string& peer, Hint hint);
+    // hint log replay: puts as one BulkLoad batch, removes one by one
+    bool sendHints(const std::string& peer, const std::vector<Hint>& hints);
 
-    
     void cleanup();
+    // the background replay behind fast_start
+    void warmUp();
+    // tells the arena a full WAL replay is in the cache
+    void arenaReplayed();
+    // a warming node's way out of a local miss: the first live and warm replica's copy
+    bool readFromReplica(const std::vector<std::string>& responsible_nodes, const distributed_cache::GetRequest& request,
+                         distributed_cache::GetResponse* response, RequestTrace* trace);
+    bool peerWarming(const std::string& peer) const;
+    void registerMetrics();
+    // one cache partition per namespace, the default namespace is always partition 0
+    void setupNamespaces(const std::vector<NamespaceOptions>& namespaces);
+    // the key the cache and ring use for a request, INVALID_ARGUMENT for unknown namespaces
+    grpc::Status resolveKey(const std::string& ns, const std::string& key, std::string& stored_key, const NamespaceState*& state) const;
+    // the namespace's default ttl stands in for a missing one
+    static int64_t ttlFor(const NamespaceState& state, int64_t ttl) {
+        return ttl <= 0 && state.options.default_ttl > 0 ? state.options.default_ttl : ttl;
+    }
+    // peer_metrics_ entry of a ring member, null for unknown addresses
+    const PeerMetrics* peerMetrics(const std::string& peer) const;
+    void recordReplication(const std::string& peer, bool ok);
+    // wall-clock microseconds shifted left by 8 with version_tag_ below, strictly increasing per node
+    uint64_t nextVersion();
+    std::mutex& keyLock(const std::string& key) { return key_locks_[std::hash<std::string>{}(key) % key_locks_.size()]; }
+    // fan cache events out to the components tracking the cache contents, runs under the cache lock
+    void onCacheEvent(CacheEvent event, std::string_view key, std::string_view value, uint64_t version,
+                      std::chrono::steady_clock::time_point expiry);
+    // move a key the SSD tier holds back into memory, false if the tier has no live copy
+    bool promoteFromTier(const std::string& key, std::string& value, uint64_t& version);
+    // log and store an entry pulled by anti-entropy
+    bool applyRepair(const distributed_cache::CacheEntry& entry);
     std::shared_ptr<grpc::Channel> getOrCreateChannel(const std::string& node_address);
 
 
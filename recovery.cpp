@@ -1,78 +1,264 @@
 #include "recovery.h"
 #include "lru.h"
 #include "wal.h"
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <future>
+#include <limits>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-RecoveryManager::RecoveryManager(const std::string& wal_path) : wal_path_(wal_path) {}
+namespace {
+
+// the last operation seen for a key, position is the record index in the log
+struct RecoveredOp {
+    LogEntry entry;
+    std::size_t position;
+};
+
+// entries logged without a version order by their wall clock timestamp, in the same encoding as
+// Node::nextVersion, so they still compare with versioned ones
+uint64_t effectiveVersion(const LogEntry& entry) {
+    if (entry.version != 0) {
+        return entry.version;
+    }
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(entry.timestamp.time_since_epoch()).count();
+    return static_cast<uint64_t>(micros) << 8;
+}
+
+// later is further down the log. Versioned writes can reach the log out of order when replica writes
+// race, so the higher version wins, puts and removes alike, and the log order only breaks ties. One total
+// order makes the chunk merge independent of how the log was split between threads
+bool supersedes(const RecoveredOp& later, const RecoveredOp& earlier) {
+    uint64_t later_version = effectiveVersion(later.entry);
+    uint64_t earlier_version = effectiveVersion(earlier.entry);
+    if (later_version != earlier_version) {
+        return later_version > earlier_version;
+    }
+    return later.position > earlier.position;
+}
+
+}
+
+RecoveryManager::RecoveryManager(const std::string& wal_path, std::size_t num_threads)
+    : wal_path_(wal_path)
+    , num_threads_(std::max<std::size_t>(1, num_threads)) {}
+
+std::vector<RecoveryManager::RecordRef> RecoveryManager::scanRecords(const char* base, std::size_t size) {
+    std::vector<RecordRef> records;
+    std::size_t offset = 0;
+
+    while (offset + sizeof(uint32_t) <= size) {
+        uint32_t batch_size;
+        std::memcpy(&batch_size, base + offset, sizeof(batch_size));
+        if (batch_size == 0) {
+            // preallocated space that was never written
+            break;
+        }
+        std::size_t cursor = offset + sizeof(batch_size);
+
+        std::vector<RecordRef> batch;
+        batch.reserve(batch_size);
+        bool truncated = false;
+        for (uint32_t i = 0; i < batch_size; ++i) {
+            uint32_t length;
+            if (cursor + sizeof(length) > size) {
+                truncated = true;
+                break;
+            }
+            std::memcpy(&length, base + cursor, sizeof(length));
+            cursor += sizeof(length);
+            if (cursor + length > size) {
+                truncated = true;
+                break;
+            }
+            batch.push_back(RecordRef{base + cursor, length});
+            cursor += length;
+        }
+
+        // a batch cut short by a crash is dropped as a whole, same as the flush that never completed
+        if (truncated) {
+            std::cerr << "Truncated WAL batch at offset " << offset << ", ignoring the tail of the segment" << std::endl;
+            break;
+        }
+        records.insert(records.end(), batch.begin(), batch.end());
+        offset = cursor;
+    }
+    return records;
+}
 
 void RecoveryManager::recoverFromWAL(const std::string& node_id, LRUCache<std::string, std::string>& cache) {
+    // nothing else touches the cache yet, one lock acquisition for everything
+    recoverFromWAL(node_id, [&cache](Items& items) {
+        cache.putBatch(items);
+        return true;
+    }, std::numeric_limits<std::size_t>::max());
+}
+
+void RecoveryManager::recoverFromWAL(const std::string& node_id, const Apply& apply, std::size_t batch_size) {
     std::cout << "Starting recovery from WAL..." << std::endl;
-    std::size_t entries_recovered = 0;
-    
+    auto start_time = std::chrono::steady_clock::now();
+
+    // every segment stays mapped until the merge is done, records point into them
+    std::vector<std::pair<void*, std::size_t>> mappings;
+    auto unmapAll = [&mappings]() {
+        for (auto& [address, length] : mappings) {
+            ::munmap(address, length);
+        }
+        mappings.clear();
+    };
+
     try {
-        // reading in binary mode
-        std::ifstream wal_file(wal_path_, std::ios::binary);
-        if (!wal_file) {
-            throw std::runtime_error("Failed to open WAL file: " + wal_path_);
+        std::vector<std::string> segments;
+        if (std::filesystem::is_regular_file(wal_path_)) {
+            segments.push_back(wal_path_);
+        } else {
+            segments = WAL::listSegments(WAL::segmentDirectory(wal_path_, node_id));
         }
 
-        while (wal_file.good()) {
-            try {
-                uint32_t batch_size;
+        std::size_t total_bytes = 0;
+        std::vector<RecordRef> records;
+        for (const auto& segment : segments) {
+            int fd = ::open(segment.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("Failed to open WAL file: " + segment);
+            }
 
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw std::runtime_error("Failed to stat WAL file: " + segment);
+            }
+            std::size_t file_size = static_cast<std::size_t>(st.st_size);
+            if (file_size == 0) {
+                ::close(fd);
+                continue;
+            }
 
-                // Read the entry length 
-                uint32_t length;
+            void* mapped = ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (mapped == MAP_FAILED) {
+                throw std::runtime_error("Failed to mmap WAL file: " + segment);
+            }
+            mappings.emplace_back(mapped, file_size);
+            ::madvise(mapped, file_size, MADV_WILLNEED);
 
-                // read the batch size first 
-                if (!wal_file.read(reinterpret_cast<char*>(&batch_size), sizeof(batch_size))) {
-                    if (wal_file.eof()) break;
-                    throw std::runtime_error("Failed to read batch size");
-                }
+            auto segment_records = scanRecords(static_cast<const char*>(mapped), file_size);
+            if (!segment_records.empty()) {
+                const RecordRef& last = segment_records.back();
+                total_bytes += (last.data + last.length) - static_cast<const char*>(mapped);
+            }
+            records.insert(records.end(), segment_records.begin(), segment_records.end());
+        }
 
-                // check for EOF
-                if (wal_file.eof()) break;
+        // parse and checksum contiguous chunks in parallel, each worker keeps the last op per key it saw
+        std::size_t num_chunks = std::min(num_threads_, std::max<std::size_t>(1, records.size()));
+        std::size_t chunk_size = (records.size() + num_chunks - 1) / num_chunks;
+        std::vector<std::future<std::unordered_map<std::string, RecoveredOp>>> workers;
+        std::atomic<std::size_t> corrupted{0};
 
-                // read each entry
-                for (int i = 0; i < batch_size; ++i) {
+        for (std::size_t c = 0; c < num_chunks; ++c) {
+            std::size_t begin = c * chunk_size;
+            std::size_t end = std::min(records.size(), begin + chunk_size);
+            workers.push_back(std::async(std::launch::async, [&records, &node_id, &corrupted, begin, end]() {
+                std::unordered_map<std::string, RecoveredOp> latest;
+                for (std::size_t i = begin; i < end; ++i) {
                     try {
-                    
-                        wal_file.read(reinterpret_cast<char*>(&length), sizeof(length));
-                        if(wal_file.eof()) break;
-
-                        // Read the entry data
-                        std::vector<char> buffer(length);
-                        wal_file.read(buffer.data(), length);
-
-                        // Deserialize the entry
-                        LogEntry entry = WAL::deserializeEntry(std::string(buffer.begin(), buffer.end()));
-
-                        auto now = std::chrono::system_clock::now();
-                        
-                        if (entry.timestamp + std::chrono::seconds(entry.ttl) > now && entry.node_id == node_id) {
-                            // Apply the operation to the cache
-                            if (entry.op_type == LogEntry::OpType::PUT) {
-                                cache.put(entry.key, entry.value, entry.ttl);
-                            } else if (entry.op_type == LogEntry::OpType::REMOVE) {
-                                cache.remove(entry.key);
-                            }
-                            entries_recovered++;
+                        LogEntry entry = WAL::deserializeEntry(records[i].data, records[i].length);
+                        if (entry.node_id != node_id) {
+                            continue;
+                        }
+                        RecoveredOp op{std::move(entry), i};
+                        auto it = latest.find(op.entry.key);
+                        if (it == latest.end()) {
+                            std::string key = op.entry.key;
+                            latest.emplace(std::move(key), std::move(op));
+                        } else if (supersedes(op, it->second)) {
+                            it->second = std::move(op);
                         }
                     } catch (const std::exception& e) {
-                        std::cerr << "Error processing batch : " << e.what() << std::endl;
-                        continue;  // Skip to next entry on error
+                        // skip the corrupted entry, the rest of the log is still usable
+                        ++corrupted;
                     }
                 }
-            } catch (const std::exception& e) {
-                std::cerr << "Error during entry recovery: " << e.what() << std::endl;
-                continue;  // Skip to next entry on error
+                return latest;
+            }));
+        }
+
+        // sequence numbers restart with every process, the log position is the tie breaker
+        std::unordered_map<std::string, RecoveredOp> merged;
+        for (auto& worker : workers) {
+            auto latest = worker.get();
+            if (merged.empty()) {
+                merged = std::move(latest);
+                continue;
+            }
+            for (auto& [key, op] : latest) {
+                auto it = merged.find(key);
+                if (it == merged.end()) {
+                    merged.emplace(key, std::move(op));
+                } else if (supersedes(op, it->second)) {
+                    it->second = std::move(op);
+                }
             }
         }
-        
-        std::cout << "Recovery completed: " << entries_recovered << " entries processed" << std::endl;
+        unmapAll();
+
+        // replay surviving puts oldest first so the most recent writes end up most recently used
+        std::vector<RecoveredOp*> puts;
+        puts.reserve(merged.size());
+        for (auto& [key, op] : merged) {
+            if (op.entry.op_type == LogEntry::OpType::PUT) {
+                puts.push_back(&op);
+            }
+        }
+        std::sort(puts.begin(), puts.end(), [](const RecoveredOp* a, const RecoveredOp* b) {
+            return a->position < b->position;
+        });
+
+        auto now = std::chrono::system_clock::now();
+        Items items;
+        items.reserve(std::min(puts.size(), batch_size));
+        std::size_t restored = 0;
+        bool stopped = false;
+        for (RecoveredOp* op : puts) {
+            auto expiry = op->entry.timestamp + std::chrono::seconds(op->entry.ttl);
+            if (expiry <= now) {
+                continue;
+            }
+            // only the remaining lifetime is restored, not the original ttl
+            int64_t remaining = std::chrono::duration_cast<std::chrono::seconds>(expiry - now).count() + 1;
+            items.emplace_back(std::move(op->entry.key), std::move(op->entry.value), remaining, op->entry.version);
+            if (items.size() >= batch_size) {
+                restored += items.size();
+                if (!apply(items)) {
+                    stopped = true;
+                    break;
+                }
+                items.clear();
+            }
+        }
+        if (!stopped && !items.empty()) {
+            restored += items.size();
+            apply(items);
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        double throughput = seconds > 0 ? (total_bytes / (1024.0 * 1024.0)) / seconds : 0;
+        std::cout << "Recovery completed: " << segments.size() << " segments, "
+                  << records.size() << " records scanned, "
+                  << restored << " entries restored" << (stopped ? " before it was stopped, " : ", ")
+                  << corrupted.load() << " corrupted, "
+                  << throughput << " MB/s" << std::endl;
     } catch (const std::exception& e) {
+        unmapAll();
         std::cerr << "Fatal error during recovery: " << e.what() << std::endl;
         throw;  // Re-throw fatal errors
     }
-}
\ No newline at end of file
+}
@@ -5,12 +5,37 @@
 #include "lru.h"
 
 #include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <tuple>
 
 class RecoveryManager {
 public:
-    RecoveryManager(const std::string& wal_path);
+    // wal_path is the WAL directory, or a single log file written before segments existed
+    RecoveryManager(const std::string& wal_path, std::size_t num_threads = std::thread::hardware_concurrency());
+    // (key, value, remaining ttl, version), as LRUCache::putBatch takes them
+    using Items = std::vector<std::tuple<std::string, std::string, int64_t, uint64_t>>;
+    // stores a batch of recovered puts, false stops the replay
+    using Apply = std::function<bool(Items& items)>;
+
     void recoverFromWAL(const std::string& node_id, LRUCache<std::string, std::string>& cache);
+    // hands the surviving puts to apply oldest first, batch_size at a time, for a cache that is already serving
+    void recoverFromWAL(const std::string& node_id, const Apply& apply, std::size_t batch_size);
 private:
-    const std::string& wal_path_;
+    // location of one serialized entry inside the mapped log
+    struct RecordRef {
+        const char* data;
+        uint32_t length;
+    };
+
+    // walk the batch/length prefixes and collect record boundaries,
+    // stops at the zeroed preallocated tail or the first truncated batch
+    static std::vector<RecordRef> scanRecords(const char* base, std::size_t size);
+
+    std::string wal_path_;
+    std::size_t num_threads_;
 };
 #endif
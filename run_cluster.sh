@@ -0,0 +1,93 @@
+#!/usr/bin/env bash
+# Start a local CacheMesh cluster and optionally run the load generator against it.
+#
+#   ./run_cluster.sh [-n NODES] [-p BASE_PORT] [-b BUILD_DIR] [-d DATA_DIR] [-o "NODE OPTIONS"] [-- LOADGEN OPTIONS]
+#
+# Without loadgen options the nodes run until Ctrl-C. With them, cachemesh_loadgen is pointed at
+# every node (--targets is filled in) and the cluster is stopped when it finishes, e.g.
+#
+#   ./run_cluster.sh -n 5 -- --rate=20000 --duration=60 --distribution=zipf --preload --out=run.json
+
+set -euo pipefail
+
+NODES=3
+BASE_PORT=50051
+BUILD_DIR=build
+DATA_DIR=cluster-data
+NODE_OPTIONS=""
+
+while getopts "n:p:b:d:o:h" opt; do
+    case "$opt" in
+        n) NODES="$OPTARG" ;;
+        p) BASE_PORT="$OPTARG" ;;
+        b) BUILD_DIR="$OPTARG" ;;
+        d) DATA_DIR="$OPTARG" ;;
+        o) NODE_OPTIONS="$OPTARG" ;;
+        *) sed -n '2,9p' "$0" | sed 's/^# \{0,1\}//'; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+if [[ "${1:-}" == "--" ]]; then
+    shift
+fi
+
+NODE_BIN="$BUILD_DIR/distributed_cache"
+LOADGEN_BIN="$BUILD_DIR/cachemesh_loadgen"
+if [[ ! -x "$NODE_BIN" ]]; then
+    echo "Node binary not found at $NODE_BIN, build first or pass -b" >&2
+    exit 1
+fi
+
+ADDRESSES=()
+for ((i = 0; i < NODES; i++)); do
+    ADDRESSES+=("localhost:$((BASE_PORT + i))")
+done
+
+PIDS=()
+stop_cluster() {
+    if [[ ${#PIDS[@]} -gt 0 ]]; then
+        echo "Stopping ${#PIDS[@]} nodes"
+        kill "${PIDS[@]}" 2>/dev/null || true
+        wait "${PIDS[@]}" 2>/dev/null || true
+    fi
+}
+trap stop_cluster EXIT INT TERM
+
+mkdir -p "$DATA_DIR"
+for ((i = 0; i < NODES; i++)); do
+    address="${ADDRESSES[$i]}"
+    peers=()
+    for other in "${ADDRESSES[@]}"; do
+        [[ "$other" != "$address" ]] && peers+=("$other")
+    done
+    port="${address##*:}"
+    # NODE_OPTIONS is split on purpose so several flags can be passed in one -o
+    # shellcheck disable=SC2086
+    "$NODE_BIN" --wal-dir="$DATA_DIR/wal" $NODE_OPTIONS "$address" "${peers[@]}" > "$DATA_DIR/node-$port.log" 2>&1 &
+    PIDS+=($!)
+    echo "Started node $address (pid $!, log $DATA_DIR/node-$port.log)"
+done
+
+# wait until every node accepts connections
+for address in "${ADDRESSES[@]}"; do
+    port="${address##*:}"
+    for ((attempt = 0; attempt < 100; attempt++)); do
+        if (echo > "/dev/tcp/127.0.0.1/$port") 2>/dev/null; then
+            break
+        fi
+        sleep 0.1
+    done
+done
+
+if [[ $# -eq 0 ]]; then
+    echo "Cluster running, press Ctrl-C to stop"
+    wait
+    exit 0
+fi
+
+if [[ ! -x "$LOADGEN_BIN" ]]; then
+    echo "Load generator not found at $LOADGEN_BIN" >&2
+    exit 1
+fi
+TARGETS=$(IFS=,; echo "${ADDRESSES[*]}")
+"$LOADGEN_BIN" --targets="$TARGETS" "$@"
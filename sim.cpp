@@ -0,0 +1,522 @@
+// trace-driven capacity planner for a CacheMesh cluster.
+// replays the sampled access logs nodes write with --access-log through the ConsistentHash and LRUCache the
+// nodes run, and reports how keys and requests spread over the nodes, the hit ratio at the per-node capacity,
+// a miss ratio curve over cache sizes from a single pass, and what each replication factor costs in memory.
+// The logs sample by key, so a sample at rate R behaves like the full trace on caches R times the size (SHARDS);
+// cache sizes are scaled that way and counts are scaled back up to estimates for the full trace.
+// Both cache models fill a get miss right away, as the client's Put after the miss would. A log started on a
+// running node holds gets of keys written before it, this counts them as cached from their first get on
+
+#include "access_log.h"
+#include "consistent_hash.h"
+#include "lru.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr uint64_t COLD = std::numeric_limits<uint64_t>::max();
+// replicated entries never expire during a replay, expiry isn't part of the trace
+constexpr int64_t NO_EXPIRY = 100LL * 365 * 24 * 3600;
+// scaled caches smaller than this give noisy results
+constexpr std::size_t MIN_SCALED_CAPACITY = 100;
+
+struct SimOptions {
+    // ring members, defaults to the nodes that wrote the logs
+    std::vector<std::string> nodes;
+    std::size_t vnodes = 52;
+    std::size_t replicas = 3;
+    // entries per node, what Node is built with
+    std::size_t capacity = 10000;
+    // per-node sizes of the miss ratio curve, empty for 1/8x to 8x the capacity
+    std::vector<std::size_t> sizes;
+    // replication factors compared, 1 up to this
+    std::size_t max_replicas = 5;
+    // resample at a lower rate than the logs were written with, 0 keeps it
+    double sample_rate = 0;
+    std::vector<std::string> paths;
+};
+
+// one access of the merged trace, keys interned
+struct Access {
+    int64_t time_us;
+    AccessOp op;
+    uint32_t key;
+    uint64_t bytes;
+};
+
+struct Trace {
+    std::vector<std::string> keys;
+    std::vector<Access> accesses;
+    double sample_rate = 0;
+    std::vector<std::string> nodes;
+    uint64_t malformed = 0;
+};
+
+std::vector<std::string> splitList(const std::string& value) {
+    std::vector<std::string> items;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+// merges the logs of all nodes in time order; throws on unreadable files and mismatched sample rates
+Trace loadTrace(const SimOptions& options) {
+    Trace trace;
+    std::unordered_map<std::string, uint32_t> index;
+    for (const auto& path : options.paths) {
+        std::ifstream in(path);
+        if (!in) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        std::string line;
+        AccessRecord record;
+        while (std::getline(in, line)) {
+            std::string node;
+            double rate;
+            if (AccessLog::parseHeader(line, node, rate)) {
+                if (trace.sample_rate > 0 && std::abs(rate - trace.sample_rate) > 1e-12) {
+                    throw std::runtime_error(path + " was sampled at " + std::to_string(rate) + ", other logs at " +
+                                             std::to_string(trace.sample_rate));
+                }
+                trace.sample_rate = rate;
+                if (std::find(trace.nodes.begin(), trace.nodes.end(), node) == trace.nodes.end()) {
+                    trace.nodes.push_back(node);
+                }
+                continue;
+            }
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            if (!AccessLog::parse(line, record)) {
+                ++trace.malformed;
+                continue;
+            }
+            auto it = index.find(record.key);
+            if (it == index.end()) {
+                it = index.emplace(record.key, static_cast<uint32_t>(trace.keys.size())).first;
+                trace.keys.push_back(record.key);
+            }
+            trace.accesses.push_back(Access{record.time_us, record.op, it->second, record.bytes});
+        }
+    }
+    if (trace.sample_rate <= 0) {
+        throw std::runtime_error("no access log header found");
+    }
+
+    if (options.sample_rate > 0) {
+        if (options.sample_rate > trace.sample_rate) {
+            throw std::runtime_error("cannot resample above the logged rate of " + std::to_string(trace.sample_rate));
+        }
+        // a lower rate keeps a subset of the logged keys, so the result is a valid sample of its own
+        uint64_t threshold = AccessLog::sampleThreshold(options.sample_rate);
+        std::vector<bool> keep(trace.keys.size());
+        for (std::size_t i = 0; i < trace.keys.size(); ++i) {
+            keep[i] = AccessLog::sampled(trace.keys[i], threshold);
+        }
+        trace.accesses.erase(std::remove_if(trace.accesses.begin(), trace.accesses.end(),
+                                            [&keep](const Access& access) { return !keep[access.key]; }),
+                             trace.accesses.end());
+        trace.sample_rate = options.sample_rate;
+    }
+    std::stable_sort(trace.accesses.begin(), trace.accesses.end(),
+                     [](const Access& a, const Access& b) { return a.time_us < b.time_us; });
+    return trace;
+}
+
+// Fenwick tree over access positions, one mark per key at its latest access
+class Fenwick {
+private:
+    std::vector<int64_t> tree_;
+
+public:
+    explicit Fenwick(std::size_t size) : tree_(size + 1, 0) {}
+
+    void add(std::size_t position, int64_t delta) {
+        for (std::size_t i = position + 1; i < tree_.size(); i += i & (~i + 1)) {
+            tree_[i] += delta;
+        }
+    }
+
+    // marks at positions [0, position)
+    int64_t prefix(std::size_t position) const {
+        int64_t sum = 0;
+        for (std::size_t i = position; i > 0; i -= i & (~i + 1)) {
+            sum += tree_[i];
+        }
+        return sum;
+    }
+};
+
+class Simulator {
+private:
+    const SimOptions& options_;
+    const Trace& trace_;
+    std::size_t max_rf_;
+    // owners_[key][i] is the index of the key's i-th replica in options_.nodes
+    std::vector<std::vector<uint16_t>> owners_;
+
+    double scale() const { return 1.0 / trace_.sample_rate; }
+
+    std::size_t scaledSize(std::size_t size) const {
+        return std::max<std::size_t>(1, static_cast<std::size_t>(std::llround(size * trace_.sample_rate)));
+    }
+
+    // Mattson's stack algorithm per node: for every get, the number of distinct keys the node saw since the
+    // key's last access, COLD for a first access or one after a remove. Gets go to the primary, puts and
+    // removes to every replica. A miss counts as an access, as if the client filled it right away
+    std::vector<uint64_t> reuseDistances(std::size_t rf) const {
+        std::size_t node_count = options_.nodes.size();
+        std::vector<std::size_t> lengths(node_count, 0);
+        for (const auto& access : trace_.accesses) {
+            const auto& owners = owners_[access.key];
+            std::size_t touched = access.op == AccessOp::GET ? 1 : std::min(rf, owners.size());
+            for (std::size_t i = 0; i < touched; ++i) {
+                ++lengths[owners[i]];
+            }
+        }
+
+        std::vector<Fenwick> marks;
+        std::vector<std::unordered_map<uint32_t, std::size_t>> last(node_count);
+        std::vector<std::size_t> next(node_count, 0);
+        for (std::size_t node = 0; node < node_count; ++node) {
+            marks.emplace_back(lengths[node]);
+        }
+
+        std::vector<uint64_t> distances;
+        for (const auto& access : trace_.accesses) {
+            const auto& owners = owners_[access.key];
+            std::size_t touched = access.op == AccessOp::GET ? 1 : std::min(rf, owners.size());
+            for (std::size_t i = 0; i < touched; ++i) {
+                std::size_t node = owners[i];
+                std::size_t position = next[node]++;
+                auto it = last[node].find(access.key);
+                if (access.op == AccessOp::GET) {
+                    distances.push_back(it == last[node].end()
+                        ? COLD
+                        : static_cast<uint64_t>(marks[node].prefix(position) - marks[node].prefix(it->second + 1)));
+                }
+                if (it != last[node].end()) {
+                    marks[node].add(it->second, -1);
+                }
+                if (access.op == AccessOp::REMOVE) {
+                    if (it != last[node].end()) {
+                        last[node].erase(it);
+                    }
+                    continue;
+                }
+                marks[node].add(position, 1);
+                last[node][access.key] = position;
+            }
+        }
+        std::sort(distances.begin(), distances.end());
+        return distances;
+    }
+
+    // share of gets missing a per-node LRU cache of size entries, from sorted reuse distances
+    double missRatio(const std::vector<uint64_t>& distances, std::size_t size) const {
+        if (distances.empty()) {
+            return 0;
+        }
+        // a hit needs fewer than size distinct keys in between, at the sampled scale
+        uint64_t scaled = scaledSize(size);
+        auto first_miss = std::lower_bound(distances.begin(), distances.end(), scaled);
+        return static_cast<double>(distances.end() - first_miss) / distances.size();
+    }
+
+    // the keys still cached at the end of the trace and their last known value size
+    std::unordered_map<uint32_t, uint64_t> workingSet() const {
+        std::unordered_map<uint32_t, uint64_t> live;
+        for (const auto& access : trace_.accesses) {
+            if (access.op == AccessOp::REMOVE) {
+                live.erase(access.key);
+            } else if (access.op == AccessOp::PUT || access.bytes > 0) {
+                live[access.key] = access.bytes;
+            }
+        }
+        return live;
+    }
+
+public:
+    Simulator(const SimOptions& options, const Trace& trace) : options_(options), trace_(trace) {
+        max_rf_ = std::min(std::max(options_.max_replicas, options_.replicas), options_.nodes.size());
+        ConsistentHash ring(options_.vnodes);
+        std::unordered_map<std::string, uint16_t> node_index;
+        for (std::size_t i = 0; i < options_.nodes.size(); ++i) {
+            ring.addNode(options_.nodes[i]);
+            node_index[options_.nodes[i]] = static_cast<uint16_t>(i);
+        }
+        owners_.reserve(trace_.keys.size());
+        for (const auto& key : trace_.keys) {
+            std::vector<uint16_t> owners;
+            for (const auto& node : ring.getNodes(key, max_rf_)) {
+                owners.push_back(node_index.at(node));
+            }
+            owners_.push_back(std::move(owners));
+        }
+    }
+
+    void reportSummary() const {
+        std::cout << trace_.accesses.size() << " sampled accesses to " << trace_.keys.size() << " keys at sample rate "
+                  << trace_.sample_rate << ", about " << std::llround(trace_.accesses.size() * scale())
+                  << " accesses in the full trace";
+        if (trace_.malformed > 0) {
+            std::cout << ", " << trace_.malformed << " malformed lines skipped";
+        }
+        std::cout << std::endl;
+        if (scaledSize(options_.capacity) < MIN_SCALED_CAPACITY) {
+            std::cout << "warning: a capacity of " << options_.capacity << " is only " << scaledSize(options_.capacity)
+                      << " entries at this sample rate, expect noisy hit ratios" << std::endl;
+        }
+        std::cout << std::endl;
+    }
+
+    // keys, reads and writes per node at the configured replication factor, and the hit ratio of the real
+    // LRUCache at the configured capacity
+    void reportNodes() const {
+        std::size_t node_count = options_.nodes.size();
+        std::size_t rf = std::min(options_.replicas, node_count);
+        std::vector<uint64_t> keys(node_count, 0);
+        std::vector<uint64_t> reads(node_count, 0);
+        std::vector<uint64_t> writes(node_count, 0);
+        std::vector<uint64_t> hits(node_count, 0);
+        std::vector<std::unique_ptr<LRUCache<std::string, std::string>>> caches;
+        for (std::size_t node = 0; node < node_count; ++node) {
+            caches.push_back(std::make_unique<LRUCache<std::string, std::string>>(scaledSize(options_.capacity)));
+        }
+        for (const auto& owners : owners_) {
+            ++keys[owners[0]];
+        }
+
+        std::string value;
+        for (const auto& access : trace_.accesses) {
+            const auto& owners = owners_[access.key];
+            const std::string& key = trace_.keys[access.key];
+            if (access.op == AccessOp::GET) {
+                ++reads[owners[0]];
+                if (caches[owners[0]]->get(key, value)) {
+                    ++hits[owners[0]];
+                } else {
+                    // filled on the primary, the same assumption as the miss ratio curve
+                    caches[owners[0]]->put(key, std::string(), NO_EXPIRY);
+                }
+                continue;
+            }
+            for (std::size_t i = 0; i < std::min(rf, owners.size()); ++i) {
+                ++writes[owners[i]];
+                if (access.op == AccessOp::PUT) {
+                    caches[owners[i]]->put(key, std::string(), NO_EXPIRY);
+                } else {
+                    caches[owners[i]]->remove(key);
+                }
+            }
+        }
+
+        std::cout << "Nodes: " << node_count << " on a ring of " << options_.vnodes << " virtual nodes each, replication factor "
+                  << rf << ", " << options_.capacity << " entries per node (estimates for the full trace)" << std::endl;
+        std::cout << "Hit ratios of the LRUCache replay, a get miss is filled on the primary" << std::endl;
+        std::cout << std::left << std::setw(28) << "node" << std::right << std::setw(12) << "keys" << std::setw(9) << "share"
+                  << std::setw(14) << "reads" << std::setw(14) << "writes" << std::setw(11) << "hit ratio" << std::endl;
+        uint64_t total_keys = 0;
+        uint64_t total_reads = 0;
+        uint64_t total_hits = 0;
+        for (std::size_t node = 0; node < node_count; ++node) {
+            total_keys += keys[node];
+            total_reads += reads[node];
+            total_hits += hits[node];
+        }
+        auto ratio = [](uint64_t part, uint64_t whole) { return whole > 0 ? static_cast<double>(part) / whole : 0.0; };
+        for (std::size_t node = 0; node < node_count; ++node) {
+            std::cout << std::left << std::setw(28) << options_.nodes[node] << std::right << std::fixed
+                      << std::setw(12) << std::llround(keys[node] * scale())
+                      << std::setw(8) << std::setprecision(1) << ratio(keys[node], total_keys) * 100 << "%"
+                      << std::setw(14) << std::llround(reads[node] * scale())
+                      << std::setw(14) << std::llround(writes[node] * scale())
+                      << std::setw(11) << std::setprecision(3) << ratio(hits[node], reads[node]) << std::endl;
+        }
+        // max over mean, 1.0 is a perfectly even spread
+        auto skew = [node_count](const std::vector<uint64_t>& counts) {
+            uint64_t sum = 0;
+            uint64_t max = 0;
+            for (uint64_t count : counts) {
+                sum += count;
+                max = std::max(max, count);
+            }
+            return sum > 0 ? static_cast<double>(max) * node_count / sum : 0.0;
+        };
+        std::cout << std::left << std::setw(28) << "skew (max/mean)" << std::right << std::setprecision(2)
+                  << std::setw(12) << skew(keys) << std::setw(9) << ""
+                  << std::setw(14) << skew(reads) << std::setw(14) << skew(writes)
+                  << std::setw(11) << std::setprecision(3) << ratio(total_hits, total_reads) << std::endl;
+        std::cout << std::endl;
+    }
+
+    void reportMissRatioCurve() const {
+        std::vector<std::size_t> sizes = options_.sizes;
+        if (sizes.empty()) {
+            for (double factor : {0.125, 0.25, 0.5, 1.0, 2.0, 4.0, 8.0}) {
+                sizes.push_back(std::max<std::size_t>(1, static_cast<std::size_t>(options_.capacity * factor)));
+            }
+        }
+        std::size_t rf = std::min(options_.replicas, options_.nodes.size());
+        auto distances = reuseDistances(rf);
+        std::cout << "Miss ratio curve, LRU with replication factor " << rf << " (entries per node), a get miss is filled on the primary:" << std::endl;
+        std::cout << std::right << std::setw(12) << "size" << std::setw(12) << "miss ratio" << std::endl;
+        for (std::size_t size : sizes) {
+            std::cout << std::setw(12) << size << std::setw(12) << std::fixed << std::setprecision(4) << missRatio(distances, size)
+                      << (size == options_.capacity ? "  <- capacity" : "") << std::endl;
+        }
+        std::cout << std::endl;
+    }
+
+    // entries and bytes every node has to hold for the working set, and the miss ratio at the configured
+    // capacity, per replication factor
+    void reportReplication() const {
+        auto live = workingSet();
+        uint64_t live_bytes = 0;
+        for (const auto& [key, bytes] : live) {
+            live_bytes += trace_.keys[key].size() + bytes;
+        }
+        std::size_t node_count = options_.nodes.size();
+        std::cout << "Replication factor vs memory, working set of " << std::llround(live.size() * scale()) << " keys and "
+                  << std::setprecision(1) << std::fixed << live_bytes * scale() / (1024 * 1024) << " MB of keys and values:" << std::endl;
+        std::cout << std::right << std::setw(4) << "rf" << std::setw(16) << "entries/node" << std::setw(12) << "max"
+                  << std::setw(12) << "MB/node" << std::setw(10) << "max" << std::setw(10) << "fits" << std::setw(12) << "miss ratio" << std::endl;
+
+        for (std::size_t rf = 1; rf <= max_rf_; ++rf) {
+            std::vector<uint64_t> entries(node_count, 0);
+            std::vector<uint64_t> bytes(node_count, 0);
+            for (const auto& [key, value_bytes] : live) {
+                const auto& owners = owners_[key];
+                for (std::size_t i = 0; i < std::min(rf, owners.size()); ++i) {
+                    ++entries[owners[i]];
+                    bytes[owners[i]] += trace_.keys[key].size() + value_bytes;
+                }
+            }
+            uint64_t total_entries = 0;
+            uint64_t max_entries = 0;
+            uint64_t total_bytes = 0;
+            uint64_t max_bytes = 0;
+            double fitting = 0;
+            for (std::size_t node = 0; node < node_count; ++node) {
+                total_entries += entries[node];
+                max_entries = std::max(max_entries, entries[node]);
+                total_bytes += bytes[node];
+                max_bytes = std::max(max_bytes, bytes[node]);
+                fitting += std::min<double>(entries[node] * scale(), options_.capacity);
+            }
+            double mb = 1024.0 * 1024.0;
+            std::cout << std::setw(4) << rf
+                      << std::setw(16) << std::llround(total_entries * scale() / node_count)
+                      << std::setw(12) << std::llround(max_entries * scale())
+                      << std::setw(12) << std::setprecision(1) << total_bytes * scale() / node_count / mb
+                      << std::setw(10) << max_bytes * scale() / mb
+                      << std::setw(9) << std::setprecision(1) << (total_entries > 0 ? fitting * 100 / (total_entries * scale()) : 100.0) << "%"
+                      << std::setw(12) << std::setprecision(4) << missRatio(reuseDistances(rf), options_.capacity) << std::endl;
+        }
+        std::cout << "fits: share of the working set the per-node capacity can hold" << std::endl;
+    }
+};
+
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] ACCESS_LOG..." << std::endl;
+    std::cerr << "  ACCESS_LOG              logs written by nodes started with --access-log, one per node" << std::endl;
+    std::cerr << "  --nodes=LIST            ring members to simulate (default: the nodes that wrote the logs)" << std::endl;
+    std::cerr << "  --node-count=N          simulate N nodes localhost:50051 and up instead" << std::endl;
+    std::cerr << "  --vnodes=N              virtual nodes per node (default: 52)" << std::endl;
+    std::cerr << "  --replicas=N            replication factor (default: 3)" << std::endl;
+    std::cerr << "  --capacity=N            cache entries per node (default: 10000)" << std::endl;
+    std::cerr << "  --sizes=LIST            per-node cache sizes of the miss ratio curve (default: 1/8 to 8 times the capacity)" << std::endl;
+    std::cerr << "  --max-replicas=N        compare replication factors up to N (default: 5)" << std::endl;
+    std::cerr << "  --sample=F              resample the logs at a lower rate, for faster runs" << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    SimOptions options;
+    std::size_t node_count = 0;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.rfind("--", 0) != 0) {
+                options.paths.push_back(arg);
+                continue;
+            }
+            std::size_t eq = arg.find('=');
+            std::string name = arg.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+            if (name == "--nodes") {
+                options.nodes = splitList(value);
+            } else if (name == "--node-count") {
+                node_count = std::stoull(value);
+            } else if (name == "--vnodes") {
+                options.vnodes = std::max<std::size_t>(1, std::stoull(value));
+            } else if (name == "--replicas") {
+                options.replicas = std::max<std::size_t>(1, std::stoull(value));
+            } else if (name == "--capacity") {
+                options.capacity = std::max<std::size_t>(1, std::stoull(value));
+            } else if (name == "--sizes") {
+                for (const auto& size : splitList(value)) {
+                    options.sizes.push_back(std::max<std::size_t>(1, std::stoull(size)));
+                }
+            } else if (name == "--max-replicas") {
+                options.max_replicas = std::max<std::size_t>(1, std::stoull(value));
+            } else if (name == "--sample") {
+                options.sample_rate = std::stod(value);
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Invalid option value: " << e.what() << std::endl;
+        return 1;
+    }
+    if (options.paths.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+    for (std::size_t i = 0; i < node_count; ++i) {
+        options.nodes.push_back("localhost:" + std::to_string(50051 + i));
+    }
+
+    Trace trace;
+    try {
+        trace = loadTrace(options);
+    } catch (const std::exception& e) {
+        std::cerr << "Cannot load the trace: " << e.what() << std::endl;
+        return 1;
+    }
+    if (options.nodes.empty()) {
+        options.nodes = trace.nodes;
+    }
+    if (options.nodes.empty() || options.nodes.size() > std::numeric_limits<uint16_t>::max()) {
+        std::cerr << "No nodes to simulate, pass --nodes or --node-count" << std::endl;
+        return 1;
+    }
+
+    Simulator simulator(options, trace);
+    simulator.reportSummary();
+    simulator.reportNodes();
+    simulator.reportMissRatioCurve();
+    simulator.reportReplication();
+    return 0;
+}
@@ -0,0 +1,196 @@
+#include "slab_allocator.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+namespace {
+
+std::size_t alignUp(std::size_t size, std::size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+}
+
+SlabAllocator::SlabAllocator(const SlabOptions& options) : options_(options) {
+    options_.page_size = alignUp(std::max<std::size_t>(options_.page_size, 4096), 4096);
+    if (options_.growth_factor <= 1.0) {
+        throw std::invalid_argument("slab growth factor must be above 1");
+    }
+    std::size_t page_count = options_.max_bytes / options_.page_size;
+    if (page_count == 0) {
+        throw std::invalid_argument("slab memory is smaller than one page");
+    }
+    region_size_ = page_count * options_.page_size;
+    // only reserved, a page costs memory once it is carved
+    void* region = mmap(nullptr, region_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+        throw std::runtime_error("failed to reserve slab memory");
+    }
+    region_ = static_cast<char*>(region);
+    pages_.resize(page_count);
+
+    // chunk sizes grow by the factor up to half a page, the last class takes a whole page
+    std::size_t size = alignUp(std::max<std::size_t>(options_.min_chunk_size, sizeof(void*)), CHUNK_ALIGNMENT);
+    while (size <= options_.page_size / 2) {
+        classes_.emplace_back(size, static_cast<uint32_t>(options_.page_size / size));
+        size = std::max(alignUp(static_cast<std::size_t>(size * options_.growth_factor), CHUNK_ALIGNMENT), size + CHUNK_ALIGNMENT);
+    }
+    classes_.emplace_back(options_.page_size, 1);
+}
+
+SlabAllocator::~SlabAllocator() {
+    munmap(region_, region_size_);
+}
+
+std::size_t SlabAllocator::classFor(std::size_t bytes) const {
+    auto it = std::lower_bound(classes_.begin(), classes_.end(), bytes,
+                               [](const SlabClass& slab_class, std::size_t size) { return slab_class.chunk_size < size; });
+    return static_cast<std::size_t>(it - classes_.begin());
+}
+
+bool SlabAllocator::assignPageLocked(std::size_t slab_class) {
+    uint32_t index;
+    if (!pool_.empty()) {
+        index = pool_.back();
+        pool_.pop_back();
+    } else if (carved_pages_ < pages_.size()) {
+        index = carved_pages_++;
+    } else {
+        return false;
+    }
+    Page& page = pages_[index];
+    if (page.last_class != NO_CLASS && page.last_class != slab_class) {
+        ++page_moves_;
+    }
+    page.slab_class = page.last_class = static_cast<uint32_t>(slab_class);
+    page.used = 0;
+    page.carved = 0;
+    page.free_list = nullptr;
+    page.available = true;
+    classes_[slab_class].pages++;
+    classes_[slab_class].available.push_back(index);
+    return true;
+}
+
+void SlabAllocator::releasePageLocked(uint32_t index) {
+    Page& page = pages_[index];
+    SlabClass& slab_class = classes_[page.slab_class];
+    if (page.available) {
+        auto it = std::find(slab_class.available.begin(), slab_class.available.end(), index);
+        *it = slab_class.available.back();
+        slab_class.available.pop_back();
+        page.available = false;
+    }
+    slab_class.pages--;
+    page.slab_class = NO_CLASS;
+    pool_.push_back(index);
+}
+
+void* SlabAllocator::do_allocate(std::size_t bytes, std::size_t alignment) {
+    if (alignment <= CHUNK_ALIGNMENT && bytes <= options_.page_size) {
+        std::size_t class_index = classFor(std::max<std::size_t>(bytes, 1));
+        SlabClass& slab_class = classes_[class_index];
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (!slab_class.available.empty() && !hasFreeChunk(pages_[slab_class.available.back()])) {
+            pages_[slab_class.available.back()].available = false;
+            slab_class.available.pop_back();
+        }
+        if (!slab_class.available.empty() || assignPageLocked(class_index)) {
+            uint32_t index = slab_class.available.back();
+            Page& page = pages_[index];
+            void* chunk;
+            if (page.free_list != nullptr) {
+                chunk = page.free_list;
+                page.free_list = *static_cast<void**>(chunk);
+            } else {
+                chunk = region_ + static_cast<std::size_t>(index) * options_.page_size + page.carved * slab_class.chunk_size;
+                page.carved++;
+            }
+            page.used++;
+            slab_class.used_chunks++;
+            slab_class.requested_bytes += bytes;
+            return chunk;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        heap_allocations_++;
+        heap_bytes_ += bytes;
+    }
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void SlabAllocator::do_deallocate(void* p, std::size_t bytes, std::size_t alignment) {
+    if (!owns(p)) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            heap_bytes_ -= bytes;
+        }
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+        return;
+    }
+    uint32_t index = static_cast<uint32_t>((static_cast<char*>(p) - region_) / options_.page_size);
+    std::lock_guard<std::mutex> lock(mutex_);
+    Page& page = pages_[index];
+    SlabClass& slab_class = classes_[page.slab_class];
+    *static_cast<void**>(p) = page.free_list;
+    page.free_list = p;
+    page.used--;
+    slab_class.used_chunks--;
+    slab_class.requested_bytes -= bytes;
+    if (page.used == 0) {
+        releasePageLocked(index);
+    } else if (!page.available) {
+        page.available = true;
+        slab_class.available.push_back(index);
+    }
+}
+
+SlabStats SlabAllocator::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    SlabStats stats;
+    stats.page_bytes = static_cast<uint64_t>(carved_pages_) * options_.page_size;
+    stats.pool_pages = pool_.size();
+    stats.page_moves = page_moves_;
+    stats.heap_allocations = heap_allocations_;
+    stats.heap_bytes = heap_bytes_;
+    for (const auto& slab_class : classes_) {
+        if (slab_class.pages == 0) {
+            continue;
+        }
+        uint64_t chunks = static_cast<uint64_t>(slab_class.pages) * slab_class.chunks_per_page;
+        stats.classes.push_back(SlabClassStats{slab_class.chunk_size, slab_class.pages, slab_class.used_chunks,
+                                               chunks - slab_class.used_chunks, slab_class.requested_bytes});
+        stats.used_bytes += slab_class.used_chunks * slab_class.chunk_size;
+        stats.requested_bytes += slab_class.requested_bytes;
+    }
+    return stats;
+}
+
+std::string SlabAllocator::report() {
+    SlabStats s = stats();
+    std::string out;
+    char line[160];
+    std::snprintf(line, sizeof(line), "page_bytes %llu pool_pages %zu used_bytes %llu requested_bytes %llu fragmentation %.3f\n",
+                  static_cast<unsigned long long>(s.page_bytes), s.pool_pages, static_cast<unsigned long long>(s.used_bytes),
+                  static_cast<unsigned long long>(s.requested_bytes), s.fragmentation());
+    out += line;
+    std::snprintf(line, sizeof(line), "page_moves %llu heap_allocations %llu heap_bytes %llu\n\n",
+                  static_cast<unsigned long long>(s.page_moves), static_cast<unsigned long long>(s.heap_allocations),
+                  static_cast<unsigned long long>(s.heap_bytes));
+    out += line;
+    std::snprintf(line, sizeof(line), "%10s %8s %12s %12s %14s %8s\n", "chunk", "pages", "used", "free", "requested", "waste");
+    out += line;
+    for (const auto& c : s.classes) {
+        uint64_t used_bytes = c.used_chunks * c.chunk_size;
+        double waste = used_bytes == 0 ? 0.0 : 1.0 - static_cast<double>(c.requested_bytes) / used_bytes;
+        std::snprintf(line, sizeof(line), "%10zu %8zu %12llu %12llu %14llu %8.3f\n", c.chunk_size, c.pages,
+                      static_cast<unsigned long long>(c.used_chunks), static_cast<unsigned long long>(c.free_chunks),
+                      static_cast<unsigned long long>(c.requested_bytes), waste);
+        out += line;
+    }
+    return out;
+}
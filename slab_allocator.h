@@ -0,0 +1,123 @@
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct SlabOptions {
+    // memory reserved for slab pages, 0 disables the allocator. Allocations that don't fit fall back to the heap
+    std::size_t max_bytes = 0;
+    std::size_t page_size = 1024 * 1024;
+    // chunk size ratio between neighbouring size classes
+    double growth_factor = 1.25;
+    std::size_t min_chunk_size = 48;
+};
+
+// one size class in stats()
+struct SlabClassStats {
+    std::size_t chunk_size;
+    std::size_t pages;
+    uint64_t used_chunks;
+    uint64_t free_chunks;
+    // bytes asked for by the chunks in use, the rest of used_chunks * chunk_size is lost to rounding up
+    uint64_t requested_bytes;
+};
+
+struct SlabStats {
+    // pages handed out to classes plus the empty ones in the pool
+    uint64_t page_bytes = 0;
+    std::size_t pool_pages = 0;
+    uint64_t used_bytes = 0;
+    uint64_t requested_bytes = 0;
+    // pages that changed size class
+    uint64_t page_moves = 0;
+    // allocations too big for a page, or made while all pages were taken
+    uint64_t heap_allocations = 0;
+    uint64_t heap_bytes = 0;
+    std::vector<SlabClassStats> classes;
+
+    // share of the page memory not holding requested bytes: rounding up to the chunk size plus free chunks
+    double fragmentation() const { return page_bytes == 0 ? 0.0 : 1.0 - static_cast<double>(requested_bytes) / page_bytes; }
+};
+
+// memcached-style allocator for the cache's entries. One region of max_bytes is reserved up front and carved
+// into pages as needed; each page belongs to a size class and is split into equal chunks, so an allocation is
+// a free list pop and freeing never leaves holes the general-purpose allocator has to coalesce. A page whose
+// last chunk is freed goes back to a shared pool, which is how pages move to the classes that need them. RSS
+// stays bounded by the pages ever carved.
+// Thread safe, though the cache only allocates under its own lock, so the mutex is uncontended
+class SlabAllocator : public std::pmr::memory_resource {
+private:
+    static constexpr std::size_t CHUNK_ALIGNMENT = 16;
+    static constexpr uint32_t NO_CLASS = UINT32_MAX;
+
+    struct Page {
+        uint32_t slab_class = NO_CLASS;
+        // class the page last belonged to, to count moves
+        uint32_t last_class = NO_CLASS;
+        uint32_t used = 0;
+        // chunks past this one were never handed out since the page joined its class
+        uint32_t carved = 0;
+        // freed chunks, linked through their first bytes
+        void* free_list = nullptr;
+        // in its class's available list
+        bool available = false;
+    };
+
+    struct SlabClass {
+        SlabClass(std::size_t chunk_size, uint32_t chunks_per_page) : chunk_size(chunk_size), chunks_per_page(chunks_per_page) {}
+
+        std::size_t chunk_size;
+        uint32_t chunks_per_page;
+        std::size_t pages = 0;
+        uint64_t used_chunks = 0;
+        uint64_t requested_bytes = 0;
+        // pages that may have a free chunk; full ones are dropped when found at the back
+        std::vector<uint32_t> available;
+    };
+
+    SlabOptions options_;
+    char* region_ = nullptr;
+    std::size_t region_size_ = 0;
+
+    std::mutex mutex_;
+    std::vector<Page> pages_;
+    std::vector<SlabClass> classes_;
+    // pages carved from the region so far; the rest of the region was never touched
+    uint32_t carved_pages_ = 0;
+    std::vector<uint32_t> pool_;
+    uint64_t page_moves_ = 0;
+    uint64_t heap_allocations_ = 0;
+    uint64_t heap_bytes_ = 0;
+
+    std::size_t classFor(std::size_t bytes) const;
+    bool owns(const void* p) const { return p >= region_ && p < region_ + region_size_; }
+    bool hasFreeChunk(const Page& page) const {
+        return page.free_list != nullptr || page.carved < classes_[page.slab_class].chunks_per_page;
+    }
+    // give the class a page from the pool or a fresh one from the region, false if there is none left
+    bool assignPageLocked(std::size_t slab_class);
+    void releasePageLocked(uint32_t index);
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+public:
+    // reserves the region, throws std::runtime_error if that fails
+    explicit SlabAllocator(const SlabOptions& options);
+    ~SlabAllocator() override;
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+    SlabStats stats();
+    // per-class table for /debug/slabs
+    std::string report();
+};
+
+#endif
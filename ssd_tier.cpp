@@ -0,0 +1,495 @@
+#include "ssd_tier.h"
+#include <boost/crc.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t RECORD_MAGIC = 0x54445343; // "CSDT"
+// wake the writer early once this many evictions are queued
+constexpr std::size_t FLUSH_BATCH = 1024;
+// evictions beyond this are not kept while the writer catches up
+constexpr std::size_t MAX_PENDING = 65536;
+
+int64_t nowMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int64_t wallClockExpiryMillis(std::chrono::steady_clock::time_point expiry) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(expiry - std::chrono::steady_clock::now());
+    return nowMillis() + remaining.count();
+}
+
+bool preadAll(int fd, char* data, std::size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t done = ::pread(fd, data, length, offset);
+        if (done <= 0) {
+            if (done < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += done;
+        length -= done;
+        offset += done;
+    }
+    return true;
+}
+
+bool pwriteAll(int fd, const char* data, std::size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t done = ::pwrite(fd, data, length, offset);
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += done;
+        length -= done;
+        offset += done;
+    }
+    return true;
+}
+
+}
+
+SsdTier::SegmentFile::~SegmentFile() {
+    ::close(fd);
+}
+
+SsdTier::SsdTier(const SsdTierOptions& options)
+    : options_(options) {
+    // locations store 32-bit offsets
+    options_.segment_size = std::min<std::size_t>(options_.segment_size, UINT32_MAX);
+
+    std::error_code error;
+    std::filesystem::create_directories(options_.path, error);
+    if (error) {
+        throw std::runtime_error("Failed to create SSD tier directory " + options_.path + ": " + error.message());
+    }
+    // whatever a previous run left is not trusted, memory and the WAL were rebuilt without it
+    for (const auto& file : std::filesystem::directory_iterator(options_.path)) {
+        if (file.path().filename().string().rfind("segment-", 0) == 0) {
+            std::filesystem::remove(file.path(), error);
+        }
+    }
+    if (!openSegment(1)) {
+        throw std::runtime_error("Failed to open SSD tier segment in " + options_.path);
+    }
+}
+
+SsdTier::~SsdTier() {
+    stop();
+    for (const auto& [id, segment] : segments_) {
+        ::unlink(segment.file->path.c_str());
+    }
+}
+
+void SsdTier::start() {
+    running_ = true;
+    writer_thread_ = std::thread(&SsdTier::writerLoop, this);
+}
+
+void SsdTier::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_one();
+    if (writer_thread_.joinable()) {
+        writer_thread_.join();
+    }
+}
+
+std::string SsdTier::segmentPath(uint32_t segment) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "segment-%08u.dat", segment);
+    return (std::filesystem::path(options_.path) / name).string();
+}
+
+uint32_t SsdTier::checksum(const RecordHeader& header, const char* key, const char* value) {
+    boost::crc_32_type result;
+    const char* fields = reinterpret_cast<const char*>(&header.version);
+    result.process_bytes(fields, sizeof(RecordHeader) - offsetof(RecordHeader, version));
+    result.process_bytes(key, header.key_length);
+    result.process_bytes(value, header.value_length);
+    return result.checksum();
+}
+
+void SsdTier::appendRecord(std::string& buffer, const std::string& key, const PendingEntry& entry) {
+    RecordHeader header{};
+    header.magic = RECORD_MAGIC;
+    header.version = entry.version;
+    header.expiry_ms = entry.expiry_ms;
+    header.key_length = static_cast<uint32_t>(key.size());
+    header.value_length = static_cast<uint32_t>(entry.value.size());
+    header.checksum = checksum(header, key.data(), entry.value.data());
+    buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    buffer.append(key);
+    buffer.append(entry.value);
+}
+
+void SsdTier::onCacheEvent(CacheEvent event, std::string_view key, std::string_view value, uint64_t version,
+                           std::chrono::steady_clock::time_point expiry) {
+    if (event == CacheEvent::REPLACED) {
+        // the INSERTED that follows covers it
+        return;
+    }
+    std::string stored_key(key);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (event != CacheEvent::EVICTED) {
+        dropLocked(stored_key);
+        return;
+    }
+    if (pending_.size() >= MAX_PENDING || sizeof(RecordHeader) + key.size() + value.size() > options_.segment_size) {
+        return;
+    }
+    pending_[stored_key] = PendingEntry{std::string(value), version, wallClockExpiryMillis(expiry)};
+    if (pending_.size() >= FLUSH_BATCH) {
+        cv_.notify_one();
+    }
+}
+
+void SsdTier::dropLocked(const std::string& key) {
+    pending_.erase(key);
+    if (flushing_.count(key)) {
+        dropped_.insert(key);
+    }
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        unindexLocked(it);
+    }
+}
+
+void SsdTier::drop(const std::string& key, uint64_t version) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // only the newest copy counts, the way take() picks it
+    uint64_t newest = 0;
+    bool found = false;
+    auto pending = pending_.find(key);
+    if (pending != pending_.end()) {
+        newest = pending->second.version;
+        found = true;
+    } else if (!dropped_.count(key) && flushing_.count(key)) {
+        newest = flushing_.at(key).version;
+        found = true;
+    } else {
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            newest = it->second.version;
+            found = true;
+        }
+    }
+    if (found && newest < version) {
+        dropLocked(key);
+    }
+}
+
+void SsdTier::unindexLocked(std::unordered_map<std::string, Location>::iterator it) {
+    auto segment = segments_.find(it->second.segment);
+    if (segment != segments_.end()) {
+        segment->second.live_bytes -= it->second.length;
+    }
+    index_.erase(it);
+}
+
+bool SsdTier::take(const std::string& key, std::string& value, uint64_t& version, int64_t& ttl_remaining) {
+    int64_t now = nowMillis();
+    int64_t expiry_ms;
+    Location location;
+    std::shared_ptr<SegmentFile> file;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // newest copy first: queued, then being written, then on disk
+        const PendingEntry* queued = nullptr;
+        auto pending = pending_.find(key);
+        if (pending != pending_.end()) {
+            queued = &pending->second;
+        } else if (!dropped_.count(key)) {
+            auto flushing = flushing_.find(key);
+            if (flushing != flushing_.end()) {
+                queued = &flushing->second;
+            }
+        }
+        if (queued) {
+            bool live = queued->expiry_ms > now;
+            if (live) {
+                value = queued->value;
+                version = queued->version;
+                expiry_ms = queued->expiry_ms;
+            }
+            dropLocked(key);
+            if (!live) {
+                misses_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            ttl_remaining = (expiry_ms - now + 999) / 1000;
+            return true;
+        }
+
+        auto it = index_.find(key);
+        if (it == index_.end() || it->second.expiry_ms <= now) {
+            if (it != index_.end()) {
+                unindexLocked(it);
+            }
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        location = it->second;
+        file = segments_.at(location.segment).file;
+        unindexLocked(it);
+    }
+
+    // read outside the lock, the shared file stays open even if GC drops the segment meanwhile
+    std::string record(location.length, '\0');
+    RecordHeader header;
+    bool valid = preadAll(file->fd, record.data(), record.size(), location.offset);
+    if (valid) {
+        std::memcpy(&header, record.data(), sizeof(header));
+        const char* stored_key = record.data() + sizeof(header);
+        valid = header.magic == RECORD_MAGIC
+            && sizeof(header) + header.key_length + header.value_length == record.size()
+            && header.checksum == checksum(header, stored_key, stored_key + header.key_length)
+            && record.compare(sizeof(header), header.key_length, key) == 0;
+    }
+    if (!valid) {
+        std::cerr << "SSD tier: unreadable record for a key in " << file->path << std::endl;
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    value = record.substr(sizeof(header) + header.key_length);
+    version = header.version;
+    ttl_remaining = (header.expiry_ms - now + 999) / 1000;
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool SsdTier::openSegment(uint32_t segment) {
+    std::string path = segmentPath(segment);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        std::cerr << "Failed to open SSD tier segment " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    segments_[segment].file = std::make_shared<SegmentFile>(fd, path);
+    active_segment_ = segment;
+    return true;
+}
+
+bool SsdTier::appendBatch(const std::string& buffer, const std::vector<uint32_t>& record_sizes, std::vector<Location>& locations) {
+    locations.clear();
+    std::size_t position = 0;
+    std::size_t i = 0;
+    while (i < record_sizes.size()) {
+        // only the writer thread changes segments_, so reading it here needs no lock
+        Segment& active = segments_.at(active_segment_);
+        if (active.size > 0 && active.size + record_sizes[i] > options_.segment_size) {
+            if (!openSegment(active_segment_ + 1)) {
+                return false;
+            }
+            continue;
+        }
+        // a record never spans two segments
+        uint64_t start = active.size;
+        std::size_t chunk = 0;
+        while (i < record_sizes.size() && (chunk == 0 || start + chunk + record_sizes[i] <= options_.segment_size)) {
+            locations.push_back(Location{active_segment_, static_cast<uint32_t>(start + chunk), record_sizes[i], 0, 0});
+            chunk += record_sizes[i];
+            ++i;
+        }
+        if (!pwriteAll(active.file->fd, buffer.data() + position, chunk, static_cast<off_t>(start))) {
+            std::cerr << "Failed to write SSD tier segment " << active.file->path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            active.size += chunk;
+            total_bytes_ += chunk;
+        }
+        position += chunk;
+    }
+    return true;
+}
+
+void SsdTier::flushPending() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.empty()) {
+            return;
+        }
+        flushing_.swap(pending_);
+    }
+
+    // flushing_ is only read until the lock is taken again, readers only read it too
+    int64_t now = nowMillis();
+    std::string buffer;
+    std::vector<const std::string*> keys;
+    std::vector<uint32_t> record_sizes;
+    for (const auto& [key, entry] : flushing_) {
+        if (entry.expiry_ms <= now) {
+            continue;
+        }
+        std::size_t before = buffer.size();
+        appendRecord(buffer, key, entry);
+        keys.push_back(&key);
+        record_sizes.push_back(static_cast<uint32_t>(buffer.size() - before));
+    }
+    std::vector<Location> locations;
+    bool written = appendBatch(buffer, record_sizes, locations);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // a failed write loses the batch, which only costs the misses it would have saved
+    for (std::size_t i = 0; written && i < keys.size(); ++i) {
+        const std::string& key = *keys[i];
+        if (dropped_.count(key)) {
+            continue;
+        }
+        auto existing = index_.find(key);
+        if (existing != index_.end()) {
+            unindexLocked(existing);
+        }
+        Location location = locations[i];
+        location.expiry_ms = flushing_.at(key).expiry_ms;
+        location.version = flushing_.at(key).version;
+        segments_.at(location.segment).live_bytes += location.length;
+        index_.emplace(key, location);
+    }
+    flushing_.clear();
+    dropped_.clear();
+    enforceSizeLocked();
+}
+
+void SsdTier::enforceSizeLocked() {
+    while (total_bytes_ > options_.max_bytes && segments_.size() > 1) {
+        auto oldest = segments_.begin();
+        if (oldest->first == active_segment_) {
+            break;
+        }
+        uint32_t id = oldest->first;
+        for (auto it = index_.begin(); it != index_.end();) {
+            it = it->second.segment == id ? index_.erase(it) : std::next(it);
+        }
+        ::unlink(oldest->second.file->path.c_str());
+        total_bytes_ -= oldest->second.size;
+        segments_.erase(oldest);
+    }
+}
+
+bool SsdTier::collectGarbage() {
+    uint32_t victim = 0;
+    std::shared_ptr<SegmentFile> file;
+    std::vector<std::pair<std::string, Location>> live;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // expired records are dead bytes whether or not anyone asked for them
+        int64_t now = nowMillis();
+        for (auto it = index_.begin(); it != index_.end();) {
+            if (it->second.expiry_ms <= now) {
+                segments_.at(it->second.segment).live_bytes -= it->second.length;
+                it = index_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        double lowest = options_.gc_live_ratio;
+        for (const auto& [id, segment] : segments_) {
+            if (id == active_segment_ || segment.size == 0) {
+                continue;
+            }
+            double ratio = static_cast<double>(segment.live_bytes) / segment.size;
+            if (ratio < lowest) {
+                lowest = ratio;
+                victim = id;
+            }
+        }
+        if (victim == 0) {
+            return false;
+        }
+        file = segments_.at(victim).file;
+        for (const auto& [key, location] : index_) {
+            if (location.segment == victim) {
+                live.emplace_back(key, location);
+            }
+        }
+    }
+
+    // copy the live records unchanged to the head of the log
+    std::string buffer;
+    std::vector<uint32_t> record_sizes;
+    std::vector<std::pair<std::string, Location>> copied;
+    for (auto& [key, location] : live) {
+        std::size_t before = buffer.size();
+        buffer.resize(before + location.length);
+        if (preadAll(file->fd, buffer.data() + before, location.length, location.offset)) {
+            record_sizes.push_back(location.length);
+            copied.emplace_back(std::move(key), location);
+        } else {
+            buffer.resize(before);
+        }
+    }
+    std::vector<Location> locations;
+    bool written = appendBatch(buffer, record_sizes, locations);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::size_t i = 0; written && i < copied.size(); ++i) {
+        auto it = index_.find(copied[i].first);
+        // skip keys taken or rewritten while the copy was running
+        if (it == index_.end() || it->second.segment != victim || it->second.offset != copied[i].second.offset) {
+            continue;
+        }
+        Location location = locations[i];
+        location.expiry_ms = it->second.expiry_ms;
+        location.version = it->second.version;
+        it->second = location;
+        segments_.at(location.segment).live_bytes += location.length;
+    }
+    // whatever still points at the victim could not be copied and is lost
+    for (auto it = index_.begin(); it != index_.end();) {
+        it = it->second.segment == victim ? index_.erase(it) : std::next(it);
+    }
+    auto segment = segments_.find(victim);
+    ::unlink(segment->second.file->path.c_str());
+    total_bytes_ -= segment->second.size;
+    segments_.erase(segment);
+    collected_segments_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void SsdTier::writerLoop() {
+    auto next_gc = std::chrono::steady_clock::now() + options_.gc_interval;
+    while (running_) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait_for(lock, std::chrono::milliseconds(100), [this] { return !running_ || pending_.size() >= FLUSH_BATCH; });
+        }
+        flushPending();
+        if (std::chrono::steady_clock::now() >= next_gc) {
+            // one segment at a time, picking up the evictions queued meanwhile in between
+            while (running_ && collectGarbage()) {
+                flushPending();
+            }
+            next_gc = std::chrono::steady_clock::now() + options_.gc_interval;
+        }
+    }
+}
+
+std::size_t SsdTier::entries() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_.size() + pending_.size();
+}
+
+uint64_t SsdTier::bytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return total_bytes_;
+}
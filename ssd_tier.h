@@ -0,0 +1,145 @@
+#ifndef SSD_TIER_H
+#define SSD_TIER_H
+
+#include "lru.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct SsdTierOptions {
+    // directory for the segment files, wiped on startup
+    std::string path;
+    // total size of the segments, the oldest segment is dropped beyond it
+    uint64_t max_bytes = 10ULL * 1024 * 1024 * 1024;
+    std::size_t segment_size = 64 * 1024 * 1024;
+    // sealed segments with less than this share of live bytes are compacted
+    double gc_live_ratio = 0.5;
+    std::chrono::seconds gc_interval{10};
+};
+
+// second cache level on local disk. Entries evicted from memory are appended to log-structured segment files by a
+// background thread; an in-memory index maps each key to its record. A memory miss takes the entry back out of the
+// tier so it can be promoted. Writes, removals and expirations in memory drop the key here, so the tier never holds
+// a copy older than memory. The contents don't survive a restart, the WAL stays the source of truth
+class SsdTier {
+private:
+    struct RecordHeader {
+        uint32_t magic;
+        // crc32 over the rest of the header, the key and the value
+        uint32_t checksum;
+        uint64_t version;
+        // wall clock, like everything that ends up on disk
+        int64_t expiry_ms;
+        uint32_t key_length;
+        uint32_t value_length;
+    };
+
+    // where a key's record lives, kept small since there is one per entry on disk
+    struct Location {
+        uint32_t segment;
+        uint32_t offset;
+        uint32_t length;
+        int64_t expiry_ms;
+        uint64_t version;
+    };
+
+    // closes the file once GC dropped the segment and the last reader is done with it
+    struct SegmentFile {
+        int fd;
+        std::string path;
+        explicit SegmentFile(int file, std::string file_path) : fd(file), path(std::move(file_path)) {}
+        ~SegmentFile();
+    };
+
+    struct Segment {
+        std::shared_ptr<SegmentFile> file;
+        uint64_t size = 0;
+        uint64_t live_bytes = 0;
+    };
+
+    struct PendingEntry {
+        std::string value;
+        uint64_t version;
+        int64_t expiry_ms;
+    };
+
+    SsdTierOptions options_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    // evicted entries waiting for the writer thread
+    std::unordered_map<std::string, PendingEntry> pending_;
+    // the batch being written, not modified until the write is done; keys dropped meanwhile go to dropped_
+    std::unordered_map<std::string, PendingEntry> flushing_;
+    std::unordered_set<std::string> dropped_;
+    std::unordered_map<std::string, Location> index_;
+    std::map<uint32_t, Segment> segments_;
+    uint32_t active_segment_ = 0;
+    uint64_t total_bytes_ = 0;
+
+    std::atomic<bool> running_{false};
+    std::thread writer_thread_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> collected_segments_{0};
+
+    std::string segmentPath(uint32_t segment) const;
+    static uint32_t checksum(const RecordHeader& header, const char* key, const char* value);
+    static void appendRecord(std::string& buffer, const std::string& key, const PendingEntry& entry);
+
+    void writerLoop();
+    // append a batch to the active segment, starting a new one when it is full; the locations of the records
+    // in the batch come back in order. Only called from the writer thread
+    bool appendBatch(const std::string& buffer, const std::vector<uint32_t>& record_sizes, std::vector<Location>& locations);
+    bool openSegment(uint32_t segment);
+    void flushPending();
+    // drop expired keys from the index and rewrite the emptiest sealed segment, if it is empty enough.
+    // false if no segment qualified
+    bool collectGarbage();
+    // the oldest segments go when the tier is over max_bytes, caller must hold mutex_
+    void enforceSizeLocked();
+    void unindexLocked(std::unordered_map<std::string, Location>::iterator it);
+    void dropLocked(const std::string& key);
+
+public:
+    explicit SsdTier(const SsdTierOptions& options);
+    ~SsdTier();
+    SsdTier(const SsdTier&) = delete;
+    SsdTier& operator=(const SsdTier&) = delete;
+
+    void start();
+    void stop();
+
+    // cache listener hook, runs under the cache lock: evictions are queued, anything that changes the key in
+    // memory drops the stale copy here
+    void onCacheEvent(CacheEvent event, std::string_view key, std::string_view value, uint64_t version,
+                      std::chrono::steady_clock::time_point expiry);
+
+    // drop the key's copy unless it is at least as new as version. For removes of keys memory no longer holds,
+    // which fire no cache event when tombstones are off
+    void drop(const std::string& key, uint64_t version);
+
+    // removes the key from the tier and returns it if a live copy was there, ttl in whole seconds rounded up
+    bool take(const std::string& key, std::string& value, uint64_t& version, int64_t& ttl_remaining);
+
+    std::size_t entries();
+    uint64_t bytes();
+    uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+    uint64_t collectedSegments() const { return collected_segments_.load(std::memory_order_relaxed); }
+};
+
+#endif
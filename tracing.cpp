@@ -0,0 +1,198 @@
+#include "tracing.h"
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <sstream>
+
+namespace {
+
+const char* TRACE_ID_HEADER = "x-cachemesh-trace-id";
+const char* TRACE_SAMPLED_HEADER = "x-cachemesh-trace-sampled";
+
+std::mt19937_64& threadRng() {
+    thread_local std::mt19937_64 rng(std::random_device{}());
+    return rng;
+}
+
+int64_t microsSince(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::ostringstream out;
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c < 0x20) {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+        } else {
+            out << c;
+        }
+    }
+    return out.str();
+}
+
+}
+
+RequestTrace::RequestTrace(uint64_t trace_id, bool sampled, const std::string& node, const std::string& method, const std::string& key)
+    : start_(std::chrono::steady_clock::now()) {
+    record_.trace_id = trace_id;
+    record_.sampled = sampled;
+    record_.node = node;
+    record_.method = method;
+    record_.key = key;
+    record_.start_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void RequestTrace::addSpan(const std::string& name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    record_.spans.push_back(TraceSpan{name, microsSince(start_, start), microsSince(start, end)});
+}
+
+RequestTrace::Phase::Phase(RequestTrace* trace, std::string name)
+    : trace_(trace) {
+    if (trace_) {
+        name_ = std::move(name);
+        start_ = std::chrono::steady_clock::now();
+    }
+}
+
+RequestTrace::Phase::~Phase() {
+    if (trace_) {
+        trace_->addSpan(name_, start_, std::chrono::steady_clock::now());
+    }
+}
+
+Tracer::Tracer(const std::string& node, const TracingOptions& options)
+    : node_(node)
+    , options_(options) {}
+
+std::shared_ptr<RequestTrace> Tracer::begin(const grpc::ServerContext* context, const std::string& method, const std::string& key) {
+    uint64_t trace_id = 0;
+    bool sampled = false;
+    if (context) {
+        const auto& metadata = context->client_metadata();
+        auto id = metadata.find(TRACE_ID_HEADER);
+        if (id != metadata.end()) {
+            trace_id = std::strtoull(std::string(id->second.data(), id->second.size()).c_str(), nullptr, 16);
+        }
+        auto flag = metadata.find(TRACE_SAMPLED_HEADER);
+        sampled = flag != metadata.end() && flag->second == "1";
+    }
+
+    if (!sampled && options_.sample_rate > 0) {
+        sampled = std::uniform_real_distribution<double>(0.0, 1.0)(threadRng()) < options_.sample_rate;
+    }
+    // without the slow log only sampled requests are worth the bookkeeping
+    if (!sampled && options_.slow_threshold.count() == 0) {
+        return nullptr;
+    }
+    if (trace_id == 0) {
+        trace_id = threadRng()() | 1;
+    }
+    return std::make_shared<RequestTrace>(trace_id, sampled, node_, method, key);
+}
+
+void Tracer::finish(const std::shared_ptr<RequestTrace>& trace) {
+    auto duration = std::chrono::steady_clock::now() - trace->start_;
+    TraceRecord record;
+    {
+        std::lock_guard<std::mutex> lock(trace->mutex_);
+        trace->record_.duration_us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        trace->record_.slow = options_.slow_threshold.count() > 0 && duration >= options_.slow_threshold;
+        if (!trace->record_.sampled && !trace->record_.slow) {
+            return;
+        }
+        record = trace->record_;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (record.slow) {
+        push(slow_log_, slow_next_, options_.slow_log_capacity, record);
+    }
+    if (record.sampled) {
+        push(sampled_, sampled_next_, options_.sampled_capacity, record);
+    }
+}
+
+void Tracer::push(std::vector<TraceRecord>& ring, std::size_t& next, std::size_t capacity, const TraceRecord& record) {
+    if (capacity == 0) {
+        return;
+    }
+    if (ring.size() < capacity) {
+        ring.push_back(record);
+    } else {
+        ring[next] = record;
+    }
+    next = (next + 1) % capacity;
+}
+
+void Tracer::inject(grpc::ClientContext& context, const RequestTrace* trace) {
+    if (!trace) {
+        return;
+    }
+    std::ostringstream id;
+    id << std::hex << trace->traceId();
+    context.AddMetadata(TRACE_ID_HEADER, id.str());
+    context.AddMetadata(TRACE_SAMPLED_HEADER, trace->sampled() ? "1" : "0");
+}
+
+std::vector<TraceRecord> Tracer::ordered(const std::vector<TraceRecord>& ring, std::size_t next, std::size_t capacity) {
+    // until the ring wraps, insertion order is index order
+    if (ring.size() < capacity) {
+        return ring;
+    }
+    std::vector<TraceRecord> records(ring.begin() + next, ring.end());
+    records.insert(records.end(), ring.begin(), ring.begin() + next);
+    return records;
+}
+
+std::vector<TraceRecord> Tracer::slowLog() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ordered(slow_log_, slow_next_, options_.slow_log_capacity);
+}
+
+std::vector<TraceRecord> Tracer::sampledTraces() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ordered(sampled_, sampled_next_, options_.sampled_capacity);
+}
+
+std::string Tracer::chromeTraceJson(const std::vector<TraceRecord>& records) {
+    // one process per node, one thread row per request so overlapping requests don't stack
+    std::map<std::string, int> pids;
+    std::ostringstream out;
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    auto separator = [&first]() {
+        const char* text = first ? "\n" : ",\n";
+        first = false;
+        return text;
+    };
+
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        const TraceRecord& record = records[i];
+        auto [it, inserted] = pids.emplace(record.node, static_cast<int>(pids.size()) + 1);
+        int pid = it->second;
+        if (inserted) {
+            out << separator() << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << pid
+                << ", \"args\": {\"name\": \"" << jsonEscape(record.node) << "\"}}";
+        }
+        std::size_t tid = i + 1;
+        std::ostringstream trace_id;
+        trace_id << std::hex << record.trace_id;
+        out << separator() << "{\"name\": \"" << jsonEscape(record.method) << "\", \"cat\": \"request\", \"ph\": \"X\""
+            << ", \"ts\": " << record.start_us << ", \"dur\": " << record.duration_us
+            << ", \"pid\": " << pid << ", \"tid\": " << tid
+            << ", \"args\": {\"trace_id\": \"" << trace_id.str() << "\", \"key\": \"" << jsonEscape(record.key)
+            << "\", \"slow\": " << (record.slow ? "true" : "false") << "}}";
+        for (const auto& span : record.spans) {
+            out << separator() << "{\"name\": \"" << jsonEscape(span.name) << "\", \"cat\": \"phase\", \"ph\": \"X\""
+                << ", \"ts\": " << record.start_us + span.offset_us << ", \"dur\": " << span.duration_us
+                << ", \"pid\": " << pid << ", \"tid\": " << tid << "}";
+        }
+    }
+    out << "\n]}\n";
+    return out.str();
+}
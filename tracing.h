@@ -0,0 +1,133 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include "grpcpp/grpcpp.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct TracingOptions {
+    // fraction of requests whose phases are kept for export, 0 disables sampling
+    double sample_rate = 0;
+    // requests slower than this go to the slow log, 0 disables it
+    std::chrono::microseconds slow_threshold{0};
+    std::size_t slow_log_capacity = 256;
+    std::size_t sampled_capacity = 1024;
+};
+
+// one timed phase of a request, relative to the start of its trace
+struct TraceSpan {
+    std::string name;
+    int64_t offset_us;
+    int64_t duration_us;
+};
+
+// a finished request as kept in the slow log or the sample buffer
+struct TraceRecord {
+    uint64_t trace_id = 0;
+    std::string node;
+    std::string method;
+    std::string key;
+    // wall clock, so traces from different nodes line up
+    int64_t start_us = 0;
+    int64_t duration_us = 0;
+    bool sampled = false;
+    bool slow = false;
+    std::vector<TraceSpan> spans;
+};
+
+// phases of one request on this node. Replica writes record from their own threads, hence the lock
+class RequestTrace {
+private:
+    TraceRecord record_;
+    std::chrono::steady_clock::time_point start_;
+    std::mutex mutex_;
+
+    friend class Tracer;
+
+public:
+    RequestTrace(uint64_t trace_id, bool sampled, const std::string& node, const std::string& method, const std::string& key);
+
+    uint64_t traceId() const { return record_.trace_id; }
+    bool sampled() const { return record_.sampled; }
+
+    void addSpan(const std::string& name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+    // times the enclosing scope, does nothing without a trace
+    class Phase {
+    private:
+        RequestTrace* trace_;
+        std::string name_;
+        std::chrono::steady_clock::time_point start_;
+
+    public:
+        Phase(RequestTrace* trace, std::string name);
+        ~Phase();
+        Phase(const Phase&) = delete;
+        Phase& operator=(const Phase&) = delete;
+    };
+};
+
+// decides which requests are traced, carries trace ids across nodes in gRPC metadata and keeps
+// the slow log and the sampled traces in fixed-size rings
+class Tracer {
+private:
+    std::string node_;
+    TracingOptions options_;
+
+    std::mutex mutex_;
+    std::vector<TraceRecord> slow_log_;
+    std::size_t slow_next_ = 0;
+    std::vector<TraceRecord> sampled_;
+    std::size_t sampled_next_ = 0;
+
+    static void push(std::vector<TraceRecord>& ring, std::size_t& next, std::size_t capacity, const TraceRecord& record);
+    static std::vector<TraceRecord> ordered(const std::vector<TraceRecord>& ring, std::size_t next, std::size_t capacity);
+
+public:
+    Tracer(const std::string& node, const TracingOptions& options);
+
+    bool enabled() const { return options_.sample_rate > 0 || options_.slow_threshold.count() > 0; }
+
+    // null if the request is not traced; a trace id in the incoming metadata is kept, and a sampled caller forces sampling
+    std::shared_ptr<RequestTrace> begin(const grpc::ServerContext* context, const std::string& method, const std::string& key);
+    void finish(const std::shared_ptr<RequestTrace>& trace);
+
+    // pass the trace on to a peer
+    static void inject(grpc::ClientContext& context, const RequestTrace* trace);
+
+    // oldest first
+    std::vector<TraceRecord> slowLog();
+    std::vector<TraceRecord> sampledTraces();
+
+    // Chrome trace event format, loads in chrome://tracing or Perfetto
+    static std::string chromeTraceJson(const std::vector<TraceRecord>& records);
+};
+
+// begins a trace for an RPC and finishes it when the handler returns
+class ActiveTrace {
+private:
+    Tracer& tracer_;
+    std::shared_ptr<RequestTrace> trace_;
+
+public:
+    ActiveTrace(Tracer& tracer, const grpc::ServerContext* context, const std::string& method, const std::string& key)
+        : tracer_(tracer)
+        , trace_(tracer.enabled() ? tracer.begin(context, method, key) : nullptr) {}
+    ~ActiveTrace() {
+        if (trace_) {
+            tracer_.finish(trace_);
+        }
+    }
+    ActiveTrace(const ActiveTrace&) = delete;
+    ActiveTrace& operator=(const ActiveTrace&) = delete;
+
+    RequestTrace* get() const { return trace_.get(); }
+};
+
+#endif
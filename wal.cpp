@@ -1,77 +1,149 @@
 #include "wal.h"
 #include "wal.pb.h"
+#include "namespaces.h"
 #include <boost/crc.hpp> 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+WAL::WAL(const std::string& wal_dir, const std::string& node_id, const WALOptions& options)
+    : log_path_(segmentDirectory(wal_dir, node_id))
+    , options_(options)
+    , writer_(WALWriter::create(options.use_io_uring, options.queue_depth)) {
+    std::cout << "Opening WAL segments at: " << log_path_ << " (" << writer_->name() << ")" << std::endl;
+
+    std::error_code ec;
+    std::filesystem::create_directories(log_path_, ec);
+    if (ec) {
+        std::cerr << "Failed to create WAL directory: " << log_path_ << std::endl;
+        throw std::runtime_error("Failed to create WAL directory");
+    }
 
-WAL::WAL(const std::string& path) : log_path_(path) {
-    std::cout << "Opening WAL file at: " << path << std::endl;
-    log_file_.open(log_path_, std::ios::app | std::ios::binary);
-    if (!log_file_) {
-        std::cerr << "Failed to open WAL file: " << path << std::endl;
-        throw std::runtime_error("Failed to open WAL file");
+    // never append to an old segment, its logical end is only known to recovery
+    auto segments = listSegments(log_path_);
+    if (!segments.empty()) {
+        std::string name = std::filesystem::path(segments.back()).filename().string();
+        segment_index_ = std::stoull(name.substr(std::strlen("segment-")));
     }
-    std::cout << "WAL file opened successfully" << std::endl;
 
-};
+    if (!openNextSegment()) {
+        throw std::runtime_error("Failed to open WAL segment");
+    }
+    std::cout << "WAL segment opened successfully" << std::endl;
 
+};
 
-// bool WAL::logPut(const std::string& node_id, const std::string& key, const std::string& value, int64_t ttl) {   
-//     // create the log entry and write 
-//     LogEntry entry {
-//         .key = key,
-//         .value = value,
-//         .ttl = ttl,
-//         .sequence_number = ++sequence_number_,
-//         .op_type = OperationType::PUT,
-//         .timestamp = std::chrono::system_clock::now()
+WAL::~WAL() {
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    closeSegment();
+}
 
-//     };
-//     return writeEntry(node_id, entry);
+bool WAL::drain() {
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    return writer_->drain();
+}
 
-// }
+std::string WAL::segmentDirectory(const std::string& wal_dir, const std::string& node_id) {
+    // node ids are host:port, keep them readable but safe as a directory name
+    std::string dir_name = node_id;
+    std::replace_if(dir_name.begin(), dir_name.end(), [](char c) {
+        return !std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '.';
+    }, '_');
+    return (std::filesystem::path(wal_dir) / dir_name).string();
+}
 
-// bool WAL::logRemove(const std::string& node_id, const std::string& key) {
-//     LogEntry entry{
-//         .key = key,
-//         .timestamp = std::chrono::system_clock::now(),
-//         .op_type = OperationType::REMOVE,
-//         .sequence_number = ++sequence_number_
+std::vector<std::string> WAL::listSegments(const std::string& segment_dir) {
+    std::vector<std::string> segments;
+    std::error_code ec;
+    for (const auto& file : std::filesystem::directory_iterator(segment_dir, ec)) {
+        std::string name = file.path().filename().string();
+        if (name.rfind("segment-", 0) == 0 && file.path().extension() == ".wal") {
+            segments.push_back(file.path().string());
+        }
+    }
+    // indexes are zero padded, so name order is write order
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
 
-//     };
-//     return writeEntry(node_id, entry);
-// }
+void WAL::closeSegment() {
+    if (segment_fd_ < 0) {
+        return;
+    }
+    if (!writer_->drain()) {
+        std::cerr << "WAL writes to segment " << segment_index_ << " failed" << std::endl;
+    }
+    ::fdatasync(segment_fd_);
+    ::close(segment_fd_);
+    segment_fd_ = -1;
+    // don't leave a preallocated but empty segment behind on every restart
+    if (segment_offset_ == 0) {
+        ::unlink(segment_path_.c_str());
+    }
+}
 
-bool WAL::writeEntry(const std::string& node_id, LogEntry&& entry) {
-    std::lock_guard<std::mutex> lock(log_mutex_);
-    
-    // serialize the entry
-    const std::string& serialized = serializeEntry(node_id, entry);
+bool WAL::openNextSegment() {
+    closeSegment();
 
-    // write length prefix
-    uint32_t length = serialized.size();
+    char name[64];
+    std::snprintf(name, sizeof(name), "segment-%012llu.wal", static_cast<unsigned long long>(++segment_index_));
+    std::string path = (std::filesystem::path(log_path_) / name).string();
+    segment_path_ = path;
 
-   
-    if (!log_file_.write(reinterpret_cast<char*>(&length), sizeof(length))) {
-        std::cerr << "Failed to write length prefix to WAL" << std::endl;
-        return false;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+    if (options_.direct_io) {
+        flags |= O_DIRECT;
     }
-
-    if (!log_file_.write(serialized.data(), serialized.size())) {
-        std::cerr << "Failed to write serialized data to WAL" << std::endl;
+#endif
+    segment_fd_ = ::open(path.c_str(), flags, 0644);
+#ifdef O_DIRECT
+    if (segment_fd_ < 0 && options_.direct_io && errno == EINVAL) {
+        // tmpfs and some overlay filesystems refuse O_DIRECT
+        std::cerr << "O_DIRECT not supported for " << path << ", using buffered writes" << std::endl;
+        options_.direct_io = false;
+        segment_fd_ = ::open(path.c_str(), flags & ~O_DIRECT, 0644);
+    }
+#elif defined(F_NOCACHE)
+    if (segment_fd_ >= 0 && options_.direct_io) {
+        ::fcntl(segment_fd_, F_NOCACHE, 1);
+    }
+#endif
+    if (segment_fd_ < 0) {
+        std::cerr << "Failed to open WAL segment " << path << ": " << std::strerror(errno) << std::endl;
         return false;
     }
 
-  
-    log_file_.flush();
-
-    if (log_file_.fail()) {
-        std::cerr << "Failed to write to WAL file" << std::endl;
-        return false;
+    if (options_.preallocate) {
+        // the reserved range reads back as zeros, which recovery treats as the end of the segment
+#ifdef __linux__
+        int ret = ::fallocate(segment_fd_, 0, 0, static_cast<off_t>(options_.segment_size));
+#else
+        int ret = ::ftruncate(segment_fd_, static_cast<off_t>(options_.segment_size));
+#endif
+        if (ret != 0) {
+            std::cerr << "Failed to preallocate WAL segment " << path << ": " << std::strerror(errno) << std::endl;
+        }
     }
 
-    
+    segment_offset_ = 0;
+    tail_block_.clear();
     return true;
 }
 
+bool WAL::writeEntry(const std::string& node_id, LogEntry&& entry) {
+    // a batch of one, so single entries use the same framing recovery expects
+    std::vector<LogEntry> entries;
+    entries.push_back(std::move(entry));
+    return writeBatch(node_id, entries);
+}
+
 uint32_t WAL::calculateCRC32(const std::string& data) {
     boost::crc_32_type result;
     result.process_bytes(data.data(), data.length());
@@ -83,9 +155,15 @@ std::string WAL::serializeEntry(const std::string& node_id, const LogEntry& entr
 
     proto_entry.set_sequence_number(entry.sequence_number);
     proto_entry.set_op_type(static_cast<distributed_cache::WALEntry_OperationType>(entry.op_type));
-    proto_entry.set_key(entry.key);
+    // the cache keys namespaced entries by a prefix, the log keeps the namespace as a field of its own
+    std::string ns;
+    std::string key;
+    splitNamespacedKey(entry.key, ns, key);
+    proto_entry.set_key(key);
+    proto_entry.set_namespace_(ns);
     proto_entry.set_value(entry.value);
     proto_entry.set_ttl(entry.ttl);
+    proto_entry.set_version(entry.version);
 
     // convert timestamp to milliseconds
     proto_entry.set_timestamp(
@@ -104,8 +182,12 @@ std::string WAL::serializeEntry(const std::string& node_id, const LogEntry& entr
 }
 
 LogEntry WAL::deserializeEntry(const std::string& data) {
+    return deserializeEntry(data.data(), data.size());
+}
+
+LogEntry WAL::deserializeEntry(const char* data, std::size_t length) {
     distributed_cache::WALEntry proto_entry;
-    if (!proto_entry.ParseFromString(data)) {
+    if (!proto_entry.ParseFromArray(data, static_cast<int>(length))) {
         throw std::runtime_error("Failed to parse WAL entry");
     }
     
@@ -119,15 +201,16 @@ LogEntry WAL::deserializeEntry(const std::string& data) {
     }
 
     LogEntry entry{
-        .sequence_number = proto_entry.sequence_number(),
         .op_type = static_cast<LogEntry::OpType>(proto_entry.op_type()),
-        .key = proto_entry.key(),
+        .node_id = proto_entry.node_id(),
+        .key = namespacedKey(proto_entry.namespace_(), proto_entry.key()),
         .value = proto_entry.value(),
         .ttl = proto_entry.ttl(),
         .timestamp = std::chrono::system_clock::time_point(
             std::chrono::milliseconds(proto_entry.timestamp())
         ),
-        .node_id = proto_entry.node_id()
+        .sequence_number = proto_entry.sequence_number(),
+        .version = proto_entry.version()
 
     };
 
@@ -138,47 +221,77 @@ LogEntry WAL::deserializeEntry(const std::string& data) {
 
 
 bool WAL::writeBatch(const std::string& node_id, std::vector<LogEntry>& entries) {
+    if (entries.empty()) {
+        // a zero batch count marks the end of a segment
+        return true;
+    }
     
     std::lock_guard<std::mutex> lock(log_mutex_);
 
+    if (writer_->failed()) {
+        // an earlier asynchronous write failed; this batch would land behind its hole, so move on to a fresh
+        // segment and report the failure
+        std::cerr << "Earlier write to WAL segment " << segment_index_ << " failed" << std::endl;
+        openNextSegment();
+        return false;
+    }
+
     // precalculate the total size and serialize all entries
     std::vector<std::string> serialized_entries;
     serialized_entries.reserve(entries.size());
-    uint32_t total_size = 0;
+    std::size_t total_size = sizeof(uint32_t);
 
     for (const auto& entry : entries) {
         std::string serialized = serializeEntry(node_id, entry);
         total_size += sizeof(uint32_t) + serialized.size();
-        serialized_entries.push_back(serialized);
+        serialized_entries.push_back(std::move(serialized));
+    }
+
+    // rotate before the batch, a batch never spans two segments
+    if (segment_offset_ > 0 && segment_offset_ + total_size > options_.segment_size) {
+        if (!openNextSegment()) {
+            return false;
+        }
     }
+
+    // with O_DIRECT the write starts at the block boundary, so the carried tail goes first
+    std::size_t head = options_.direct_io ? tail_block_.size() : 0;
+    AlignedBuffer buffer(head + total_size, BLOCK_SIZE_);
+    if (head > 0) {
+        buffer.append(tail_block_.data(), head);
+    }
+
     // write batch size
     uint32_t batch_size = entries.size();
-    if (!log_file_.write(reinterpret_cast<char*>(&batch_size), sizeof(batch_size))) {
-        std::cerr << "Failed to write batch size to WAL" << std::endl;
-        return false;
-    }
+    buffer.append(&batch_size, sizeof(batch_size));
 
     for (const auto& serialized : serialized_entries) {
         uint32_t length = serialized.size();
+        buffer.append(&length, sizeof(length));
+        buffer.append(serialized.data(), serialized.size());
+    }
 
-        if (!log_file_.write(reinterpret_cast<char*>(&length), sizeof(length))) {
-            std ::cerr << "Failed to write length prefix to WAL" << std::endl;
-            return false;
-        }
-
-        // write serialized data 
-        if (!log_file_.write(serialized.data(), serialized.size())) {
-            std::cerr << "Failed to write serialized data to WAL" << std::endl;
-            return false;
-        }
-
+    off_t write_offset = static_cast<off_t>(segment_offset_ - head);
+    std::size_t next_offset = segment_offset_ + total_size;
 
+    std::vector<char> next_tail;
+    if (options_.direct_io) {
+        std::size_t tail = next_offset % BLOCK_SIZE_;
+        next_tail.assign(buffer.data() + buffer.size() - tail, buffer.data() + buffer.size());
+        buffer.padToAlignment();
     }
-    log_file_.flush();
 
-    if (log_file_.fail()){
-        std::cerr << "Failed to write batch to WAL file" << std::endl;
+    // consecutive O_DIRECT writes overlap in the tail block and must not be reordered
+    if (!writer_->submit(segment_fd_, write_offset, std::move(buffer), options_.direct_io)){
+        std::cerr << "Failed to write batch to WAL segment" << std::endl;
+        // part of this batch or an earlier one that failed asynchronously may be missing from the file, so later
+        // batches go to a fresh segment instead of after a hole or torn data recovery would stop at
+        openNextSegment();
         return false;
     }
+    segment_offset_ = next_offset;
+    if (options_.direct_io) {
+        tail_block_ = std::move(next_tail);
+    }
     return true;
-}
\ No newline at end of file
+}
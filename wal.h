@@ -1,12 +1,15 @@
 #ifndef WAL_H
 #define WAL_H
 
+#include "wal_io.h"
+
 #include <string>
-#include <fstream> 
 #include <atomic>
 #include <mutex>
 #include <string>
 #include <chrono>
+#include <memory>
+#include <vector>
 
 
 struct LogEntry {
@@ -21,27 +24,68 @@ struct LogEntry {
     int64_t ttl;
     std::chrono::system_clock::time_point timestamp;
     uint64_t sequence_number;
+    // atomic operations are logged as the PUT of their result, so this is the version the primary assigned.
+    // 0 if the writer assigned none, recovery then orders the entry by its timestamp
+    uint64_t version;
+
+};
 
+struct WALOptions {
+    // a new segment file is started once the current one would grow past this size
+    std::size_t segment_size = 64 * 1024 * 1024;
+    // reserve the blocks of each segment up front so appends never extend the file
+    bool preallocate = true;
+    // submit writes through io_uring when available, pwritev otherwise
+    bool use_io_uring = true;
+    // bypass the page cache, every write is padded out to whole blocks
+    bool direct_io = false;
+    // maximum number of batches in flight before the flush thread waits
+    unsigned queue_depth = 64;
 };
 
 class WAL {
 private:
+    static constexpr std::size_t BLOCK_SIZE_ = 4096;
+
     std::string log_path_;
-    std::ofstream log_file_;
+    WALOptions options_;
+    std::unique_ptr<WALWriter> writer_;
+    int segment_fd_ = -1;
+    std::string segment_path_;
+    uint64_t segment_index_ = 0;
+    // logical end of the data in the current segment
+    std::size_t segment_offset_ = 0;
+    // O_DIRECT only: the partially filled last block, rewritten together with the next batch
+    std::vector<char> tail_block_;
     // std::atomic<uint64_t> sequence_number_{0};
     std::mutex log_mutex_;
 
+    // finish the current segment and open the next one, caller must hold log_mutex_
+    bool openNextSegment();
+    void closeSegment();
 
 public:
    
-    WAL(const std::string& path);
+    // segments go to <wal_dir>/<node_id>/, so nodes sharing a host never share a file
+    WAL(const std::string& wal_dir, const std::string& node_id, const WALOptions& options = WALOptions());
+    ~WAL();
+    WAL(const WAL&) = delete;
+    WAL& operator=(const WAL&) = delete;
+
     // bool logPut(const std::string& node_id, const std::string& key, const std::string& value, int64_t ttl);
     // bool logRemove(const std::string& node_id, const std::string& key);
     const std::string& getLogPath() const {return log_path_;}
+    static std::string segmentDirectory(const std::string& wal_dir, const std::string& node_id);
+    // segment files of a node in write order
+    static std::vector<std::string> listSegments(const std::string& segment_dir);
     static std::string serializeEntry(const std::string& node_id, const LogEntry& entry);
     static LogEntry deserializeEntry(const std::string& data);
+    // parse straight out of a mapped buffer, avoids copying the record into a string first
+    static LogEntry deserializeEntry(const char* data, std::size_t length);
     bool writeEntry(const std::string& node_id, LogEntry&& entry);
     bool writeBatch(const std::string& node_id, std::vector<LogEntry>& entries);
+    // wait until every submitted batch reached the file, false if one of them failed
+    bool drain();
 private:
     static uint32_t calculateCRC32(const std::string& data);
     
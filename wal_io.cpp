@@ -0,0 +1,222 @@
+#include "wal_io.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <sys/uio.h>
+#include <unistd.h>
+
+AlignedBuffer::AlignedBuffer(std::size_t capacity, std::size_t alignment)
+    : capacity_(capacity)
+    , alignment_(alignment) {
+    // round up so padToAlignment never has to grow the buffer
+    capacity_ = (capacity_ + alignment_ - 1) / alignment_ * alignment_;
+    void* memory = nullptr;
+    if (posix_memalign(&memory, alignment_, capacity_ == 0 ? alignment_ : capacity_) != 0) {
+        throw std::bad_alloc();
+    }
+    data_ = static_cast<char*>(memory);
+}
+
+AlignedBuffer::~AlignedBuffer() {
+    std::free(data_);
+}
+
+AlignedBuffer::AlignedBuffer(AlignedBuffer&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr))
+    , size_(std::exchange(other.size_, 0))
+    , capacity_(std::exchange(other.capacity_, 0))
+    , alignment_(other.alignment_) {}
+
+AlignedBuffer& AlignedBuffer::operator=(AlignedBuffer&& other) noexcept {
+    if (this != &other) {
+        std::free(data_);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        capacity_ = std::exchange(other.capacity_, 0);
+        alignment_ = other.alignment_;
+    }
+    return *this;
+}
+
+void AlignedBuffer::append(const void* bytes, std::size_t length) {
+    if (size_ + length > capacity_) {
+        throw std::length_error("AlignedBuffer overflow");
+    }
+    std::memcpy(data_ + size_, bytes, length);
+    size_ += length;
+}
+
+void AlignedBuffer::padToAlignment() {
+    std::size_t padded = (size_ + alignment_ - 1) / alignment_ * alignment_;
+    std::memset(data_ + size_, 0, padded - size_);
+    size_ = padded;
+}
+
+// write the whole range, retrying on short writes and EINTR
+static bool writeFully(int fd, off_t offset, const char* data, std::size_t length) {
+    while (length > 0) {
+        struct iovec iov{const_cast<char*>(data), length};
+        ssize_t written = ::pwritev(fd, &iov, 1, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "WAL pwritev failed: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        data += written;
+        offset += written;
+        length -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+bool PwritevWriter::submit(int fd, off_t offset, AlignedBuffer&& buffer, bool ordered) {
+    // already in order, every write finishes before the next one starts
+    (void)ordered;
+    if (!writeFully(fd, offset, buffer.data(), buffer.size())) {
+        failed_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool PwritevWriter::drain() {
+    bool ok = !failed_;
+    failed_ = false;
+    return ok;
+}
+
+std::unique_ptr<WALWriter> WALWriter::create(bool prefer_io_uring, unsigned queue_depth) {
+#ifdef CACHEMESH_HAVE_IO_URING
+    if (prefer_io_uring) {
+        try {
+            return std::make_unique<IoUringWriter>(queue_depth);
+        } catch (const std::exception& e) {
+            std::cerr << "io_uring unavailable, falling back to pwritev: " << e.what() << std::endl;
+        }
+    }
+#else
+    (void)prefer_io_uring;
+    (void)queue_depth;
+#endif
+    return std::make_unique<PwritevWriter>();
+}
+
+#ifdef CACHEMESH_HAVE_IO_URING
+
+IoUringWriter::IoUringWriter(unsigned queue_depth) : queue_depth_(queue_depth) {
+    int ret = io_uring_queue_init(queue_depth_, &ring_, 0);
+    if (ret < 0) {
+        throw std::runtime_error(std::string("io_uring_queue_init: ") + std::strerror(-ret));
+    }
+}
+
+IoUringWriter::~IoUringWriter() {
+    drain();
+    io_uring_queue_exit(&ring_);
+}
+
+void IoUringWriter::complete(struct io_uring_cqe* cqe) {
+    auto* pending = static_cast<PendingWrite*>(io_uring_cqe_get_data(cqe));
+    int res = cqe->res;
+    io_uring_cqe_seen(&ring_, cqe);
+    --in_flight_;
+    if (pending == nullptr) {
+        return;
+    }
+
+    if (res < 0) {
+        std::cerr << "WAL io_uring write failed: " << std::strerror(-res) << std::endl;
+        failed_ = true;
+    } else if (static_cast<std::size_t>(res) < pending->buffer.size()) {
+        // short write, rare enough to finish inline
+        std::size_t done = static_cast<std::size_t>(res);
+        if (!writeFully(pending->fd, pending->offset + done, pending->buffer.data() + done, pending->buffer.size() - done)) {
+            failed_ = true;
+        }
+    }
+    delete pending;
+}
+
+void IoUringWriter::reap() {
+    struct io_uring_cqe* cqe = nullptr;
+    while (in_flight_ > 0 && io_uring_peek_cqe(&ring_, &cqe) == 0) {
+        complete(cqe);
+    }
+}
+
+bool IoUringWriter::submit(int fd, off_t offset, AlignedBuffer&& buffer, bool ordered) {
+    reap();
+    // bound the number of buffers held by the kernel
+    while (in_flight_ >= queue_depth_) {
+        struct io_uring_cqe* cqe = nullptr;
+        if (io_uring_wait_cqe(&ring_, &cqe) < 0) {
+            failed_ = true;
+            return false;
+        }
+        complete(cqe);
+    }
+    if (failed_) {
+        // an earlier write failed, anything written after it would sit behind a hole recovery stops at
+        return false;
+    }
+
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+    if (sqe == nullptr) {
+        // completions are bounded above, so the submission queue only fills if we forgot to submit
+        io_uring_submit(&ring_);
+        sqe = io_uring_get_sqe(&ring_);
+        if (sqe == nullptr) {
+            failed_ = true;
+            return false;
+        }
+    }
+
+    auto* pending = new PendingWrite{fd, offset, std::move(buffer), {}};
+    pending->iov.iov_base = pending->buffer.data();
+    pending->iov.iov_len = pending->buffer.size();
+
+    io_uring_prep_writev(sqe, fd, &pending->iov, 1, offset);
+    io_uring_sqe_set_data(sqe, pending);
+    if (ordered) {
+        sqe->flags |= IOSQE_IO_DRAIN;
+    }
+
+    ++in_flight_;
+    int ret = io_uring_submit(&ring_);
+    if (ret < 0 && ret != -EAGAIN && ret != -EBUSY) {
+        // the kernel hasn't consumed the sqe, and the next submit or drain would still send it to this fd and
+        // offset. Turn it into a nop so the write the caller is told failed never lands
+        std::cerr << "io_uring_submit failed: " << std::strerror(-ret) << std::endl;
+        io_uring_prep_nop(sqe);
+        io_uring_sqe_set_data(sqe, nullptr);
+        delete pending;
+        failed_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool IoUringWriter::drain() {
+    if (in_flight_ > 0) {
+        io_uring_submit(&ring_);
+    }
+    while (in_flight_ > 0) {
+        struct io_uring_cqe* cqe = nullptr;
+        int ret = io_uring_wait_cqe(&ring_, &cqe);
+        if (ret < 0) {
+            if (ret == -EINTR) continue;
+            failed_ = true;
+            break;
+        }
+        complete(cqe);
+    }
+    bool ok = !failed_;
+    failed_ = false;
+    return ok;
+}
+
+#endif
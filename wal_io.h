@@ -0,0 +1,104 @@
+#ifndef WAL_IO_H
+#define WAL_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef CACHEMESH_HAVE_IO_URING
+#include <liburing.h>
+#endif
+
+// heap buffer aligned for O_DIRECT, owns its memory
+class AlignedBuffer {
+private:
+    char* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t capacity_ = 0;
+    std::size_t alignment_ = 4096;
+
+public:
+    AlignedBuffer() = default;
+    AlignedBuffer(std::size_t capacity, std::size_t alignment = 4096);
+    ~AlignedBuffer();
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+    AlignedBuffer(AlignedBuffer&& other) noexcept;
+    AlignedBuffer& operator=(AlignedBuffer&& other) noexcept;
+
+    void append(const void* bytes, std::size_t length);
+    // zero-fill up to the next multiple of the alignment
+    void padToAlignment();
+
+    char* data() { return data_; }
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+};
+
+// positional writes into WAL segment files.
+// submit() may return before the data reaches the file, the writer keeps the buffer alive until it does
+class WALWriter {
+public:
+    virtual ~WALWriter() = default;
+
+    // ordered writes start only after every earlier write completed (needed when writes overlap)
+    virtual bool submit(int fd, off_t offset, AlignedBuffer&& buffer, bool ordered) = 0;
+    // wait for all submitted writes, false if any of them failed since the last drain
+    virtual bool drain() = 0;
+    // a write failed since the last drain, so the segment may have a hole after it
+    virtual bool failed() const = 0;
+    virtual const char* name() const = 0;
+
+    // io_uring when it is compiled in and the kernel allows it, pwritev otherwise
+    static std::unique_ptr<WALWriter> create(bool prefer_io_uring, unsigned queue_depth);
+};
+
+// synchronous fallback, the flush thread blocks in pwritev
+class PwritevWriter : public WALWriter {
+private:
+    bool failed_ = false;
+
+public:
+    bool submit(int fd, off_t offset, AlignedBuffer&& buffer, bool ordered) override;
+    bool drain() override;
+    bool failed() const override { return failed_; }
+    const char* name() const override { return "pwritev"; }
+};
+
+#ifdef CACHEMESH_HAVE_IO_URING
+class IoUringWriter : public WALWriter {
+private:
+    struct PendingWrite {
+        int fd;
+        off_t offset;
+        AlignedBuffer buffer;
+        struct iovec iov;
+    };
+
+    struct io_uring ring_;
+    unsigned queue_depth_;
+    unsigned in_flight_ = 0;
+    bool failed_ = false;
+
+    // handle one completion, finishing short writes synchronously. A write withdrawn after a failed submit
+    // completes as a nop without data
+    void complete(struct io_uring_cqe* cqe);
+    // collect whatever completed without blocking
+    void reap();
+
+public:
+    // throws if the kernel refuses to set up a ring
+    explicit IoUringWriter(unsigned queue_depth);
+    ~IoUringWriter() override;
+
+    bool submit(int fd, off_t offset, AlignedBuffer&& buffer, bool ordered) override;
+    bool drain() override;
+    bool failed() const override { return failed_; }
+    const char* name() const override { return "io_uring"; }
+};
+#endif
+
+#endif
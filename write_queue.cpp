@@ -2,28 +2,44 @@
 #include <future>
 #include <iostream>
 
-WriteQueue::WriteQueue(const std::string& wal_path, const std::string& node_id, std::size_t batch_size, std::chrono::milliseconds flush_interval)
-    : wal_(WAL(wal_path))
+WriteQueue::WriteQueue(const std::string& wal_path, const std::string& node_id, const WriteQueueOptions& options, const WALOptions& wal_options)
+    : ring_(options.capacity)
+    , wal_(wal_path, node_id, wal_options)
     , node_id_(node_id)
-    , batch_size_(batch_size)
-    , flush_interval_(flush_interval) {}
+    , batch_size_(options.batch_size)
+    , flush_interval_(options.flush_interval)
+    , backpressure_(options.backpressure) {
+    auto& metrics = MetricsRegistry::instance();
+    batch_entries_ = metrics.histogram("cachemesh_wal_batch_entries", "Entries per WAL batch write");
+    flush_latency_ = metrics.histogram("cachemesh_wal_flush_latency_microseconds", "Time to hand one batch to the WAL");
+    write_failures_ = metrics.counter("cachemesh_wal_write_failures_total", "WAL batch writes that failed");
+    rejected_ = metrics.counter("cachemesh_write_queue_rejected_total", "Writes rejected because the write queue was full");
+    spilled_ = metrics.counter("cachemesh_write_queue_spilled_total", "Writes parked in the overflow list because the write queue was full");
+    metrics.gauge("cachemesh_write_queue_depth", "Entries waiting to be written to the WAL", {},
+                  [this]() { return static_cast<double>(size()); }, this);
+}
 
 WriteQueue::~WriteQueue(){
+    MetricsRegistry::instance().removeCallbacks(this);
     stop();
 }
 
 void WriteQueue::start() {
     running_ = true;
-    // start this thread 
+    // start this thread
     flush_thread_ = std::thread(&WriteQueue::flushLoop, this);
 
 }
 
 void WriteQueue::stop() {
-    running_ = false;
+    {
+        // taken so the flush thread can't miss the wakeup between its predicate check and sleeping
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        running_ = false;
+    }
 
-    // currently we only have one thread, but may add additional threads in the future 
-    // change to notify_all if more threads 
+    // currently we only have one thread, but may add additional threads in the future
+    // change to notify_all if more threads
     cv_.notify_one();
 
 
@@ -33,82 +49,139 @@ void WriteQueue::stop() {
 
 }
 
-void WriteQueue::enqueue(LogEntry&& op) {
-    {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        queue_.push(op); 
+bool WriteQueue::enqueue(LogEntry&& op) {
+    for (;;) {
+        // tryPush only moves from op when it succeeds
+        if (!spilling_.load(std::memory_order_acquire) && ring_.tryPush(std::move(op))) {
+            break;
+        }
+        if (backpressure_ == BackpressurePolicy::SPILL) {
+            spill(std::move(op));
+            MetricsRegistry::instance().add(spilled_);
+            break;
+        }
+        if (backpressure_ == BackpressurePolicy::FAIL_FAST) {
+            MetricsRegistry::instance().add(rejected_);
+            return false;
+        }
+        // BLOCK: make sure the flush thread is draining and back off until a slot frees up
+        cv_.notify_one();
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
     }
-    cv_.notify_one(); // notify the flush thread, does cv_ needs the lock? hmmm
+
+    // a notify without waiters is cheap, but only wake the flush thread for a full batch
+    if (size() >= batch_size_) {
+        cv_.notify_one();
+    }
+    return true;
 }
 
-void WriteQueue::flushLoop() {
-    std::vector<LogEntry> batch;
+void WriteQueue::spill(LogEntry&& op) {
+    std::lock_guard<std::mutex> lock(spill_mutex_);
+    spill_.push_back(std::move(op));
+    ++spill_size_;
+    spilling_.store(true, std::memory_order_release);
+}
 
+void WriteQueue::flushLoop() {
     while (running_) {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
-
-
-        // since cv_ acquires the lock, it still holds the queue_mutex_ even after passing the cv_.wait call
-        cv_.wait_for(lock, flush_interval_, [this] {return !running_ ||  queue_.size() >= batch_size_;});
-
-        if (!running_ && queue_.empty()) {
-            break;
+        {
+            std::unique_lock<std::mutex> lock(wait_mutex_);
+            cv_.wait_for(lock, flush_interval_, [this] {return !running_ || size() >= batch_size_;});
         }
-        lock.unlock();
-   
+
         // process by batch
         processBatch();
-        // lock.lock();
 
     }
-    
+
     processBatch();
 }
 
 void WriteQueue::processBatch() {
-    std::vector<LogEntry> batch;
-    {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        while (size() > 0) {
-            batch.push_back(std::move(queue_.front()));
-            queue_.pop();
+    std::lock_guard<std::mutex> lock(flush_mutex_);
+    processBatchLocked();
+}
 
+void WriteQueue::processBatchLocked() {
+    std::vector<LogEntry> batch;
+    batch.reserve(size());
+    // one consumer at a time under flush_mutex_, producers never take it
+    ring_.drain(batch, ring_.capacity());
+
+    // while spilling, producers bypass the ring, so the spilled entries come after everything drained above
+    if (spilling_.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(spill_mutex_);
+        // pick up producers that passed the spilling check just before it flipped
+        ring_.drain(batch, ring_.capacity());
+        while (!spill_.empty()) {
+            batch.push_back(std::move(spill_.front()));
+            spill_.pop_front();
         }
+        spill_size_ = 0;
+        spilling_.store(false, std::memory_order_release);
+    }
+
+    if(batch.empty())
+        return;
+
+    auto& metrics = MetricsRegistry::instance();
+    metrics.observe(batch_entries_, batch.size());
+    ScopedLatency latency(flush_latency_);
+    if (!wal_.writeBatch(node_id_, batch)) {
+        metrics.add(write_failures_);
     }
-    if(!batch.empty())
-        wal_.writeBatch(node_id_, batch);
 
 
-}   
+}
 
 
 std::size_t WriteQueue::size() {
-    return queue_.size();
+    return ring_.size() + spill_size_.load(std::memory_order_relaxed);
 }
 
 
-void WriteQueue::logPut(const std::string& key, const std::string& value, int64_t ttl) {
-    // construct the LogEntry first 
+bool WriteQueue::logPut(const std::string& key, const std::string& value, int64_t ttl, uint64_t version) {
+    // construct the LogEntry first
     LogEntry entry{
+        .op_type = LogEntry::OpType::PUT,
         .key = key,
         .value = value,
         .ttl = ttl,
+        .timestamp = std::chrono::system_clock::now(),
         .sequence_number = ++sequence_number_,
-        .op_type = LogEntry::OpType::PUT,
-        .timestamp = std::chrono::system_clock::now()
+        .version = version
     };
-    enqueue(std::move(entry));
+    return enqueue(std::move(entry));
 
 }
 
 
-void WriteQueue::logRemove(const std::string& key) {
+bool WriteQueue::logBatch(std::vector<LogEntry>& entries) {
+    for (auto& entry : entries) {
+        entry.sequence_number = ++sequence_number_;
+    }
+    std::lock_guard<std::mutex> lock(flush_mutex_);
+    // whatever was queued before goes first, so the log keeps the order the writes were applied in
+    processBatchLocked();
+    auto& metrics = MetricsRegistry::instance();
+    metrics.observe(batch_entries_, entries.size());
+    ScopedLatency latency(flush_latency_);
+    if (!wal_.writeBatch(node_id_, entries)) {
+        metrics.add(write_failures_);
+        return false;
+    }
+    return true;
+}
+
+bool WriteQueue::logRemove(const std::string& key, uint64_t version) {
     LogEntry entry{
+        .op_type = LogEntry::OpType::REMOVE,
         .key = key,
+        .timestamp = std::chrono::system_clock::now(),
         .sequence_number = ++sequence_number_,
-        .op_type = LogEntry::OpType::REMOVE,
-        .timestamp = std::chrono::system_clock::now()
+        .version = version
 
     };
-    enqueue(std::move(entry));
+    return enqueue(std::move(entry));
 }
@@ -2,7 +2,9 @@
 #define WRITE_QUEUE_H
 
 #include "wal.h"
-#include <queue>
+#include "mpsc_ring.h"
+#include "metrics.h"
+#include <deque>
 #include <mutex>
 #include <condition_variable>
 #include <string>
@@ -12,10 +14,29 @@
 #include <memory>
 #include <vector>
 
+// what enqueue does when the ring is full
+enum class BackpressurePolicy {
+    // wait for the flush thread to free slots
+    BLOCK,
+    // reject the write, the caller reports it to the client
+    FAIL_FAST,
+    // park entries in an unbounded overflow list until the ring catches up
+    SPILL
+};
+
+struct WriteQueueOptions {
+    std::size_t batch_size = 100;
+    std::chrono::milliseconds flush_interval = std::chrono::milliseconds(10000);
+    // number of preallocated ring slots, rounded up to a power of two
+    std::size_t capacity = 64 * 1024;
+    BackpressurePolicy backpressure = BackpressurePolicy::BLOCK;
+};
+
 class WriteQueue {
 private:
-    std::queue<LogEntry> queue_;
-    std::mutex queue_mutex_;
+    MPSCRing<LogEntry> ring_;
+    // only used by the flush thread to sleep, producers never take it
+    std::mutex wait_mutex_;
     std::condition_variable cv_;
     std::atomic<bool> running_{false};
     std::thread flush_thread_;
@@ -23,22 +44,45 @@ private:
     std::string node_id_;
     std::atomic<std::size_t> sequence_number_{0};
 
+    // overflow for BackpressurePolicy::SPILL, touched only while the ring is full
+    std::mutex spill_mutex_;
+    std::deque<LogEntry> spill_;
+    // once set, new entries go behind the spilled ones to keep the log in order
+    std::atomic<bool> spilling_{false};
+    std::atomic<std::size_t> spill_size_{0};
+
     const std::size_t batch_size_;
     const std::chrono::milliseconds flush_interval_;
+    const BackpressurePolicy backpressure_;
+
+    MetricsRegistry::Histogram batch_entries_;
+    MetricsRegistry::Histogram flush_latency_;
+    MetricsRegistry::Counter write_failures_;
+    MetricsRegistry::Counter rejected_;
+    MetricsRegistry::Counter spilled_;
+
+    // serializes the two ways entries reach the WAL: batches drained from the ring and logBatch
+    std::mutex flush_mutex_;
 
     void processBatch();
+    void processBatchLocked();
     void flushLoop();
+    void spill(LogEntry&& op);
 
 public:
-    WriteQueue(const std::string& wal_path, const std::string& node_id, std::size_t batch_size = 100, std::chrono::milliseconds flush_interval = std::chrono::milliseconds(10000));
+    WriteQueue(const std::string& wal_path, const std::string& node_id, const WriteQueueOptions& options = WriteQueueOptions(), const WALOptions& wal_options = WALOptions());
     ~WriteQueue();
 
     void start();
     void stop();
 
-    void logPut(const std::string& key, const std::string& value, int64_t ttl);
-    void logRemove(const std::string& key);
-    void enqueue(LogEntry&& op);
+    // false only under BackpressurePolicy::FAIL_FAST when the ring is full
+    bool logPut(const std::string& key, const std::string& value, int64_t ttl, uint64_t version = 0);
+    bool logRemove(const std::string& key, uint64_t version = 0);
+    bool enqueue(LogEntry&& op);
+    // write entries straight to the WAL as one batch, after everything queued so far. For bulk loads, where
+    // passing through the ring one entry at a time costs more than the write. False if the write failed
+    bool logBatch(std::vector<LogEntry>& entries);
     std::size_t size() ;
 };
 #endif